@@ -0,0 +1,29 @@
+#ifndef ARRAY_VIEW_HPP
+#define ARRAY_VIEW_HPP
+
+#include <cstddef>
+
+/**
+ * @brief Read only view of a contiguous array owned by someone else, like a
+ * C++20 std::span<const T>
+ */
+template<typename T>
+class array_view
+{
+public:
+	array_view() : ptr(nullptr), count(0){}
+	array_view(const T *ptr, size_t count) : ptr(ptr), count(count){}
+
+	const T *data() const {return ptr;}
+	size_t size() const {return count;}
+	bool empty() const {return count == 0;}
+	const T *begin() const {return ptr;}
+	const T *end() const {return ptr + count;}
+	const T &operator[](size_t i) const {return ptr[i];}
+
+private:
+	const T *ptr;
+	size_t count;
+};
+
+#endif
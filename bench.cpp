@@ -0,0 +1,631 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <omp.h>
+#include <boost/program_options.hpp>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "physics.hpp"
+#include "numa.hpp"
+
+namespace po = boost::program_options;
+
+/**
+ * @brief One benchmark configuration and what it measured
+ */
+struct bench_result
+{
+	uint32_t obj_count;
+	int threads;
+	std::string force;
+	std::string kernel;
+	std::string precision;
+	std::string integrator;
+	uint64_t steps;
+	double seconds;
+	double steps_per_sec;
+	uint64_t interactions;
+	double ns_per_interaction;
+	double parallel_efficiency;
+	/**
+	 * @brief Peak resident memory of this configuration alone, from init()
+	 * to the end of its steps. Where reset_peak_rss() can't reset the peak
+	 * it is the running max of the whole process instead.
+	 */
+	double peak_rss_mb;
+	/**
+	 * @brief |E_end - E_start| / |E_start| over the warm up and timed steps,
+	 * NaN when N was too big to sum the energy
+	 */
+	double energy_drift;
+};
+
+/**
+ * @brief A force method, kernel and integrator combination to sweep over N
+ * and thread counts
+ */
+struct bench_config
+{
+	physics::force_method force;
+	simd_isa isa;
+	precision prec;
+	physics::integrator integ;
+};
+
+/**
+ * @brief Sets the peak RSS back to the current RSS so the next
+ * peak_rss_mb() only covers what runs after it, Linux only
+ * @return False if the peak can't be reset here, it is then a running max
+ */
+static bool reset_peak_rss()
+{
+#if defined(__linux__)
+	// 5 resets VmHWM, since Linux 4.0
+	FILE *f = fopen("/proc/self/clear_refs", "w");
+	if(f == nullptr)
+		return false;
+	bool ok = fputs("5", f) >= 0;
+	ok = fclose(f) == 0 && ok;
+	return ok;
+#else
+	return false;
+#endif
+}
+
+static double peak_rss_mb()
+{
+#if defined(__linux__)
+	// VmHWM is what reset_peak_rss() resets, ru_maxrss never goes down
+	FILE *f = fopen("/proc/self/status", "r");
+	if(f != nullptr)
+	{
+		char line[256];
+		unsigned long long kb = 0;
+		bool found = false;
+		while(!found && fgets(line, sizeof(line), f) != nullptr)
+			found = sscanf(line, "VmHWM: %llu kB", &kb) == 1;
+		fclose(f);
+		if(found)
+			return kb / 1024.0;
+	}
+#endif
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS pmc;
+	if(GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+		return pmc.PeakWorkingSetSize / (1024.0 * 1024.0);
+	return 0.0;
+#else
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+	// bytes on macOS
+	return usage.ru_maxrss / (1024.0 * 1024.0);
+#else
+	// kilobytes on Linux
+	return usage.ru_maxrss / 1024.0;
+#endif
+#endif
+}
+
+static std::vector<std::string> split(const std::string &s)
+{
+	std::vector<std::string> out;
+	size_t start = 0;
+	while(start < s.size())
+	{
+		size_t end = s.find(',', start);
+		if(end == std::string::npos)
+			end = s.size();
+		if(end > start)
+			out.push_back(s.substr(start, end - start));
+		start = end + 1;
+	}
+	return out;
+}
+
+/**
+ * @brief Parses a comma separated list of counts, k and M suffixes allowed
+ */
+static std::vector<uint32_t> parse_counts(const std::string &s)
+{
+	std::vector<uint32_t> out;
+	for(std::string item : split(s))
+	{
+		double scale = 1.0;
+		if(item.back() == 'k' || item.back() == 'K')
+		{
+			scale = 1000.0;
+			item.pop_back();
+		}
+		else if(item.back() == 'm' || item.back() == 'M')
+		{
+			scale = 1000000.0;
+			item.pop_back();
+		}
+		out.push_back((uint32_t)(std::stod(item) * scale));
+	}
+	return out;
+}
+
+static bool run_one(const bench_config &c, uint32_t obj_count,
+	int threads, thread_pinning pin, uint64_t seed, uint64_t steps, double dt,
+	uint32_t energy_max_n, bench_result &r)
+{
+	omp_set_num_threads(threads);
+	if(pin != thread_pinning::none)
+		pin_threads(pin);
+	// the last configuration's memory is freed by now, so the peak starts
+	// from roughly what the process needs without any bodies
+	reset_peak_rss();
+
+	physics *p = new physics();
+	p->seed(seed);
+	// keep the density constant as N grows and the bodies small so init()
+	// rarely has to move overlapping bodies
+	double side = 4.0 * std::cbrt(obj_count / 1024.0);
+	p->set_distance_range(-side, side);
+	p->set_radius_range(0.001, 0.002);
+	p->set_force_method(c.force);
+	p->set_simd_isa(c.isa);
+	p->set_precision(c.prec);
+	p->set_integrator(c.integ);
+	if(!p->init(obj_count))
+	{
+		delete p;
+		return false;
+	}
+
+	bool energy = obj_count <= energy_max_n;
+	double e0 = energy ? p->get_energy() : 0.0;
+
+	// the first step includes one off setup (first force evaluation, buffers)
+	p->step(dt);
+	uint64_t warm_interactions = p->get_interactions();
+
+	typedef std::chrono::steady_clock clock;
+	clock::time_point t0 = clock::now();
+	for(uint64_t i = 0; i < steps; i++)
+		p->step(dt);
+	clock::time_point t1 = clock::now();
+
+	r.energy_drift = NAN;
+	if(energy)
+		r.energy_drift = std::fabs(p->get_energy() - e0) / std::fabs(e0);
+	r.obj_count = obj_count;
+	r.threads = threads;
+	r.force = physics::force_method_name(c.force);
+	r.kernel = simd_isa_name(p->get_simd_isa());
+	r.precision = precision_name(c.prec);
+	r.integrator = physics::integrator_name(c.integ);
+	r.steps = steps;
+	r.seconds = std::chrono::duration<double>(t1 - t0).count();
+	r.steps_per_sec = steps / r.seconds;
+	r.interactions = p->get_interactions() - warm_interactions;
+	r.ns_per_interaction = r.interactions ? r.seconds * 1e9 / r.interactions :
+		0.0;
+	r.parallel_efficiency = 1.0;
+	r.peak_rss_mb = peak_rss_mb();
+
+	p->deinit();
+	delete p;
+	return true;
+}
+
+/**
+ * @brief Where run_bandwidth() puts the pages of its array
+ */
+enum class placement
+{
+	/**
+	 * @brief One thread writes all of it, how the per body arrays used to be
+	 * placed by a serial resize()
+	 */
+	serial,
+	/**
+	 * @brief Every thread writes its own part first
+	 */
+	first_touch,
+	/**
+	 * @brief Round robin over the nodes
+	 */
+	interleave
+};
+
+static const char *placement_name(placement p)
+{
+	switch(p)
+	{
+		case placement::first_touch:
+			return "first_touch";
+		case placement::interleave:
+			return "interleave";
+		default:
+			return "serial";
+	}
+}
+
+/**
+ * @brief Prints the read bandwidth the threads on each NUMA node get from an
+ * array of mb megabytes placed each way, every thread summing its own static
+ * part like the per body loops do. The best of repeats passes is kept per
+ * thread and a node's bandwidth is the sum over its threads.
+ */
+static void run_bandwidth(double mb, int threads, thread_pinning pin,
+	int repeats)
+{
+	omp_set_num_threads(threads);
+	if(pin != thread_pinning::none)
+		pin_threads(pin);
+	const int n = (int)(mb * 1024.0 * 1024.0 / sizeof(double));
+	const int nodes = numa_node_count();
+
+	for(placement p : {placement::serial, placement::first_touch,
+		placement::interleave})
+	{
+		aligned_vector<double> data;
+		data.resize(n);
+		if(p == placement::interleave)
+			numa_interleave(data.data(), n * sizeof(double));
+		if(p == placement::serial)
+		{
+			for(int i = 0; i < n; i++)
+				data[i] = 1.0;
+		}
+		else
+		{
+			#pragma omp parallel for
+			for(int i = 0; i < n; i++)
+				data[i] = 1.0;
+		}
+
+		std::vector<double> node_gbs(nodes, 0.0);
+		std::vector<int> node_threads(nodes, 0);
+		double sum = 0.0;
+		#pragma omp parallel reduction(+:sum)
+		{
+			int t = omp_get_thread_num();
+			int team = omp_get_num_threads();
+			int begin = (int)((int64_t)n * t / team);
+			int end = (int)((int64_t)n * (t + 1) / team);
+			double best = INFINITY;
+			for(int k = 0; k < repeats; k++)
+			{
+				#pragma omp barrier
+				double t0 = omp_get_wtime();
+				double s = 0.0;
+				#pragma omp simd reduction(+:s)
+				for(int i = begin; i < end; i++)
+					s += data[i];
+				best = std::min(best, omp_get_wtime() - t0);
+				sum += s;
+			}
+			int node = std::min(numa_current_node(), nodes - 1);
+			double gbs = (end - begin) * sizeof(double) / best * 1e-9;
+			#pragma omp critical
+			{
+				node_gbs[node] += gbs;
+				node_threads[node]++;
+			}
+		}
+		// the sum is printed so the reads can't be left out
+		double total = 0.0;
+		for(int node = 0; node < nodes; node++)
+		{
+			if(node_threads[node] == 0)
+				continue;
+			printf("%-12s %7d %5d %7d %10.2f\n", placement_name(p), threads,
+				node, node_threads[node], node_gbs[node]);
+			total += node_gbs[node];
+		}
+		printf("%-12s %7d %5s %7d %10.2f (checksum %g)\n", placement_name(p),
+			threads, "all", threads, total, sum);
+		fflush(stdout);
+	}
+}
+
+static void write_csv(const std::string &fname,
+	const std::vector<bench_result> &results)
+{
+	FILE *f = fopen(fname.c_str(), "wt");
+	if(f == NULL)
+	{
+		printf("ERROR couldn't open %s\n", fname.c_str());
+		return;
+	}
+	fprintf(f, "n,threads,force,kernel,precision,integrator,steps,seconds,"
+		"steps_per_sec,interactions,ns_per_interaction,parallel_efficiency,"
+		"peak_rss_mb,energy_drift\n");
+	for(const bench_result &r : results)
+	{
+		// an empty field when the drift wasn't measured
+		char drift[32] = "";
+		if(!std::isnan(r.energy_drift))
+			snprintf(drift, sizeof(drift), "%.6g", r.energy_drift);
+		fprintf(f, "%u,%d,%s,%s,%s,%s,%llu,%.9g,%.9g,%llu,%.9g,%.6g,%.3f,%s\n",
+			r.obj_count, r.threads, r.force.c_str(), r.kernel.c_str(),
+			r.precision.c_str(), r.integrator.c_str(),
+			(unsigned long long)r.steps, r.seconds, r.steps_per_sec,
+			(unsigned long long)r.interactions, r.ns_per_interaction,
+			r.parallel_efficiency, r.peak_rss_mb, drift);
+	}
+	fclose(f);
+}
+
+static void write_json(const std::string &fname,
+	const std::vector<bench_result> &results, uint64_t seed)
+{
+	FILE *f = fopen(fname.c_str(), "wt");
+	if(f == NULL)
+	{
+		printf("ERROR couldn't open %s\n", fname.c_str());
+		return;
+	}
+	fprintf(f, "{\n\t\"seed\": %llu,\n\t\"results\": [\n",
+		(unsigned long long)seed);
+	for(size_t i = 0; i < results.size(); i++)
+	{
+		const bench_result &r = results[i];
+		// JSON has no NaN
+		char drift[32] = "null";
+		if(!std::isnan(r.energy_drift))
+			snprintf(drift, sizeof(drift), "%.6g", r.energy_drift);
+		fprintf(f, "\t\t{\"n\": %u, \"threads\": %d, \"force\": \"%s\", "
+			"\"kernel\": \"%s\", \"precision\": \"%s\", "
+			"\"integrator\": \"%s\", \"steps\": %llu, "
+			"\"seconds\": %.9g, \"steps_per_sec\": %.9g, "
+			"\"interactions\": %llu, \"ns_per_interaction\": %.9g, "
+			"\"parallel_efficiency\": %.6g, \"peak_rss_mb\": %.3f, "
+			"\"energy_drift\": %s}%s\n",
+			r.obj_count, r.threads, r.force.c_str(), r.kernel.c_str(),
+			r.precision.c_str(), r.integrator.c_str(),
+			(unsigned long long)r.steps, r.seconds, r.steps_per_sec,
+			(unsigned long long)r.interactions, r.ns_per_interaction,
+			r.parallel_efficiency, r.peak_rss_mb, drift,
+			i + 1 < results.size() ? "," : "");
+	}
+	fprintf(f, "\t]\n}\n");
+	fclose(f);
+}
+
+int main(int argc, char **argv)
+{
+	std::string sizes_str, threads_str, forces_str, integ_str, prec_str;
+	std::string pin_name;
+	double bandwidth_mb;
+	uint64_t seed;
+	uint64_t steps;
+	double dt;
+	double max_seconds;
+	uint32_t energy_max_n;
+	std::string csv_name, json_name;
+
+	int max_threads = omp_get_max_threads();
+	std::string default_threads = "1";
+	for(int t = 2; t < max_threads; t *= 2)
+		default_threads += "," + std::to_string(t);
+	if(max_threads > 1)
+		default_threads += "," + std::to_string(max_threads);
+
+	po::options_description desc("grav_sim2_bench options");
+	desc.add_options()
+		("help,h", "print this message")
+		("sizes,n",
+			po::value<std::string>(&sizes_str)->default_value(
+				"1k,4k,16k,64k,256k,1M"),
+			"comma separated body counts, k and M suffixes are allowed")
+		("threads,t",
+			po::value<std::string>(&threads_str)->default_value(
+				default_threads), "comma separated OpenMP thread counts")
+		("force,f",
+			po::value<std::string>(&forces_str)->default_value(
+				"direct,barnes_hut,tiled"), "comma separated force methods")
+		("integrator,i",
+			po::value<std::string>(&integ_str)->default_value(
+				"leapfrog,rk4,hermite"), "comma separated integrators")
+		("precision,p",
+			po::value<std::string>(&prec_str)->default_value(
+				"double,float,mixed"),
+			"comma separated direct sum precisions")
+		("seed,s", po::value<uint64_t>(&seed)->default_value(42),
+			"random seed, fixed so runs are comparable")
+		("steps", po::value<uint64_t>(&steps)->default_value(3),
+			"timed steps per configuration")
+		("dt", po::value<double>(&dt)->default_value(0.001), "step size")
+		("max-seconds", po::value<double>(&max_seconds)->default_value(10.0),
+			"skip larger N for a configuration once a run takes longer")
+		("energy-max-n",
+			po::value<uint32_t>(&energy_max_n)->default_value(65536),
+			"largest N to measure the O(N^2) energy drift for")
+		("pin", po::value<std::string>(&pin_name)->default_value("none"),
+			"pin the threads to CPUs: none, compact or spread")
+		("bandwidth", po::value<double>(&bandwidth_mb),
+			"instead of the simulation, measure the read bandwidth of the "
+			"threads on each NUMA node from an array of this many MB placed "
+			"serially, by first touch and interleaved")
+		("csv", po::value<std::string>(&csv_name), "write results as CSV")
+		("json", po::value<std::string>(&json_name), "write results as JSON")
+	;
+
+	po::variables_map vm;
+	try
+	{
+		po::store(po::parse_command_line(argc, argv, desc), vm);
+		po::notify(vm);
+	}
+	catch(const std::exception &e)
+	{
+		std::cerr << "ERROR: " << e.what() << "\n" << desc << std::endl;
+		return 1;
+	}
+
+	if(vm.count("help"))
+	{
+		std::cout << desc << std::endl;
+		return 0;
+	}
+
+	std::vector<uint32_t> sizes;
+	std::vector<uint32_t> thread_counts;
+	try
+	{
+		sizes = parse_counts(sizes_str);
+		thread_counts = parse_counts(threads_str);
+	}
+	catch(const std::exception &e)
+	{
+		std::cerr << "ERROR: bad count list " << e.what() << std::endl;
+		return 1;
+	}
+
+	thread_pinning pin;
+	if(!parse_thread_pinning(pin_name, pin))
+	{
+		std::cerr << "ERROR: unknown thread pinning " << pin_name << std::endl;
+		return 1;
+	}
+
+	if(vm.count("bandwidth"))
+	{
+		printf("numa nodes: %d, pinning: %s\n", numa_node_count(),
+			thread_pinning_name(pin));
+		printf("%-12s %7s %5s %7s %10s\n", "placement", "threads", "node",
+			"on_node", "GB/s");
+		for(uint32_t t : thread_counts)
+			run_bandwidth(bandwidth_mb, (int)t, pin, 10);
+		return 0;
+	}
+
+	std::vector<precision> precs;
+	for(const std::string &name : split(prec_str))
+	{
+		precision prec;
+		if(!parse_precision(name, prec))
+		{
+			std::cerr << "ERROR: unknown precision " << name << std::endl;
+			return 1;
+		}
+		precs.push_back(prec);
+	}
+
+	// every force method and integrator asked for and every kernel and
+	// precision this CPU can run, Hermite, Barnes-Hut and tiled are always
+	// double, Hermite is always direct sum with the scalar jerk kernel and
+	// the Barnes-Hut walk is scalar too so those two run once
+	std::vector<bench_config> configs;
+	simd_isa best = detect_simd_isa();
+	for(const std::string &name : split(forces_str))
+	{
+		physics::force_method force;
+		if(!physics::parse_force_method(name, force))
+		{
+			std::cerr << "ERROR: unknown force method " << name << std::endl;
+			return 1;
+		}
+
+		for(const std::string &iname : split(integ_str))
+		{
+			physics::integrator integ;
+			if(!physics::parse_integrator(iname, integ))
+			{
+				std::cerr << "ERROR: unknown integrator " << iname << std::endl;
+				return 1;
+			}
+			if(integ == physics::integrator::hermite &&
+				force != physics::force_method::direct)
+				continue;
+
+			if(force == physics::force_method::direct &&
+				integ != physics::integrator::hermite)
+			{
+				for(precision prec : precs)
+				{
+					for(int k = 0; k <= (int)best; k++)
+						configs.push_back({force, (simd_isa)k, prec, integ});
+				}
+			}
+			else if(force == physics::force_method::tiled)
+			{
+				for(int k = 0; k <= (int)best; k++)
+				{
+					configs.push_back({force, (simd_isa)k, precision::fp64,
+						integ});
+				}
+			}
+			else
+			{
+				configs.push_back({force, simd_isa::scalar, precision::fp64,
+					integ});
+			}
+		}
+	}
+
+	if(!reset_peak_rss())
+	{
+		printf("note: the peak RSS can't be reset on this system, rss_mb is "
+			"the running max of the whole sweep\n");
+	}
+	printf("%8s %7s %-10s %-7s %-6s %-9s %12s %12s %12s %8s %10s %10s\n",
+		"n", "threads", "force", "kernel", "prec", "integ", "steps/s",
+		"ns/inter", "interactions", "par_eff", "rss_mb", "e_drift");
+
+	std::vector<bench_result> results;
+	for(const bench_config &c : configs)
+	{
+		for(uint32_t t : thread_counts)
+		{
+			for(uint32_t n : sizes)
+			{
+				// init() printed why, the larger sizes are as dense
+				bench_result r;
+				if(!run_one(c, n, (int)t, pin, seed, steps, dt, energy_max_n,
+					r))
+				{
+					break;
+				}
+
+				// efficiency against the same configuration on one thread
+				for(const bench_result &b : results)
+				{
+					if(b.threads == 1 && b.obj_count == r.obj_count &&
+						b.force == r.force && b.kernel == r.kernel &&
+						b.precision == r.precision &&
+						b.integrator == r.integrator)
+					{
+						r.parallel_efficiency = b.seconds / (r.seconds *
+							r.threads);
+					}
+				}
+
+				printf("%8u %7d %-10s %-7s %-6s %-9s %12.3f %12.4f %12llu "
+					"%8.3f %10.1f %10.3g\n", r.obj_count, r.threads,
+					r.force.c_str(), r.kernel.c_str(), r.precision.c_str(),
+					r.integrator.c_str(), r.steps_per_sec, r.ns_per_interaction,
+					(unsigned long long)r.interactions, r.parallel_efficiency,
+					r.peak_rss_mb, r.energy_drift);
+				fflush(stdout);
+				results.push_back(r);
+
+				if(r.seconds > max_seconds)
+					break;
+			}
+		}
+	}
+
+	if(vm.count("csv"))
+		write_csv(csv_name, results);
+	if(vm.count("json"))
+		write_json(json_name, results, seed);
+
+	return 0;
+}
@@ -0,0 +1,161 @@
+#include "checkpoint.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+static const char checkpoint_magic[8] = {'G', 'S', 'I', 'M', '2', 'C', 'K',
+	'P'};
+
+static uint64_t align64(uint64_t n)
+{
+	return (n + 63) & ~(uint64_t)63;
+}
+
+void checkpoint_init_header(checkpoint_header &h, uint32_t obj_count,
+	uint32_t version)
+{
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, checkpoint_magic, sizeof(h.magic));
+	h.version = version;
+	h.byte_order = 0x01020304;
+	h.obj_count = obj_count;
+	h.header_size = version == 1 ? offsetof(checkpoint_header, id_offset) :
+		sizeof(checkpoint_header);
+
+	uint64_t vec_bytes = 3 * sizeof(double) * (uint64_t)obj_count;
+	uint64_t scalar_bytes = sizeof(double) * (uint64_t)obj_count;
+	h.x_offset = align64(sizeof(checkpoint_header));
+	h.v_offset = align64(h.x_offset + vec_bytes);
+	h.m_offset = align64(h.v_offset + vec_bytes);
+	h.r_offset = align64(h.m_offset + scalar_bytes);
+	h.file_size = h.r_offset + scalar_bytes;
+	if(version == 1)
+		return;
+	h.id_offset = align64(h.file_size);
+	h.file_size = h.id_offset + sizeof(uint32_t) * (uint64_t)obj_count;
+}
+
+/**
+ * @brief Writes zeros up to offset then size bytes of data
+ */
+static bool write_at(FILE *f, uint64_t &pos, uint64_t offset,
+	const void *data, uint64_t size)
+{
+	static const char zeros[64] = {};
+	if(offset > pos && fwrite(zeros, 1, offset - pos, f) != offset - pos)
+		return false;
+	pos = offset;
+	if(size > 0 && fwrite(data, 1, size, f) != size)
+		return false;
+	pos += size;
+	return true;
+}
+
+bool checkpoint_write(const std::string &fname, const checkpoint_header &h,
+	const double *x, const double *v, const double *m, const double *r,
+	const uint32_t *id)
+{
+	std::string tmp = fname + ".tmp";
+	FILE *f = fopen(tmp.c_str(), "wb");
+	if(f == NULL)
+	{
+		printf("ERROR couldn't open %s\n", tmp.c_str());
+		return false;
+	}
+
+	uint64_t vec_bytes = 3 * sizeof(double) * (uint64_t)h.obj_count;
+	uint64_t scalar_bytes = sizeof(double) * (uint64_t)h.obj_count;
+	uint64_t pos = 0;
+	bool ok = write_at(f, pos, 0, &h, sizeof(h)) &&
+		write_at(f, pos, h.x_offset, x, vec_bytes) &&
+		write_at(f, pos, h.v_offset, v, vec_bytes) &&
+		write_at(f, pos, h.m_offset, m, scalar_bytes) &&
+		write_at(f, pos, h.r_offset, r, scalar_bytes) &&
+		write_at(f, pos, h.id_offset, id,
+			sizeof(uint32_t) * (uint64_t)h.obj_count) &&
+		fflush(f) == 0;
+
+	// the data has to be on disk before the rename or a crash could leave a
+	// renamed but empty file
+#ifdef _WIN32
+	ok = ok && _commit(_fileno(f)) == 0;
+#else
+	ok = ok && fsync(fileno(f)) == 0;
+#endif
+	ok = fclose(f) == 0 && ok;
+	if(!ok)
+	{
+		printf("ERROR couldn't write %s\n", tmp.c_str());
+		remove(tmp.c_str());
+		return false;
+	}
+
+#ifdef _WIN32
+	ok = MoveFileExA(tmp.c_str(), fname.c_str(), MOVEFILE_REPLACE_EXISTING |
+		MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	ok = rename(tmp.c_str(), fname.c_str()) == 0;
+#endif
+	if(!ok)
+	{
+		printf("ERROR couldn't rename %s to %s\n", tmp.c_str(), fname.c_str());
+		remove(tmp.c_str());
+		return false;
+	}
+	return true;
+}
+
+const checkpoint_header *checkpoint_check(const mapped_file &f,
+	const std::string &fname)
+{
+	if(f.size() < sizeof(checkpoint_header))
+	{
+		printf("ERROR %s is too small for a checkpoint\n", fname.c_str());
+		return nullptr;
+	}
+	const checkpoint_header *h = (const checkpoint_header *)f.data();
+	if(memcmp(h->magic, checkpoint_magic, sizeof(h->magic)) != 0)
+	{
+		printf("ERROR %s is not a checkpoint\n", fname.c_str());
+		return nullptr;
+	}
+	if(h->byte_order != 0x01020304)
+	{
+		printf("ERROR %s was written with the other byte order\n",
+			fname.c_str());
+		return nullptr;
+	}
+	if(h->version < 1 || h->version > checkpoint_version)
+	{
+		printf("ERROR %s is checkpoint version %u, this reads versions 1 to "
+			"%u\n", fname.c_str(), h->version, checkpoint_version);
+		return nullptr;
+	}
+
+	// the offsets come from the file so check them against a header made
+	// here rather than trusting them
+	checkpoint_header expect;
+	checkpoint_init_header(expect, h->obj_count, h->version);
+	if(h->x_offset != expect.x_offset || h->v_offset != expect.v_offset ||
+		h->m_offset != expect.m_offset || h->r_offset != expect.r_offset ||
+		h->id_offset != expect.id_offset ||
+		h->file_size != expect.file_size)
+	{
+		printf("ERROR %s has a bad layout\n", fname.c_str());
+		return nullptr;
+	}
+	if(f.size() < h->file_size)
+	{
+		printf("ERROR %s is cut off, %zu of %llu bytes\n", fname.c_str(),
+			f.size(), (unsigned long long)h->file_size);
+		return nullptr;
+	}
+	return h;
+}
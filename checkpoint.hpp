@@ -0,0 +1,83 @@
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+#include "mapped_file.hpp"
+
+/**
+ * @brief Start of a checkpoint file, the arrays follow at the given offsets
+ * (each 64 byte aligned) in the writer's byte order:
+ * x and v as obj_count (x, y, z) doubles, m and r as obj_count doubles and
+ * from version 2 the stable body ids as obj_count uint32s
+ */
+struct checkpoint_header
+{
+	/**
+	 * @brief "GSIM2CKP"
+	 */
+	char magic[8];
+	uint32_t version;
+	/**
+	 * @brief 0x01020304 as written, anything else is the wrong byte order
+	 */
+	uint32_t byte_order;
+	uint32_t obj_count;
+	uint32_t header_size;
+	double total_time;
+	/**
+	 * @brief Restored with the state, they change the dynamics
+	 */
+	double G;
+	double softening;
+	uint64_t x_offset;
+	uint64_t v_offset;
+	uint64_t m_offset;
+	uint64_t r_offset;
+	/**
+	 * @brief The whole file, a shorter file was cut off
+	 */
+	uint64_t file_size;
+	/**
+	 * @brief Version 2 on, it comes after the version 1 fields so those
+	 * stay where they were, a version 1 header has 0 here
+	 */
+	uint64_t id_offset;
+};
+
+const uint32_t checkpoint_version = 2;
+
+/**
+ * @brief Fills in everything but total_time, G and softening for obj_count
+ * bodies with the layout of the given version, only the reader asks for an
+ * older one
+ */
+void checkpoint_init_header(checkpoint_header &h, uint32_t obj_count,
+	uint32_t version = checkpoint_version);
+
+/**
+ * @brief Writes the header and arrays to fname.tmp, flushes it to disk then
+ * renames it over fname so a crash leaves either the old or the new file
+ * @param x Positions, 3 * obj_count doubles
+ * @param v Velocities, 3 * obj_count doubles
+ * @param m Masses
+ * @param r Radii
+ * @param id Stable ids
+ * @return False (with an error printed) if anything failed, fname is then
+ * left untouched
+ */
+bool checkpoint_write(const std::string &fname, const checkpoint_header &h,
+	const double *x, const double *v, const double *m, const double *r,
+	const uint32_t *id);
+
+/**
+ * @brief Checks the header and that the arrays fit in the mapped file,
+ * version 1 files are accepted too and have no ids (id_offset is 0)
+ * @return The header in the map or nullptr (with an error printed)
+ */
+const checkpoint_header *checkpoint_check(const mapped_file &f,
+	const std::string &fname);
+
+#endif
@@ -0,0 +1,545 @@
+#include "domain.hpp"
+#include "morton.hpp"
+#include "checkpoint.hpp"
+#include "profiler.hpp"
+
+#include <omp.h>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+/**
+ * @brief Doubles per body moved by rebalance(): x, v, m and r
+ */
+const static int body_doubles = 8;
+/**
+ * @brief Doubles per point mass in the essential data: x and m
+ */
+const static int ghost_doubles = 4;
+
+/**
+ * @brief Offsets for MPI_Alltoallv from per rank counts, exits if the total
+ * doesn't fit in the int MPI counts in
+ */
+static int exclusive_sum(const std::vector<int> &counts,
+	std::vector<int> &displs)
+{
+	int64_t sum = 0;
+	displs.resize(counts.size());
+	for(size_t q = 0; q < counts.size(); q++)
+	{
+		displs[q] = (int)sum;
+		sum += counts[q];
+	}
+	if(sum > std::numeric_limits<int>::max())
+	{
+		printf("ERROR %lld doubles in one exchange, use more ranks\n",
+			(long long)sum);
+		MPI_Abort(MPI_COMM_WORLD, 1);
+	}
+	return (int)sum;
+}
+
+/**
+ * @brief Bounding box of x as lo then hi, lo > hi when x is empty
+ */
+static void bounding_box(const std::vector<Eigen::Vector3d> &x,
+	double box[6])
+{
+	const double inf = std::numeric_limits<double>::infinity();
+	for(int d = 0; d < 3; d++)
+	{
+		box[d] = inf;
+		box[3 + d] = -inf;
+	}
+	for(const Eigen::Vector3d &p : x)
+	{
+		for(int d = 0; d < 3; d++)
+		{
+			box[d] = std::min(box[d], p[d]);
+			box[3 + d] = std::max(box[3 + d], p[d]);
+		}
+	}
+}
+
+domain::domain(MPI_Comm comm)
+{
+	this->comm = comm;
+	MPI_Comm_rank(comm, &rank);
+	MPI_Comm_size(comm, &size);
+	accel_valid = false;
+	step_count = 0;
+	rebalance_interval = 10;
+	rebalance_count = 0;
+	ghost_count = 0;
+	total_time = 0.0;
+	softening = 0.0;
+	G = 6.67408e-11;
+	interactions = 0;
+	last_force_time = 0.0;
+	force_time = 0.0;
+	build_time = 0.0;
+	exchange_time = 0.0;
+}
+
+domain::~domain()
+{
+
+}
+
+void domain::set_bodies(const std::vector<Eigen::Vector3d> &x,
+	const std::vector<Eigen::Vector3d> &v, const std::vector<double> &m,
+	const std::vector<double> &r)
+{
+	this->x = x;
+	this->v = v;
+	this->m = m;
+	this->r = r;
+	a.assign(x.size(), Eigen::Vector3d(0.0, 0.0, 0.0));
+	cost.assign(x.size(), 0);
+	accel_valid = false;
+	step_count = 0;
+	total_time = 0.0;
+}
+
+void domain::set_theta(double theta)
+{
+	local_tree.set_theta(theta);
+	tree.set_theta(theta);
+	accel_valid = false;
+}
+
+uint64_t domain::get_global_count()
+{
+	uint64_t local = x.size(), global = 0;
+	MPI_Allreduce(&local, &global, 1, MPI_UINT64_T, MPI_SUM, comm);
+	return global;
+}
+
+void domain::step(double delta_t)
+{
+	profile_scope scope(profile_phase::step);
+	if(!accel_valid)
+	{
+		rebalance();
+		forces(false);
+		accel_valid = true;
+	}
+
+	double half_dt = 0.5 * delta_t;
+	int count = (int)x.size();
+	{
+		profile_scope integrate_scope(profile_phase::integrate);
+		#pragma omp parallel for
+		for(int i = 0; i < count; i++)
+		{
+			v[i] += half_dt * a[i];
+			x[i] += delta_t * v[i];
+		}
+	}
+	total_time += delta_t;
+	step_count++;
+
+	// a is found again after this so only x, v, m and r have to move
+	if(rebalance_interval > 0 && step_count % rebalance_interval == 0)
+		rebalance();
+	forces(false);
+	accel_valid = true;
+
+	profile_scope integrate_scope(profile_phase::integrate);
+	count = (int)x.size();
+	#pragma omp parallel for
+	for(int i = 0; i < count; i++)
+		v[i] += half_dt * a[i];
+}
+
+void domain::rebalance()
+{
+	profile_scope scope(profile_phase::exchange);
+	double t0 = MPI_Wtime();
+	uint32_t count = (uint32_t)x.size();
+
+	// the global bounding cube, hi is negated so one MIN does both
+	double box[6];
+	bounding_box(x, box);
+	for(int d = 0; d < 3; d++)
+		box[3 + d] = -box[3 + d];
+	MPI_Allreduce(MPI_IN_PLACE, box, 6, MPI_DOUBLE, MPI_MIN, comm);
+	Eigen::Vector3d lo(box[0], box[1], box[2]);
+	Eigen::Vector3d hi(-box[3], -box[4], -box[5]);
+	if(!(lo.array() <= hi.array()).all())
+		return;
+	double width = (hi - lo).maxCoeff() * 1.0001 + 1e-12;
+	double scale = (double)(1u << morton_bits) / width;
+
+	// the last walk time on this rank shared out by interactions, so the
+	// weight is seconds and a slower rank counts as more loaded. Until every
+	// rank has timed a pass all bodies weigh the same.
+	uint64_t local_cost = 0;
+	for(uint32_t i = 0; i < count; i++)
+		local_cost += cost[i] + 1;
+	int measured = count == 0 || (accel_valid && last_force_time > 0.0);
+	MPI_Allreduce(MPI_IN_PLACE, &measured, 1, MPI_INT, MPI_MIN, comm);
+	double per = measured && count > 0 ? last_force_time / local_cost : 0.0;
+
+	const uint32_t bucket_count = 1u << bucket_bits;
+	const uint32_t shift = 3 * morton_bits - bucket_bits;
+	std::vector<double> weight(bucket_count, 0.0);
+	std::vector<uint32_t> bucket(count);
+	for(uint32_t i = 0; i < count; i++)
+	{
+		bucket[i] = (uint32_t)(morton_key(x[i], lo, scale) >> shift);
+		weight[bucket[i]] += measured ? per * (cost[i] + 1) : 1.0;
+	}
+	MPI_Allreduce(MPI_IN_PLACE, weight.data(), bucket_count, MPI_DOUBLE,
+		MPI_SUM, comm);
+
+	// each bucket goes to the rank its middle falls in when the curve is cut
+	// into equal shares, so the ranks own consecutive runs of buckets
+	double total = 0.0;
+	for(double w : weight)
+		total += w;
+	std::vector<int> owner(bucket_count);
+	double before = 0.0;
+	for(uint32_t b = 0; b < bucket_count; b++)
+	{
+		double mid = (before + 0.5 * weight[b]) / total;
+		owner[b] = std::min(size - 1, (int)(mid * size));
+		before += weight[b];
+	}
+
+	// counting sort the bodies by destination
+	std::vector<int> send_counts(size, 0), recv_counts(size);
+	for(uint32_t i = 0; i < count; i++)
+		send_counts[owner[bucket[i]]] += body_doubles;
+	std::vector<int> send_displs, recv_displs;
+	int send_total = exclusive_sum(send_counts, send_displs);
+	std::vector<double> send(send_total);
+	std::vector<int> fill = send_displs;
+	for(uint32_t i = 0; i < count; i++)
+	{
+		double *p = &send[fill[owner[bucket[i]]]];
+		fill[owner[bucket[i]]] += body_doubles;
+		for(int d = 0; d < 3; d++)
+		{
+			p[d] = x[i][d];
+			p[3 + d] = v[i][d];
+		}
+		p[6] = m[i];
+		p[7] = r[i];
+	}
+
+	MPI_Alltoall(send_counts.data(), 1, MPI_INT, recv_counts.data(), 1,
+		MPI_INT, comm);
+	int recv_total = exclusive_sum(recv_counts, recv_displs);
+	std::vector<double> recv(recv_total);
+	MPI_Alltoallv(send.data(), send_counts.data(), send_displs.data(),
+		MPI_DOUBLE, recv.data(), recv_counts.data(), recv_displs.data(),
+		MPI_DOUBLE, comm);
+
+	count = (uint32_t)(recv_total / body_doubles);
+	x.resize(count);
+	v.resize(count);
+	a.resize(count);
+	m.resize(count);
+	r.resize(count);
+	cost.assign(count, 0);
+	for(uint32_t i = 0; i < count; i++)
+	{
+		const double *p = &recv[(size_t)i * body_doubles];
+		x[i] = Eigen::Vector3d(p[0], p[1], p[2]);
+		v[i] = Eigen::Vector3d(p[3], p[4], p[5]);
+		m[i] = p[6];
+		r[i] = p[7];
+	}
+	// the bodies moved so a no longer lines up with them
+	accel_valid = false;
+	rebalance_count++;
+	exchange_time += MPI_Wtime() - t0;
+}
+
+void domain::forces(bool potential)
+{
+	int count = (int)x.size();
+	double t0 = MPI_Wtime();
+	{
+		profile_scope scope(profile_phase::tree_build);
+		local_tree.build(x, array_view<double>(m.data(), m.size()));
+	}
+
+	// every rank's box, then the part of the local tree each of them needs
+	double t1 = MPI_Wtime();
+	std::vector<double> boxes(6 * size);
+	{
+		profile_scope scope(profile_phase::exchange);
+		double box[6];
+		bounding_box(x, box);
+		MPI_Allgather(box, 6, MPI_DOUBLE, boxes.data(), 6, MPI_DOUBLE, comm);
+	}
+	double t2 = MPI_Wtime();
+	std::vector<std::vector<Eigen::Vector3d>> ex(size);
+	std::vector<std::vector<double>> em(size);
+	{
+		profile_scope scope(profile_phase::tree_build);
+		#pragma omp parallel for schedule(dynamic, 1)
+		for(int q = 0; q < size; q++)
+		{
+			const double *b = &boxes[6 * q];
+			if(q == rank || b[0] > b[3])
+				continue;
+			local_tree.essential(Eigen::Vector3d(b[0], b[1], b[2]),
+				Eigen::Vector3d(b[3], b[4], b[5]), ex[q], em[q]);
+		}
+	}
+
+	std::vector<int> send_counts(size), recv_counts(size);
+	for(int q = 0; q < size; q++)
+		send_counts[q] = (int)em[q].size() * ghost_doubles;
+	std::vector<int> send_displs, recv_displs;
+	int send_total = exclusive_sum(send_counts, send_displs);
+	std::vector<double> send(send_total);
+	for(int q = 0; q < size; q++)
+	{
+		double *p = &send[send_displs[q]];
+		for(size_t k = 0; k < em[q].size(); k++, p += ghost_doubles)
+		{
+			p[0] = ex[q][k][0];
+			p[1] = ex[q][k][1];
+			p[2] = ex[q][k][2];
+			p[3] = em[q][k];
+		}
+	}
+	double t3 = MPI_Wtime();
+
+	std::vector<double> recv;
+	{
+		profile_scope scope(profile_phase::exchange);
+		MPI_Alltoall(send_counts.data(), 1, MPI_INT, recv_counts.data(), 1,
+			MPI_INT, comm);
+		int recv_total = exclusive_sum(recv_counts, recv_displs);
+		recv.resize(recv_total);
+		MPI_Alltoallv(send.data(), send_counts.data(), send_displs.data(),
+			MPI_DOUBLE, recv.data(), recv_counts.data(), recv_displs.data(),
+			MPI_DOUBLE, comm);
+	}
+	double t4 = MPI_Wtime();
+
+	// the local bodies keep their indices so the walk can skip each one
+	ghost_count = (uint32_t)(recv.size() / ghost_doubles);
+	all_x.resize(count + ghost_count);
+	all_m.resize(count + ghost_count);
+	std::copy(x.begin(), x.end(), all_x.begin());
+	std::copy(m.begin(), m.end(), all_m.begin());
+	for(uint32_t k = 0; k < ghost_count; k++)
+	{
+		const double *p = &recv[(size_t)k * ghost_doubles];
+		all_x[count + k] = Eigen::Vector3d(p[0], p[1], p[2]);
+		all_m[count + k] = p[3];
+	}
+	{
+		profile_scope scope(profile_phase::tree_build);
+		tree.build(all_x, array_view<double>(all_m.data(), all_m.size()));
+	}
+	double t5 = MPI_Wtime();
+
+	a.resize(count);
+	cost.resize(count);
+	if(potential)
+		phi.assign(count, 0.0);
+	double eps2 = softening * softening;
+	uint64_t total = 0;
+	// chunks cut by the cost of each body's last walk, rebalance() zeroes
+	// them so the first pass after one is cut evenly and relies on stealing
+	pool.split(count, cost.data(), omp_get_max_threads());
+	#pragma omp parallel reduction(+:total)
+	{
+		profile_scope scope(profile_phase::force);
+		uint32_t begin, end;
+		while(pool.next(begin, end))
+		{
+			for(uint32_t i = begin; i < end; i++)
+			{
+				uint64_t c = 0;
+				a[i] = tree.accel(x[i], i, G, eps2, c,
+					potential ? &phi[i] : nullptr);
+				cost[i] = (uint32_t)c;
+				total += c;
+			}
+		}
+	}
+	double t6 = MPI_Wtime();
+
+	interactions += total;
+	last_force_time = t6 - t5;
+	force_time += t6 - t5;
+	build_time += (t1 - t0) + (t3 - t2) + (t5 - t4);
+	exchange_time += (t2 - t1) + (t4 - t3);
+}
+
+double domain::get_energy()
+{
+	// only the steps are counted
+	uint64_t saved_interactions = interactions;
+	double saved[3] = {force_time, build_time, exchange_time};
+	forces(true);
+	interactions = saved_interactions;
+	force_time = saved[0];
+	build_time = saved[1];
+	exchange_time = saved[2];
+
+	double e[2] = {0.0, 0.0};
+	for(size_t i = 0; i < x.size(); i++)
+	{
+		e[0] += 0.5 * m[i] * v[i].squaredNorm();
+		e[1] += 0.5 * m[i] * phi[i];
+	}
+	MPI_Allreduce(MPI_IN_PLACE, e, 2, MPI_DOUBLE, MPI_SUM, comm);
+	return e[0] + e[1];
+}
+
+bool domain::load_checkpoint(const std::string &fname)
+{
+	mapped_file f;
+	const checkpoint_header *h = nullptr;
+	if(f.open(fname))
+		h = checkpoint_check(f, fname);
+	int ok = h != nullptr;
+	MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, comm);
+	if(!ok)
+		return false;
+
+	// an even slice each, the first step() balances them properly
+	uint64_t total = h->obj_count;
+	uint64_t begin = total * rank / size;
+	uint64_t end = total * (rank + 1) / size;
+	uint32_t count = (uint32_t)(end - begin);
+	const uint8_t *base = f.data();
+	x.resize(count);
+	v.resize(count);
+	m.resize(count);
+	r.resize(count);
+	memcpy((double *)x.data(), base + h->x_offset + begin *
+		sizeof(Eigen::Vector3d), count * sizeof(Eigen::Vector3d));
+	memcpy((double *)v.data(), base + h->v_offset + begin *
+		sizeof(Eigen::Vector3d), count * sizeof(Eigen::Vector3d));
+	memcpy(m.data(), base + h->m_offset + begin * sizeof(double),
+		count * sizeof(double));
+	memcpy(r.data(), base + h->r_offset + begin * sizeof(double),
+		count * sizeof(double));
+	a.assign(count, Eigen::Vector3d(0.0, 0.0, 0.0));
+	cost.assign(count, 0);
+
+	total_time = h->total_time;
+	G = h->G;
+	softening = h->softening;
+	accel_valid = false;
+	step_count = 0;
+	return true;
+}
+
+bool domain::save_checkpoint(const std::string &fname)
+{
+	uint64_t count = x.size(), offset = 0, total = 0;
+	MPI_Exscan(&count, &offset, 1, MPI_UINT64_T, MPI_SUM, comm);
+	if(rank == 0)
+		offset = 0;
+	MPI_Allreduce(&count, &total, 1, MPI_UINT64_T, MPI_SUM, comm);
+	// every rank has to give up together or the others wait in the open
+	int fits = total <= UINT32_MAX &&
+		count * 3 <= (uint64_t)std::numeric_limits<int>::max();
+	MPI_Allreduce(MPI_IN_PLACE, &fits, 1, MPI_INT, MPI_MIN, comm);
+	if(!fits)
+	{
+		if(rank == 0)
+			printf("ERROR %llu bodies don't fit in a checkpoint\n",
+				(unsigned long long)total);
+		return false;
+	}
+
+	checkpoint_header h;
+	checkpoint_init_header(h, (uint32_t)total);
+	h.total_time = total_time;
+	h.G = G;
+	h.softening = softening;
+
+	// the same write to a temporary then rename as checkpoint_write(), with
+	// every rank writing its slice of each array
+	std::string tmp = fname + ".tmp";
+	MPI_File f;
+	int opened = MPI_File_open(comm, tmp.c_str(),
+		MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &f) == MPI_SUCCESS;
+	int all_opened = opened;
+	MPI_Allreduce(MPI_IN_PLACE, &all_opened, 1, MPI_INT, MPI_MIN, comm);
+	if(!all_opened)
+	{
+		if(opened)
+			MPI_File_close(&f);
+		if(rank == 0)
+			printf("ERROR couldn't open %s\n", tmp.c_str());
+		return false;
+	}
+	const int vec = 3 * (int)count;
+	const MPI_Offset vec_at = offset * sizeof(Eigen::Vector3d);
+	const MPI_Offset scalar_at = offset * sizeof(double);
+	// every rank makes every collective call whatever failed before it, a
+	// rank that skipped one would leave the others waiting in it
+	bool size_ok = MPI_File_set_size(f, h.file_size) == MPI_SUCCESS;
+	bool x_ok = MPI_File_write_at_all(f, h.x_offset + vec_at, x.data(), vec,
+		MPI_DOUBLE, MPI_STATUS_IGNORE) == MPI_SUCCESS;
+	bool v_ok = MPI_File_write_at_all(f, h.v_offset + vec_at, v.data(), vec,
+		MPI_DOUBLE, MPI_STATUS_IGNORE) == MPI_SUCCESS;
+	bool m_ok = MPI_File_write_at_all(f, h.m_offset + scalar_at, m.data(),
+		(int)count, MPI_DOUBLE, MPI_STATUS_IGNORE) == MPI_SUCCESS;
+	bool r_ok = MPI_File_write_at_all(f, h.r_offset + scalar_at, r.data(),
+		(int)count, MPI_DOUBLE, MPI_STATUS_IGNORE) == MPI_SUCCESS;
+	// the bodies have no ids of their own here, they get their place in the
+	// file so a physics restart from it has ids in Morton order
+	std::vector<uint32_t> id(count);
+	for(uint64_t i = 0; i < count; i++)
+		id[i] = (uint32_t)(offset + i);
+	bool id_ok = MPI_File_write_at_all(f, h.id_offset + offset *
+		sizeof(uint32_t), id.data(), (int)count, MPI_UINT32_T,
+		MPI_STATUS_IGNORE) == MPI_SUCCESS;
+	bool header_ok = true;
+	if(rank == 0)
+		header_ok = MPI_File_write_at(f, 0, &h, sizeof(h), MPI_BYTE,
+			MPI_STATUS_IGNORE) == MPI_SUCCESS;
+	bool sync_ok = MPI_File_sync(f) == MPI_SUCCESS;
+	bool close_ok = MPI_File_close(&f) == MPI_SUCCESS;
+	bool ok = size_ok && x_ok && v_ok && m_ok && r_ok && id_ok &&
+		header_ok && sync_ok && close_ok;
+
+	int good = ok;
+	MPI_Allreduce(MPI_IN_PLACE, &good, 1, MPI_INT, MPI_MIN, comm);
+	if(rank == 0)
+	{
+		if(!good)
+		{
+			printf("ERROR couldn't write %s\n", tmp.c_str());
+			remove(tmp.c_str());
+		}
+		else
+		{
+#ifdef _WIN32
+			good = MoveFileExA(tmp.c_str(), fname.c_str(),
+				MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+			good = rename(tmp.c_str(), fname.c_str()) == 0;
+#endif
+			if(!good)
+			{
+				printf("ERROR couldn't rename %s to %s\n", tmp.c_str(),
+					fname.c_str());
+				remove(tmp.c_str());
+			}
+		}
+	}
+	MPI_Bcast(&good, 1, MPI_INT, 0, comm);
+	return good != 0;
+}
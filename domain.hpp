@@ -0,0 +1,167 @@
+#ifndef DOMAIN_HPP
+#define DOMAIN_HPP
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <mpi.h>
+#include <Eigen/Core>
+
+#include "octree.hpp"
+#include "task_pool.hpp"
+#include "array_view.hpp"
+
+/**
+ * @brief One rank's share of a Barnes-Hut leapfrog run spread over the ranks
+ * of an MPI communicator, every method is collective unless it says
+ * otherwise.
+ *
+ * The bodies are split along a Morton curve into key ranges of equal
+ * measured cost, so each rank owns a compact region of space. The forces on
+ * the local bodies come from a tree over them plus the locally essential data
+ * every other rank sends for this rank's bounding box (see
+ * octree::essential()). No rank ever holds all the bodies, only its own and
+ * the summary of everything else.
+ */
+class domain
+{
+public:
+	domain(MPI_Comm comm);
+	virtual ~domain();
+
+	/**
+	 * @brief Hands this rank its first bodies, any share of the total (even
+	 * none) on any rank, the first step() balances them
+	 */
+	void set_bodies(const std::vector<Eigen::Vector3d> &x,
+		const std::vector<Eigen::Vector3d> &v, const std::vector<double> &m,
+		const std::vector<double> &r);
+	/**
+	 * @brief Every rank reads its slice of a physics checkpoint, the file
+	 * has to be on a file system all ranks can see
+	 * @return False (with an error printed) on every rank if any rank
+	 * couldn't read it
+	 */
+	bool load_checkpoint(const std::string &fname);
+	/**
+	 * @brief Writes all bodies to one checkpoint physics can load, each rank
+	 * writes its own slice in place with MPI-IO and the file is renamed over
+	 * fname once it is complete
+	 */
+	bool save_checkpoint(const std::string &fname);
+
+	void step(double delta_t);
+	/**
+	 * @brief Total kinetic plus potential energy of the current state, with
+	 * the potential from the same trees as the forces, costs a force pass
+	 */
+	double get_energy();
+
+	void set_theta(double theta);
+	double get_theta(){return local_tree.get_theta();}
+	void set_softening(double eps){softening = eps > 0.0 ? eps : 0.0;
+		accel_valid = false;}
+	double get_softening(){return softening;}
+	void set_G(double G){this->G = G; accel_valid = false;}
+	double get_G(){return G;}
+	/**
+	 * @brief Steps between rebalancing by measured cost, 0 only balances
+	 * before the first step
+	 */
+	void set_rebalance_interval(uint32_t steps){rebalance_interval = steps;}
+
+	int get_rank(){return rank;}
+	int get_size(){return size;}
+	/**
+	 * @brief Not collective, this rank only
+	 */
+	uint32_t get_local_count(){return (uint32_t)x.size();}
+	uint64_t get_global_count();
+	double get_total_time(){return total_time;}
+	/**
+	 * @brief Not collective, this rank only: bodies and nodes received from
+	 * the other ranks in the last force pass
+	 */
+	uint32_t get_ghost_count(){return ghost_count;}
+	/**
+	 * @brief Not collective, this rank only: bodies and nodes summed by the
+	 * walks of every step
+	 */
+	uint64_t get_interactions(){return interactions;}
+	/**
+	 * @brief Not collective, this rank only: seconds in the tree walks, in
+	 * building both trees and the exports, and in the exchanges and
+	 * rebalancing, get_energy() isn't counted
+	 */
+	double get_force_time(){return force_time;}
+	double get_build_time(){return build_time;}
+	double get_exchange_time(){return exchange_time;}
+	uint32_t get_rebalance_count(){return rebalance_count;}
+	array_view<Eigen::Vector3d> get_pos_view() const
+	{
+		return array_view<Eigen::Vector3d>(x.data(), x.size());
+	}
+
+private:
+	/**
+	 * @brief Moves every body to the rank that owns its Morton key range,
+	 * the ranges are cut so each rank gets an equal share of the cost the
+	 * last force pass measured
+	 */
+	void rebalance();
+	/**
+	 * @brief Exchanges the essential trees and finds a at x, with the
+	 * potential in phi if potential is set
+	 */
+	void forces(bool potential);
+
+	/**
+	 * @brief Histogram buckets for rebalance(), the level 5 octree cells of
+	 * the global bounding cube
+	 */
+	const static uint32_t bucket_bits = 15;
+
+	MPI_Comm comm;
+	int rank, size;
+
+	std::vector<Eigen::Vector3d> x, v, a;
+	std::vector<double> m, r;
+	/**
+	 * @brief Interactions each body's walk took in the last force pass
+	 */
+	std::vector<uint32_t> cost;
+	std::vector<double> phi;
+	/**
+	 * @brief Local bodies first, then the essential data of the other ranks
+	 */
+	std::vector<Eigen::Vector3d> all_x;
+	std::vector<double> all_m;
+	/**
+	 * @brief Over the local bodies only, what gets exported
+	 */
+	octree local_tree;
+	/**
+	 * @brief Over all_x, what the forces come from
+	 */
+	octree tree;
+	task_pool pool;
+
+	bool accel_valid;
+	uint64_t step_count;
+	uint32_t rebalance_interval;
+	uint32_t rebalance_count;
+	uint32_t ghost_count;
+	double total_time;
+	double softening;
+	double G;
+
+	uint64_t interactions;
+	/**
+	 * @brief Seconds of the force walk in the last force pass, what the cost
+	 * is scaled to so a slower rank counts as more loaded
+	 */
+	double last_force_time;
+	double force_time, build_time, exchange_time;
+};
+
+#endif
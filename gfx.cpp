@@ -1,10 +1,16 @@
 #include "gfx.hpp"
 
 #include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <omp.h>
 #include <GL/glu.h>
 
 #include "physics.hpp"
+#include "physics_thread.hpp"
+#include "replay_thread.hpp"
+#include "profiler.hpp"
 #include "fox/counter.hpp"
 #include "fox/gfx/eigen_opengl.hpp"
 
@@ -20,6 +26,10 @@ int print_opengl_error2(char *file, int line);
 gfx::gfx()
 {
 	this->generator = std::mt19937_64(std::random_device{}());
+	p = nullptr;
+	pt = nullptr;
+	rt = nullptr;
+	tracer_count = 0;
 }
 
 void gfx::init()
@@ -147,26 +157,29 @@ void gfx::init()
 	print_opengl_error();
 
 	obj_count = 1024;
-
-	x_gfx.resize(obj_count * 3);
-	for(int i = 0; i < obj_count; i++)
+	// the vertex buffers have to hold the biggest frame of a replay
+	if(!replay_file.empty())
 	{
-		x_gfx[i * 3] = 0.0f;
-		x_gfx[i * 3 + 1] = 0.0f;
-		x_gfx[i * 3 + 2] = 0.0f;
+		rt = new replay_thread();
+		if(!rt->open(replay_file))
+			exit(-1);
+		obj_count = rt->get_max_obj_count();
+		printf("Replaying %s: %zu frames, up to %u bodies\n",
+			replay_file.c_str(), rt->get_frame_count(), obj_count);
+		tracer_count = 0;
 	}
-	glGenBuffers(1, &x_vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, x_vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(float) * obj_count * 3,
-		x_gfx.data(), GL_STATIC_DRAW);
+
+	init_vertex_buffers();
 
 	print_opengl_error();
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
 
 	load_shaders();
 
 	print_opengl_error();
 
+	vertex_loc = glGetAttribLocation(point_render_program, "vertex");
+	color_loc = glGetUniformLocation(point_render_program, "color");
+
 	glUseProgram(point_render_program);
 	GLint u;
 	MVP = P * (V * M);
@@ -176,14 +189,22 @@ void gfx::init()
 	print_opengl_error();
 	fflush(stdout);
 
-	update_counter = new fox::counter();
 	fps_counter = new fox::counter();
 	perf_counter = new fox::counter();
 
 	perf_index = 0;
 
+	if(rt)
+	{
+		rt->start();
+		return;
+	}
 	p = new physics();
-	p->init(obj_count);
+	p->set_tracer_count(tracer_count);
+	if(!p->init(obj_count))
+		exit(-1);
+	pt = new physics_thread(p);
+	pt->start();
 }
 
 void gfx::deinit()
@@ -197,16 +218,25 @@ void gfx::deinit()
 	if(point_render_program != 0)
 		glDeleteProgram(point_render_program);
 
-	glDeleteBuffers(1, &x_vbo);
+	deinit_vertex_buffers();
 
 	SDL_GL_DeleteContext(context);
 	SDL_DestroyWindow(window);
 	
 	SDL_Quit();
 
-	delete p;
+	if(rt)
+	{
+		rt->stop();
+		delete rt;
+	}
+	else
+	{
+		pt->stop();
+		delete pt;
+		delete p;
+	}
 
-	delete update_counter;
 	delete fps_counter;
 	delete perf_counter;
 }
@@ -227,16 +257,16 @@ void gfx::render()
 		exit(1);
 	}
 
-	double delta_t = update_counter->update_double();
-	p->step(delta_t);
-	auto px = p->get_pos();
-	#pragma omp parallel for
-	for(int i = 0; i < obj_count; i++)
+	// physics runs on its own thread, just take the newest finished state
+	// and only upload it if it is newer than what was drawn last frame, a
+	// replay is the same with the frame the playback clock is at
+	if(rt)
 	{
-		x_gfx[i * 3] = (float)px[i][0];
-		x_gfx[i * 3 + 1] = (float)px[i][1];
-		x_gfx[i * 3 + 2] = (float)px[i][2];
+		if(rt->update())
+			upload_positions(rt->get_positions(), rt->get_obj_count());
 	}
+	else if(pt->update())
+		upload_positions(pt->get_snapshot().x, pt->get_snapshot().tracers);
 
 	phys_times[perf_index] = perf_counter->update_double();
 
@@ -253,27 +283,61 @@ void gfx::render()
 			phys_time += phys_times[i];
 			render_time += render_times[i];
 		}
-		printf("Physics time:    %.9f\n", phys_time);
+		printf("Upload time:     %.9f\n", phys_time);
 		printf("Render time:     %.9f\n", render_time);
+		if(rt)
+		{
+			printf("Replay frame:    %zu / %zu (time %g)\n", rt->get_frame(),
+				rt->get_frame_count() - 1, rt->get_time());
+			printf("Replay speed:    %g frames/s%s\n", rt->get_speed(),
+				rt->get_paused() ? " (paused)" : "");
+		}
+		else
+			printf("Physics steps/s: %.1f\n", pt->get_steps_per_second());
 		printf("----------------------------\n");
 		//fflush(stdout);
 		total_time = 0.0;
 	}
 
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	glUseProgram(point_render_program);
-	GLint vertex_loc = glGetAttribLocation(point_render_program, "vertex");
-	glBindBuffer(GL_ARRAY_BUFFER, x_vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(float) * obj_count * 3,
-		x_gfx.data(), GL_STATIC_DRAW);
-	glEnableVertexAttribArray(vertex_loc);
-	glVertexAttribPointer(vertex_loc, 3, GL_FLOAT, GL_FALSE, 0, 0);
+	{
+		// ends before the swap so the two phases don't overlap
+		profile_scope draw_scope(profile_phase::draw);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		glUseProgram(point_render_program);
+		glBindBuffer(GL_ARRAY_BUFFER, x_vbos[vbo_index]);
+		glEnableVertexAttribArray(vertex_loc);
+		glVertexAttribPointer(vertex_loc, 3, GL_FLOAT, GL_FALSE, 0, 0);
 
-	glDrawArrays(GL_POINTS, 0, obj_count);
+		// the tracers first, small and faint so the bodies stay visible on top
+		// of a million of them
+		if(draw_tracer_count > 0)
+		{
+			glPointSize(1.0f);
+			glUniform4f(color_loc, 0.6f, 0.75f, 1.0f, 0.5f);
+			glDrawArrays(GL_POINTS, draw_count, draw_tracer_count);
+			glPointSize(3.0f);
+		}
+		glUniform4f(color_loc, 1.0f, 1.0f, 1.0f, 1.0f);
+		glDrawArrays(GL_POINTS, 0, draw_count);
 
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+		if(persistent_vbos)
+		{
+			// the buffer can't be written again until this draw is done with it
+			if(vbo_fences[vbo_index])
+				glDeleteSync(vbo_fences[vbo_index]);
+			vbo_fences[vbo_index] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE,
+				0);
+		}
+
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
 
-	SDL_GL_SwapWindow(window);
+	{
+		// the CPU side of the draw calls, the GPU time shows up in the swap
+		// when it has to wait for the GPU
+		profile_scope swap_scope(profile_phase::swap);
+		SDL_GL_SwapWindow(window);
+	}
 
 	if(print_opengl_error())
 	{
@@ -282,6 +346,184 @@ void gfx::render()
 	}
 }
 
+void gfx::init_vertex_buffers()
+{
+	vbo_capacity = obj_count + tracer_count;
+	draw_count = 0;
+	draw_tracer_count = 0;
+	vbo_index = 0;
+	GLsizeiptr size = sizeof(float) * 3 * (GLsizeiptr)vbo_capacity;
+
+	for(int k = 0; k < vbo_ring_size; k++)
+	{
+		x_vbos[k] = 0;
+		vbo_fences[k] = 0;
+		x_mapped[k] = nullptr;
+	}
+
+	persistent_vbos = GLEW_ARB_buffer_storage ? true : false;
+	if(persistent_vbos)
+	{
+		// coherent so writes are visible to the GPU without explicit flushes,
+		// the fences keep the CPU from writing a buffer still being drawn
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT |
+			GL_MAP_COHERENT_BIT;
+		glGenBuffers(vbo_ring_size, x_vbos);
+		for(int k = 0; k < vbo_ring_size; k++)
+		{
+			glBindBuffer(GL_ARRAY_BUFFER, x_vbos[k]);
+			glBufferStorage(GL_ARRAY_BUFFER, size, NULL, flags);
+			x_mapped[k] = (float *)glMapBufferRange(GL_ARRAY_BUFFER, 0, size,
+				flags);
+			if(x_mapped[k] == nullptr)
+			{
+				printf("Failed to persistently map vertex buffer %d\n", k);
+				persistent_vbos = false;
+			}
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		if(!persistent_vbos)
+		{
+			deinit_vertex_buffers();
+			print_opengl_error();
+		}
+	}
+
+	if(!persistent_vbos)
+	{
+		glGenBuffers(1, &x_vbos[0]);
+		glBindBuffer(GL_ARRAY_BUFFER, x_vbos[0]);
+		glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_STREAM_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	printf("Vertex upload: %s\n", persistent_vbos ?
+		"persistent mapped ring (ARB_buffer_storage)" : "buffer orphaning");
+}
+
+void gfx::deinit_vertex_buffers()
+{
+	for(int k = 0; k < vbo_ring_size; k++)
+	{
+		if(vbo_fences[k])
+			glDeleteSync(vbo_fences[k]);
+		vbo_fences[k] = 0;
+		if(x_mapped[k])
+		{
+			glBindBuffer(GL_ARRAY_BUFFER, x_vbos[k]);
+			glUnmapBuffer(GL_ARRAY_BUFFER);
+			x_mapped[k] = nullptr;
+		}
+		if(x_vbos[k])
+			glDeleteBuffers(1, &x_vbos[k]);
+		x_vbos[k] = 0;
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void gfx::upload_positions(const std::vector<Eigen::Vector3d> &px,
+	const std::vector<float> &tracers)
+{
+	profile_scope scope(profile_phase::upload);
+	uint32_t count = (uint32_t)std::min<size_t>(px.size(), vbo_capacity);
+	uint32_t t_count = (uint32_t)std::min<size_t>(tracers.size() / 3,
+		vbo_capacity - count);
+	float *dst = begin_upload();
+
+	// write the floats straight into the buffer memory
+	#pragma omp parallel for
+	for(int i = 0; i < (int)count; i++)
+	{
+		dst[i * 3] = (float)px[i][0];
+		dst[i * 3 + 1] = (float)px[i][1];
+		dst[i * 3 + 2] = (float)px[i][2];
+	}
+
+	// the tracers are floats already, split the copy like the replay one
+	size_t bytes = sizeof(float) * 3 * (size_t)t_count;
+	uint8_t *t_dst = (uint8_t *)(dst + 3 * (size_t)count);
+	#pragma omp parallel
+	{
+		int t = omp_get_thread_num();
+		int threads = omp_get_num_threads();
+		size_t begin = bytes * t / threads;
+		size_t end = bytes * (t + 1) / threads;
+		memcpy(t_dst + begin, (const uint8_t *)tracers.data() + begin,
+			end - begin);
+	}
+
+	end_upload(count, t_count);
+}
+
+void gfx::upload_positions(const std::vector<float> &px, uint32_t count)
+{
+	profile_scope scope(profile_phase::upload);
+	count = std::min(count, vbo_capacity);
+	float *dst = begin_upload();
+
+	// already floats, split the copy so each thread streams its own part
+	size_t bytes = sizeof(float) * 3 * (size_t)count;
+	#pragma omp parallel
+	{
+		int t = omp_get_thread_num();
+		int threads = omp_get_num_threads();
+		size_t begin = bytes * t / threads;
+		size_t end = bytes * (t + 1) / threads;
+		memcpy((uint8_t *)dst + begin, (const uint8_t *)px.data() + begin,
+			end - begin);
+	}
+
+	end_upload(count);
+}
+
+float *gfx::begin_upload()
+{
+	if(persistent_vbos)
+	{
+		vbo_index = (vbo_index + 1) % vbo_ring_size;
+		if(vbo_fences[vbo_index])
+		{
+			// normally already signaled since it was drawn two frames ago
+			GLenum ret = glClientWaitSync(vbo_fences[vbo_index],
+				GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+			while(ret == GL_TIMEOUT_EXPIRED)
+				ret = glClientWaitSync(vbo_fences[vbo_index], 0, 1000000000);
+			glDeleteSync(vbo_fences[vbo_index]);
+			vbo_fences[vbo_index] = 0;
+		}
+		return x_mapped[vbo_index];
+	}
+
+	// orphan the old storage so the driver doesn't stall on the draw still
+	// reading it, then map the new storage
+	GLsizeiptr size = sizeof(float) * 3 * (GLsizeiptr)vbo_capacity;
+	glBindBuffer(GL_ARRAY_BUFFER, x_vbos[0]);
+	glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_STREAM_DRAW);
+	float *dst = (float *)glMapBufferRange(GL_ARRAY_BUFFER, 0, size,
+		GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	if(dst == nullptr)
+	{
+		printf("Failed to map vertex buffer\n");
+		print_opengl_error();
+		fflush(stdout);
+		exit(-1);
+	}
+	return dst;
+}
+
+void gfx::end_upload(uint32_t count, uint32_t tracers)
+{
+	if(!persistent_vbos)
+	{
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	draw_count = count;
+	draw_tracer_count = tracers;
+}
+
 void gfx::resize(int w, int h)
 {
 	win_w = w;
@@ -305,9 +547,9 @@ void gfx::load_shaders()
 
 	std::string fname = data_root + "/point_render_v330.vert";
 	FILE *f;
-	uint8_t *vert_data, *frag_data, *phys_data;
-	long fsize, vsize, phsize;
-	long ret, result;
+	uint8_t *vert_data, *frag_data;
+	long fsize, vsize;
+	long result;
 	f = fopen(fname.c_str(), "rt");
 	if(f == NULL)
 	{
@@ -329,7 +571,7 @@ void gfx::load_shaders()
 	if(result != vsize)
 	{
 		printf("ERROR: loading shader: %s\n", fname.c_str());
-		printf("Expected %d bytes but only read %d\n", vsize, result);
+		printf("Expected %ld bytes but only read %ld\n", vsize, result);
 
 		fclose(f);
 		free(vert_data);
@@ -361,7 +603,7 @@ void gfx::load_shaders()
 	if(result != fsize)
 	{
 		printf("ERROR: loading shader: %s\n", fname.c_str());
-		printf("Expected %d bytes but only read %d\n", fsize, result);
+		printf("Expected %ld bytes but only read %ld\n", fsize, result);
 
 		fclose(f);
 		free(frag_data);
@@ -491,6 +733,8 @@ int gfx::main_loop()
 				{
 					done = 1;
 				}
+				else if(rt)
+					replay_key(event.key.keysym.sym);
 				break;
 			case SDL_KEYUP:
 				break;
@@ -516,6 +760,42 @@ int gfx::main_loop()
 	return done;
 }
 
+void gfx::replay_key(SDL_Keycode key)
+{
+	double speed = rt->get_speed();
+	// skip a second of playback but always at least a frame
+	double skip = std::max(std::fabs(speed), 1.0);
+	switch(key)
+	{
+		case SDLK_SPACE:
+			rt->set_paused(!rt->get_paused());
+			break;
+		case SDLK_LEFT:
+			rt->seek(rt->get_position() - skip);
+			break;
+		case SDLK_RIGHT:
+			rt->seek(rt->get_position() + skip);
+			break;
+		case SDLK_UP:
+			rt->set_speed(speed * 2.0);
+			break;
+		case SDLK_DOWN:
+			rt->set_speed(speed * 0.5);
+			break;
+		case SDLK_r:
+			rt->set_speed(-speed);
+			break;
+		case SDLK_HOME:
+			rt->seek(0.0);
+			break;
+		case SDLK_END:
+			rt->seek((double)rt->get_frame_count());
+			break;
+		default:
+			break;
+	}
+}
+
 void gfx::print_info()
 {
 	printf("GLEW library version %s\n", glewGetString(GLEW_VERSION));
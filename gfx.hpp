@@ -3,6 +3,7 @@
 
 #define _USE_MATH_DEFINES
 #include <vector>
+#include <string>
 #include <random>
 #include <SDL2/SDL.h>
 #include <GL/glew.h>
@@ -14,6 +15,8 @@ namespace fox
 	class counter;
 }
 class physics;
+class physics_thread;
+class replay_thread;
 
 class gfx
 {
@@ -21,6 +24,16 @@ public:
 
 	gfx();
 	
+	/**
+	 * @brief Play a trajectory file back instead of simulating, call before
+	 * init()
+	 */
+	void set_replay(const std::string &fname){replay_file = fname;}
+	/**
+	 * @brief Massless tracers to simulate and draw with the bodies, call
+	 * before init(), replays don't have any
+	 */
+	void set_tracer_count(uint32_t n){tracer_count = n;}
 	void init();
 	void deinit();
 	void render();
@@ -30,9 +43,37 @@ public:
 private:
 	void print_info();
 	void load_shaders();
+	/**
+	 * @brief Creates the vertex buffer ring, persistently mapped with
+	 * ARB_buffer_storage if it is there and a single orphaned buffer if not
+	 */
+	void init_vertex_buffers();
+	void deinit_vertex_buffers();
+	/**
+	 * @brief Converts positions straight into the next free vertex buffer,
+	 * copies the tracer floats in after them and makes it the one drawn
+	 */
+	void upload_positions(const std::vector<Eigen::Vector3d> &px,
+		const std::vector<float> &tracers);
+	/**
+	 * @brief Copies count bodies of x, y, z floats into the next free vertex
+	 * buffer and makes it the one drawn
+	 */
+	void upload_positions(const std::vector<float> &px, uint32_t count);
+	/**
+	 * @brief The memory of the next free vertex buffer, end_upload() makes it
+	 * the one drawn
+	 */
+	float *begin_upload();
+	void end_upload(uint32_t count, uint32_t tracers = 0);
+	/**
+	 * @brief Replay key handling, space pauses, left and right skip a second
+	 * of playback, up and down double and halve the speed, r reverses and
+	 * home and end go to either end
+	 */
+	void replay_key(SDL_Keycode key);
 
 	fox::counter *fps_counter;
-	fox::counter *update_counter;
 	fox::counter *perf_counter;
 	SDL_Window *window;
 	SDL_GLContext context;
@@ -46,7 +87,8 @@ private:
 	std::mt19937_64 generator;
 
 	double G = 6.67408e-11;
-	uint16_t obj_count;
+	uint32_t obj_count;
+	uint32_t tracer_count;
 
 	// an empty vertex array object to bind to
 	uint32_t default_vao;
@@ -56,8 +98,30 @@ private:
 	Eigen::Projective3f P, MVP;
 
 	GLuint point_render_program, shader_vert_id, shader_frag_id;
-	GLuint x_vbo;
-	std::vector<float> x_gfx;
+	GLint vertex_loc;
+	GLint color_loc;
+
+	const static int vbo_ring_size = 3;
+	/**
+	 * @brief True when the ring is persistently mapped, false when
+	 * x_vbos[0] is orphaned and mapped every upload instead
+	 */
+	bool persistent_vbos;
+	GLuint x_vbos[vbo_ring_size];
+	/**
+	 * @brief Signaled when the GPU is done with the draw that last read each
+	 * buffer so the CPU can write it again
+	 */
+	GLsync vbo_fences[vbo_ring_size];
+	float *x_mapped[vbo_ring_size];
+	int vbo_index;
+	/**
+	 * @brief Points each vertex buffer can hold, and the bodies and the
+	 * tracers after them in the one drawn
+	 */
+	uint32_t vbo_capacity;
+	uint32_t draw_count;
+	uint32_t draw_tracer_count;
 
 	const static uint8_t perf_array_size = 8;
 	double phys_times[perf_array_size];
@@ -68,6 +132,15 @@ private:
 	double total_time;
 
 	physics *p;
+	/**
+	 * @brief Steps p on its own thread, render() only reads snapshots
+	 */
+	physics_thread *pt;
+	/**
+	 * @brief Set when replaying a trajectory, p and pt are null then
+	 */
+	replay_thread *rt;
+	std::string replay_file;
 };
 
 #endif
@@ -0,0 +1,428 @@
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <random>
+#include <cmath>
+#include <algorithm>
+#include <omp.h>
+#include <boost/program_options.hpp>
+#include <Eigen/Geometry>
+
+#include "physics.hpp"
+#include "trajectory.hpp"
+#include "profiler.hpp"
+#include "numa.hpp"
+
+namespace po = boost::program_options;
+
+int main(int argc, char **argv)
+{
+	uint32_t obj_count, tracer_count;
+	uint64_t seed;
+	uint64_t steps;
+	double dt;
+	std::string integ_name, method_name, prec_name, collision_name;
+	std::string dist_name, checkpoint, restart, trajectory, trace;
+	std::string diagnostics_file, pin_name;
+	uint64_t checkpoint_every, trajectory_every;
+	uint32_t diagnostics_every;
+	double trajectory_quantum;
+	double theta, softening, G, reorder;
+	int threads;
+	double mass[2], radius[2], distance;
+
+	po::options_description desc("grav_sim2_headless options");
+	desc.add_options()
+		("help,h", "print this message")
+		("count,n", po::value<uint32_t>(&obj_count)->default_value(1024),
+			"number of bodies")
+		("tracers", po::value<uint32_t>(&tracer_count)->default_value(0),
+			"massless tracers placed with the bodies, they feel the bodies' "
+			"gravity but exert none")
+		("seed,s", po::value<uint64_t>(&seed),
+			"random seed, picked from std::random_device if not given")
+		("steps", po::value<uint64_t>(&steps)->default_value(100),
+			"number of steps")
+		("dt", po::value<double>(&dt)->default_value(0.01), "step size")
+		("integrator,i",
+			po::value<std::string>(&integ_name)->default_value("leapfrog"),
+			"leapfrog, rk4 or hermite")
+		("force,f",
+			po::value<std::string>(&method_name)->default_value("direct"),
+			"direct, barnes_hut or tiled")
+		("precision,p",
+			po::value<std::string>(&prec_name)->default_value("double"),
+			"direct sum precision: double, float or mixed")
+		("energy", "report the relative energy drift over the run, O(N^2)")
+		("diagnostics",
+			po::value<uint32_t>(&diagnostics_every)->default_value(0),
+			"sample energy and momenta every this many steps from the force "
+			"pass, 0 for never")
+		("diagnostics-file", po::value<std::string>(&diagnostics_file),
+			"write the samples to this file as CSV")
+		("theta", po::value<double>(&theta)->default_value(0.5),
+			"Barnes-Hut opening angle")
+		("reorder", po::value<double>(&reorder)->default_value(0.1),
+			"sort the bodies along a Morton curve once this fraction of "
+			"neighbours are out of order (Barnes-Hut or collisions only), 0 "
+			"for never")
+		("collisions,c",
+			po::value<std::string>(&collision_name)->default_value("none"),
+			"none, report, elastic or merge")
+		("softening", po::value<double>(&softening)->default_value(0.0),
+			"Plummer softening length, 0 for none")
+		("G", po::value<double>(&G)->default_value(6.67408e-11),
+			"gravitational constant, 1 for N-body units")
+		("threads,t", po::value<int>(&threads)->default_value(0),
+			"OpenMP threads, 0 for the OpenMP default")
+		("pin", po::value<std::string>(&pin_name)->default_value("none"),
+			"pin the threads to CPUs: none, compact or spread")
+		("interleave", "spread the direct and tiled sum sources over the "
+			"NUMA nodes")
+		("mass-min", po::value<double>(&mass[0])->default_value(5e7), "")
+		("mass-max", po::value<double>(&mass[1])->default_value(1e8), "")
+		("radius-min", po::value<double>(&radius[0])->default_value(0.05), "")
+		("radius-max", po::value<double>(&radius[1])->default_value(0.25), "")
+		("distance", po::value<double>(&distance)->default_value(4.0),
+			"bodies start in a cube from -distance to distance")
+		("distribution,d",
+			po::value<std::string>(&dist_name)->default_value("uniform"),
+			"uniform, plummer or disk")
+		("checkpoint", po::value<std::string>(&checkpoint),
+			"write the state to this file at the end of the run")
+		("checkpoint-every",
+			po::value<uint64_t>(&checkpoint_every)->default_value(0),
+			"also write the checkpoint every this many steps, 0 for only at the "
+			"end")
+		("restart", po::value<std::string>(&restart),
+			"start from this checkpoint in place of new bodies, the count, G "
+			"and softening come from the file")
+		("trajectory", po::value<std::string>(&trajectory),
+			"record positions to this file from a background thread")
+		("trajectory-every",
+			po::value<uint64_t>(&trajectory_every)->default_value(1),
+			"record every this many steps")
+		("trajectory-quantum",
+			po::value<double>(&trajectory_quantum)->default_value(1e-4),
+			"positions are recorded to the nearest multiple of this")
+		("profile", "time each phase and print percentiles and per thread "
+			"totals at the end")
+		("trace", po::value<std::string>(&trace),
+			"also write the phase timings as a Chrome trace to this file")
+	;
+
+	po::variables_map vm;
+	try
+	{
+		po::store(po::parse_command_line(argc, argv, desc), vm);
+		po::notify(vm);
+	}
+	catch(const po::error &e)
+	{
+		std::cerr << "ERROR: " << e.what() << "\n" << desc << std::endl;
+		return 1;
+	}
+
+	if(vm.count("help"))
+	{
+		std::cout << desc << std::endl;
+		return 0;
+	}
+
+	physics::integrator integ;
+	if(!physics::parse_integrator(integ_name, integ))
+	{
+		std::cerr << "ERROR: unknown integrator " << integ_name << std::endl;
+		return 1;
+	}
+	physics::force_method method;
+	if(!physics::parse_force_method(method_name, method))
+	{
+		std::cerr << "ERROR: unknown force method " << method_name << std::endl;
+		return 1;
+	}
+	precision prec;
+	if(!parse_precision(prec_name, prec))
+	{
+		std::cerr << "ERROR: unknown precision " << prec_name << std::endl;
+		return 1;
+	}
+	physics::distribution dist;
+	if(!physics::parse_distribution(dist_name, dist))
+	{
+		std::cerr << "ERROR: unknown distribution " << dist_name << std::endl;
+		return 1;
+	}
+	physics::collision_mode collisions;
+	if(!physics::parse_collision_mode(collision_name, collisions))
+	{
+		std::cerr << "ERROR: unknown collision mode " << collision_name <<
+			std::endl;
+		return 1;
+	}
+	thread_pinning pin;
+	if(!parse_thread_pinning(pin_name, pin))
+	{
+		std::cerr << "ERROR: unknown thread pinning " << pin_name << std::endl;
+		return 1;
+	}
+	if(obj_count < 2 || obj_count > physics::max_obj_count)
+	{
+		std::cerr << "ERROR: count must be 2 to " << physics::max_obj_count <<
+			std::endl;
+		return 1;
+	}
+	if(tracer_count > physics::max_obj_count)
+	{
+		std::cerr << "ERROR: tracers must be 0 to " << physics::max_obj_count <<
+			std::endl;
+		return 1;
+	}
+	if(tracer_count > 0 && !restart.empty())
+	{
+		std::cerr << "ERROR: tracers aren't saved in checkpoints, they can't "
+			"be used with restart" << std::endl;
+		return 1;
+	}
+
+	if(!vm.count("seed"))
+		seed = std::random_device{}();
+	if(threads > 0)
+		omp_set_num_threads(threads);
+	if(pin != thread_pinning::none && !pin_threads(pin))
+		return 1;
+
+	bool profile = vm.count("profile") > 0 || !trace.empty();
+	profiler::set_enabled(profile);
+	profiler::set_tracing(!trace.empty());
+	if(profile)
+		profiler::set_thread_name("main");
+
+	physics *p = new physics();
+	p->seed(seed);
+	p->set_mass_range(mass[0], mass[1]);
+	p->set_radius_range(radius[0], radius[1]);
+	p->set_distance_range(-distance, distance);
+	p->set_integrator(integ);
+	p->set_force_method(method);
+	p->set_theta(theta);
+	p->set_reorder_threshold(reorder);
+	p->set_precision(prec);
+	p->set_softening(softening);
+	p->set_G(G);
+	p->set_interleave(vm.count("interleave") > 0);
+	p->set_collision_mode(collisions);
+	p->set_distribution(dist);
+	p->set_tracer_count(tracer_count);
+	if(!diagnostics_file.empty() && diagnostics_every == 0)
+		diagnostics_every = 1;
+	p->set_diagnostics_interval(diagnostics_every);
+
+	printf("bodies:     %u\n", obj_count);
+	if(tracer_count > 0)
+		printf("tracers:    %u\n", tracer_count);
+	printf("seed:       %llu\n", (unsigned long long)seed);
+	printf("steps:      %llu\n", (unsigned long long)steps);
+	printf("dt:         %g\n", dt);
+	printf("integrator: %s\n", physics::integrator_name(integ));
+	printf("force:      %s\n", physics::force_method_name(method));
+	printf("kernel:     %s\n", simd_isa_name(p->get_simd_isa()));
+	printf("precision:  %s\n", precision_name(prec));
+	printf("distribution: %s\n", physics::distribution_name(dist));
+	printf("collisions: %s\n", physics::collision_mode_name(collisions));
+	printf("softening:  %g\n", softening);
+	printf("G:          %g\n", G);
+	printf("threads:    %d\n", omp_get_max_threads());
+	printf("pinning:    %s\n", thread_pinning_name(pin));
+	printf("numa nodes: %d%s\n", numa_node_count(),
+		p->get_interleave() ? ", sources interleaved" : "");
+	if(!restart.empty())
+		printf("restart:    %s\n", restart.c_str());
+	if(!checkpoint.empty())
+		printf("checkpoint: %s\n", checkpoint.c_str());
+	if(!trajectory.empty())
+		printf("trajectory: %s\n", trajectory.c_str());
+	fflush(stdout);
+
+	typedef std::chrono::steady_clock clock;
+	clock::time_point t0 = clock::now();
+	if(restart.empty() ? !p->init(obj_count) :
+		!p->load_checkpoint(restart))
+	{
+		delete p;
+		return 1;
+	}
+	clock::time_point t1 = clock::now();
+	if(p->get_radius_scale() < 1.0)
+	{
+		printf("radii scaled by %g to fit the %s distribution\n",
+			p->get_radius_scale(), physics::distribution_name(dist));
+		fflush(stdout);
+		t1 = clock::now();
+	}
+	if(!restart.empty())
+	{
+		printf("restarted with %u bodies at time %g, G %g, softening %g\n",
+			p->get_obj_count(), p->get_total_time(), p->get_G(),
+			p->get_softening());
+		fflush(stdout);
+		t1 = clock::now();
+	}
+	trajectory_writer writer;
+	uint64_t step_count = 0;
+	if(!trajectory.empty())
+	{
+		if(!writer.open(trajectory, trajectory_quantum))
+			return 1;
+		if(trajectory_every == 0)
+			trajectory_every = 1;
+		writer.push(0, p->get_total_time(), p->get_pos_view(),
+			p->get_id_order_view());
+		p->set_step_callback([&](const physics &state)
+		{
+			step_count++;
+			if(step_count % trajectory_every == 0)
+				writer.push(step_count, state.get_total_time(),
+					state.get_pos_view(), state.get_id_order_view());
+		});
+	}
+	FILE *diag_out = nullptr;
+	size_t diag_written = 0;
+	if(!diagnostics_file.empty())
+	{
+		diag_out = fopen(diagnostics_file.c_str(), "w");
+		if(diag_out == NULL)
+		{
+			printf("ERROR couldn't open %s\n", diagnostics_file.c_str());
+			return 1;
+		}
+		fprintf(diag_out, "time,kinetic,potential,energy,px,py,pz,lx,ly,lz\n");
+	}
+	bool energy = vm.count("energy") > 0;
+	double e0 = energy ? p->get_energy() : 0.0;
+	// don't time the energy sum
+	if(energy)
+		t1 = clock::now();
+
+	// checkpoints aren't counted in the run time
+	double checkpoint_time = 0.0;
+	for(uint64_t i = 0; i < steps; i++)
+	{
+		p->step(dt);
+		// samples go out as they come so a run that is stopped keeps them
+		array_view<physics::diagnostics> samples = p->get_diagnostics();
+		for(; diag_out != nullptr && diag_written < samples.size();
+			diag_written++)
+		{
+			const physics::diagnostics &d = samples[diag_written];
+			fprintf(diag_out, "%.9g,%.17g,%.17g,%.17g,%.17g,%.17g,%.17g,"
+				"%.17g,%.17g,%.17g\n", d.time, d.kinetic, d.potential,
+				d.energy(), d.momentum[0], d.momentum[1], d.momentum[2],
+				d.angular_momentum[0], d.angular_momentum[1],
+				d.angular_momentum[2]);
+		}
+		bool last = i + 1 == steps;
+		if(checkpoint.empty() ||
+			!(last || (checkpoint_every > 0 && (i + 1) % checkpoint_every == 0)))
+			continue;
+		clock::time_point c0 = clock::now();
+		if(!p->save_checkpoint(checkpoint))
+			return 1;
+		checkpoint_time += std::chrono::duration<double>(clock::now() -
+			c0).count();
+	}
+	clock::time_point t2 = clock::now();
+	if(diag_out != nullptr && fclose(diag_out) != 0)
+	{
+		printf("ERROR couldn't write %s\n", diagnostics_file.c_str());
+		return 1;
+	}
+	if(!trajectory.empty())
+	{
+		p->set_step_callback(nullptr);
+		if(!writer.close())
+			return 1;
+	}
+
+	double init_time = std::chrono::duration<double>(t1 - t0).count();
+	double run_time = std::chrono::duration<double>(t2 - t1).count() -
+		checkpoint_time;
+	uint64_t interactions = p->get_interactions();
+	printf("init time:          %.6f s\n", init_time);
+	printf("run time:           %.6f s\n", run_time);
+	printf("steps/sec:          %.3f\n", steps / run_time);
+	printf("interactions:       %llu\n", (unsigned long long)interactions);
+	printf("interactions/sec:   %.6g\n", interactions / run_time);
+	printf("reorders:           %u\n", p->get_reorder_count());
+	if(!checkpoint.empty())
+		printf("checkpoint time:    %.6f s\n", checkpoint_time);
+	if(!trajectory.empty())
+	{
+		printf("trajectory frames:  %llu (%llu dropped)\n",
+			(unsigned long long)writer.get_frames_written(),
+			(unsigned long long)writer.get_frames_dropped());
+		printf("trajectory size:    %llu bytes, %.3f of raw doubles\n",
+			(unsigned long long)writer.get_bytes_written(),
+			(double)writer.get_bytes_written() / writer.get_raw_bytes());
+	}
+	if(collisions != physics::collision_mode::none)
+	{
+		printf("collisions:         %llu\n",
+			(unsigned long long)p->get_collision_count());
+		printf("bodies left:        %u\n", p->get_obj_count());
+	}
+	array_view<physics::diagnostics> samples = p->get_diagnostics();
+	if(samples.size() > 0)
+	{
+		// drifts are from the first sample, momenta relative to the sum of
+		// the magnitudes so a system at rest doesn't divide by zero
+		const physics::diagnostics &first = samples[0];
+		double e_drift = 0.0, p_drift = 0.0, l_drift = 0.0;
+		double p_scale = 0.0, l_scale = 0.0;
+		const array_view<Eigen::Vector3d> pos = p->get_pos_view();
+		const array_view<Eigen::Vector3d> vel = p->get_vel_view();
+		const array_view<double> m = p->get_mass_view();
+		for(size_t k = 0; k < p->get_obj_count(); k++)
+		{
+			p_scale += m[k] * vel[k].norm();
+			l_scale += m[k] * pos[k].cross(vel[k]).norm();
+		}
+		for(size_t k = 0; k < samples.size(); k++)
+		{
+			const physics::diagnostics &d = samples[k];
+			e_drift = std::max(e_drift, std::fabs(d.energy() - first.energy()) /
+				std::fabs(first.energy()));
+			p_drift = std::max(p_drift, (d.momentum - first.momentum).norm());
+			l_drift = std::max(l_drift, (d.angular_momentum -
+				first.angular_momentum).norm());
+		}
+		printf("diag samples:       %zu\n", samples.size());
+		printf("diag energy drift:  %.6g\n", e_drift);
+		printf("diag P drift:       %.6g\n",
+			p_scale > 0.0 ? p_drift / p_scale : p_drift);
+		printf("diag L drift:       %.6g\n",
+			l_scale > 0.0 ? l_drift / l_scale : l_drift);
+	}
+	if(energy)
+	{
+		double e1 = p->get_energy();
+		printf("energy start:       %.9g\n", e0);
+		printf("energy end:         %.9g\n", e1);
+		printf("energy drift:       %.6g\n", std::fabs(e1 - e0) / std::fabs(e0));
+	}
+
+	if(profile)
+	{
+		printf("\n");
+		profiler::report(stdout);
+	}
+	if(!trace.empty() && !profiler::write_chrome_trace(trace))
+		return 1;
+
+	p->deinit();
+	delete p;
+
+	return 0;
+}
@@ -0,0 +1,295 @@
+#include "kernels.hpp"
+
+#include <cmath>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+static bool cpu_has_avx(bool avx512)
+{
+	int info[4];
+	__cpuid(info, 0);
+	int max_leaf = info[0];
+	__cpuid(info, 1);
+	// OSXSAVE and AVX
+	if(!(info[2] & (1 << 27)) || !(info[2] & (1 << 28)))
+		return false;
+	unsigned long long xcr0 = _xgetbv(0);
+	// the OS saves the xmm and ymm registers
+	if((xcr0 & 0x6) != 0x6)
+		return false;
+	if(!avx512)
+		return true;
+	if(max_leaf < 7)
+		return false;
+	__cpuidex(info, 7, 0);
+	// AVX-512F and the OS saves opmask and zmm state
+	return (info[1] & (1 << 16)) && (xcr0 & 0xe6) == 0xe6;
+}
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+static bool cpu_has_avx(bool avx512)
+{
+	__builtin_cpu_init();
+	if(avx512)
+		return __builtin_cpu_supports("avx512f");
+	return __builtin_cpu_supports("avx");
+}
+#else
+static bool cpu_has_avx(bool avx512)
+{
+	return false;
+}
+#endif
+
+simd_isa detect_simd_isa()
+{
+	if(accel_avx512_built() && cpu_has_avx(true))
+		return simd_isa::avx512;
+	if(accel_avx_built() && cpu_has_avx(false))
+		return simd_isa::avx;
+	return simd_isa::scalar;
+}
+
+const char *simd_isa_name(simd_isa isa)
+{
+	switch(isa)
+	{
+		case simd_isa::avx512:
+			return "avx512";
+		case simd_isa::avx:
+			return "avx";
+		default:
+			return "scalar";
+	}
+}
+
+accel_kernel get_accel_kernel(simd_isa isa, bool softened, bool unit_g,
+	bool potential)
+{
+	switch(isa)
+	{
+		case simd_isa::avx512:
+			return get_accel_avx512(softened, unit_g, potential);
+		case simd_isa::avx:
+			return get_accel_avx(softened, unit_g, potential);
+		default:
+			return get_accel_scalar(softened, unit_g, potential);
+	}
+}
+
+pair_kernel get_pair_kernel(simd_isa isa, bool softened, bool unit_g,
+	bool potential)
+{
+	switch(isa)
+	{
+		case simd_isa::avx512:
+			return get_pair_avx512(softened, unit_g, potential);
+		case simd_isa::avx:
+			return get_pair_avx(softened, unit_g, potential);
+		default:
+			return get_pair_scalar(softened, unit_g, potential);
+	}
+}
+
+tracer_kernel get_tracer_kernel(simd_isa isa, bool softened, bool unit_g)
+{
+	switch(isa)
+	{
+		case simd_isa::avx512:
+			return get_tracer_avx512(softened, unit_g);
+		case simd_isa::avx:
+			return get_tracer_avx(softened, unit_g);
+		default:
+			return get_tracer_scalar(softened, unit_g);
+	}
+}
+
+const char *precision_name(precision prec)
+{
+	switch(prec)
+	{
+		case precision::fp32:
+			return "float";
+		case precision::mixed:
+			return "mixed";
+		default:
+			return "double";
+	}
+}
+
+bool parse_precision(const std::string &name, precision &prec)
+{
+	for(precision k : {precision::fp64, precision::fp32, precision::mixed})
+	{
+		if(name == precision_name(k))
+		{
+			prec = k;
+			return true;
+		}
+	}
+	return false;
+}
+
+accel_kernel_f get_accel_kernel_f(simd_isa isa, precision prec,
+	bool softened, bool unit_g, bool potential)
+{
+	bool mixed = prec == precision::mixed;
+	switch(isa)
+	{
+		case simd_isa::avx512:
+			return get_accel_avx512_f(mixed, softened, unit_g, potential);
+		case simd_isa::avx:
+			return get_accel_avx_f(mixed, softened, unit_g, potential);
+		default:
+			return get_accel_scalar_f(mixed, softened, unit_g, potential);
+	}
+}
+
+template<typename policy, typename T, typename acc_t>
+static void accel_scalar(const basic_body_soa<T> &src, uint32_t begin,
+	uint32_t end, const double *p, double G, double eps2, double *a,
+	double *phi)
+{
+	accel_scalar_t<policy, T, acc_t>(src, begin, end, p, G, eps2, a, phi);
+}
+
+accel_kernel get_accel_scalar(bool softened, bool unit_g, bool potential)
+{
+	typedef double T;
+	return select_policy<accel_kernel>(softened, unit_g, potential,
+		accel_scalar<force_policy<false, false>, T, T>,
+		accel_scalar<force_policy<true, false>, T, T>,
+		accel_scalar<force_policy<false, true>, T, T>,
+		accel_scalar<force_policy<true, true>, T, T>,
+		accel_scalar<force_policy<false, false, true>, T, T>,
+		accel_scalar<force_policy<true, false, true>, T, T>,
+		accel_scalar<force_policy<false, true, true>, T, T>,
+		accel_scalar<force_policy<true, true, true>, T, T>);
+}
+
+accel_kernel_f get_accel_scalar_f(bool mixed, bool softened, bool unit_g,
+	bool potential)
+{
+	typedef float T;
+	if(mixed)
+	{
+		return select_policy<accel_kernel_f>(softened, unit_g, potential,
+			accel_scalar<force_policy<false, false>, T, double>,
+			accel_scalar<force_policy<true, false>, T, double>,
+			accel_scalar<force_policy<false, true>, T, double>,
+			accel_scalar<force_policy<true, true>, T, double>,
+			accel_scalar<force_policy<false, false, true>, T, double>,
+			accel_scalar<force_policy<true, false, true>, T, double>,
+			accel_scalar<force_policy<false, true, true>, T, double>,
+			accel_scalar<force_policy<true, true, true>, T, double>);
+	}
+	return select_policy<accel_kernel_f>(softened, unit_g, potential,
+		accel_scalar<force_policy<false, false>, T, T>,
+		accel_scalar<force_policy<true, false>, T, T>,
+		accel_scalar<force_policy<false, true>, T, T>,
+		accel_scalar<force_policy<true, true>, T, T>,
+		accel_scalar<force_policy<false, false, true>, T, T>,
+		accel_scalar<force_policy<true, false, true>, T, T>,
+		accel_scalar<force_policy<false, true, true>, T, T>,
+		accel_scalar<force_policy<true, true, true>, T, T>);
+}
+
+template<typename policy>
+static void pair_scalar(const body_soa &src, uint32_t i_begin, uint32_t i_end,
+	uint32_t j_begin, uint32_t j_end, double G, double eps2, double *ax,
+	double *ay, double *az, double *phi)
+{
+	// within one range each pair is done from its lower index
+	for(uint32_t i = i_begin; i < i_end; i++)
+		pair_row_scalar_t<policy>(src, i, j_begin == i_begin ? i + 1 :
+			j_begin, j_end, G, eps2, ax, ay, az, phi);
+}
+
+pair_kernel get_pair_scalar(bool softened, bool unit_g, bool potential)
+{
+	return select_policy<pair_kernel>(softened, unit_g, potential,
+		pair_scalar<force_policy<false, false>>,
+		pair_scalar<force_policy<true, false>>,
+		pair_scalar<force_policy<false, true>>,
+		pair_scalar<force_policy<true, true>>,
+		pair_scalar<force_policy<false, false, true>>,
+		pair_scalar<force_policy<true, false, true>>,
+		pair_scalar<force_policy<false, true, true>>,
+		pair_scalar<force_policy<true, true, true>>);
+}
+
+tracer_kernel get_tracer_scalar(bool softened, bool unit_g)
+{
+	return select_policy<tracer_kernel>(softened, unit_g,
+		tracer_scalar_t<force_policy<false, false>>,
+		tracer_scalar_t<force_policy<true, false>>,
+		tracer_scalar_t<force_policy<false, true>>,
+		tracer_scalar_t<force_policy<true, true>>);
+}
+
+template<typename policy>
+static void accel_jerk(const body_soa &src, uint32_t begin, uint32_t end,
+	const double *p, const double *pv, double G, double eps2, double *a,
+	double *j, double *phi)
+{
+	const double *x = src.x.data();
+	const double *y = src.y.data();
+	const double *z = src.z.data();
+	const double *vx = src.vx.data();
+	const double *vy = src.vy.data();
+	const double *vz = src.vz.data();
+	const double *m = src.m.data();
+	double ax = 0.0, ay = 0.0, az = 0.0;
+	double jx = 0.0, jy = 0.0, jz = 0.0;
+	double pot = 0.0;
+	for(uint32_t k = begin; k < end; k++)
+	{
+		double dx = x[k] - p[0];
+		double dy = y[k] - p[1];
+		double dz = z[k] - p[2];
+		double dvx = vx[k] - pv[0];
+		double dvy = vy[k] - pv[1];
+		double dvz = vz[k] - pv[2];
+		double r2 = dx * dx + dy * dy + dz * dz;
+		if(policy::softened)
+			r2 += eps2;
+		double inv_r2 = 1.0 / r2;
+		double inv_r = std::sqrt(inv_r2);
+		double s = m[k] * inv_r * inv_r2;
+		// 3 (r . v) / r^2
+		double rv = 3.0 * (dx * dvx + dy * dvy + dz * dvz) * inv_r2;
+		ax += dx * s;
+		ay += dy * s;
+		az += dz * s;
+		jx += (dvx - rv * dx) * s;
+		jy += (dvy - rv * dy) * s;
+		jz += (dvz - rv * dz) * s;
+		if(policy::potential)
+			pot += m[k] * inv_r;
+	}
+	if(policy::unit_g)
+		G = 1.0;
+	a[0] += G * ax;
+	a[1] += G * ay;
+	a[2] += G * az;
+	j[0] += G * jx;
+	j[1] += G * jy;
+	j[2] += G * jz;
+	if(policy::potential)
+		*phi -= G * pot;
+}
+
+jerk_kernel get_jerk_kernel(bool softened, bool unit_g, bool potential)
+{
+	return select_policy<jerk_kernel>(softened, unit_g, potential,
+		accel_jerk<force_policy<false, false>>,
+		accel_jerk<force_policy<true, false>>,
+		accel_jerk<force_policy<false, true>>,
+		accel_jerk<force_policy<true, true>>,
+		accel_jerk<force_policy<false, false, true>>,
+		accel_jerk<force_policy<true, false, true>>,
+		accel_jerk<force_policy<false, true, true>>,
+		accel_jerk<force_policy<true, true, true>>);
+}
@@ -0,0 +1,358 @@
+#ifndef KERNELS_HPP
+#define KERNELS_HPP
+
+#include <cstdint>
+#include <string>
+#include <cmath>
+
+#include "soa.hpp"
+
+/**
+ * @brief Instruction sets the direct sum kernels are built for
+ */
+enum class simd_isa
+{
+	scalar,
+	/**
+	 * @brief 4 doubles per instruction
+	 */
+	avx,
+	/**
+	 * @brief 8 doubles per instruction
+	 */
+	avx512
+};
+
+/**
+ * @brief Finds the best instruction set supported by both the CPU and this
+ * build
+ */
+simd_isa detect_simd_isa();
+const char *simd_isa_name(simd_isa isa);
+
+/**
+ * @brief Precision the direct sum pairwise forces are found in, positions
+ * and velocities are always integrated in double
+ */
+enum class precision
+{
+	/**
+	 * @brief Double sources, pairwise terms and sums
+	 */
+	fp64,
+	/**
+	 * @brief Float sources, pairwise terms and sums, twice the SIMD width and
+	 * half the memory traffic of fp64
+	 */
+	fp32,
+	/**
+	 * @brief Float sources and pairwise terms, summed in float over short
+	 * blocks that are accumulated in double
+	 */
+	mixed
+};
+
+const char *precision_name(precision prec);
+bool parse_precision(const std::string &name, precision &prec);
+
+/**
+ * @brief Compile time options of the pairwise kernels, get_accel_kernel()
+ * picks the instantiation at runtime so the inner loops never test them
+ */
+template<bool softened_, bool unit_g_, bool potential_ = false>
+struct force_policy
+{
+	/**
+	 * @brief Plummer softening, r^2 + eps^2 in place of r^2
+	 */
+	constexpr static bool softened = softened_;
+	/**
+	 * @brief G is 1 in the unit system (or already folded into the masses) so
+	 * the sums are not scaled by it
+	 */
+	constexpr static bool unit_g = unit_g_;
+	/**
+	 * @brief Also sum the potential at the point, only used on the steps the
+	 * conservation diagnostics are sampled
+	 */
+	constexpr static bool potential = potential_;
+};
+
+/**
+ * @brief Picks one of the four force_policy instantiations of a kernel
+ */
+template<typename F>
+F select_policy(bool softened, bool unit_g, F plain, F soft, F unit,
+	F soft_unit)
+{
+	if(softened)
+		return unit_g ? soft_unit : soft;
+	return unit_g ? unit : plain;
+}
+
+/**
+ * @brief Picks one of the eight force_policy instantiations of a kernel, the
+ * last four sum the potential
+ */
+template<typename F>
+F select_policy(bool softened, bool unit_g, bool potential, F plain, F soft,
+	F unit, F soft_unit, F pot, F pot_soft, F pot_unit, F pot_soft_unit)
+{
+	if(potential)
+		return select_policy(softened, unit_g, pot, pot_soft, pot_unit,
+			pot_soft_unit);
+	return select_policy(softened, unit_g, plain, soft, unit, soft_unit);
+}
+
+/**
+ * @brief Direct sum acceleration on a point from the sources in [begin, end),
+ * the self term is left out by the caller splitting the range around it
+ * @param src The sources
+ * @param begin First source
+ * @param end One past the last source
+ * @param p The point (x, y, z)
+ * @param G Gravitational constant, ignored by unit_g instantiations
+ * @param eps2 Softening length squared, ignored unless softened
+ * @param a The acceleration (x, y, z) is added to this
+ * @param phi The potential per unit mass at the point (-G sum m / r) is added
+ * to this by the potential instantiations, the others don't touch it
+ */
+typedef void (*accel_kernel)(const body_soa &src, uint32_t begin,
+	uint32_t end, const double *p, double G, double eps2, double *a,
+	double *phi);
+
+/**
+ * @brief The same over single precision sources, the point and the result
+ * stay double
+ */
+typedef void (*accel_kernel_f)(const body_soa_f &src, uint32_t begin,
+	uint32_t end, const double *p, double G, double eps2, double *a,
+	double *phi);
+
+/**
+ * @brief Direct sum acceleration and jerk (da/dt) on a point from the sources
+ * in [begin, end), needs the source velocities
+ * @param pv The velocity of the point (x, y, z)
+ * @param j The jerk (x, y, z) is added to this
+ */
+typedef void (*jerk_kernel)(const body_soa &src, uint32_t begin,
+	uint32_t end, const double *p, const double *pv, double G, double eps2,
+	double *a, double *j, double *phi);
+
+/**
+ * @brief Both sides of every pair between sources i in [i_begin, i_end) and
+ * j in [j_begin, j_end), the ranges are either the same (each pair in it is
+ * done once) or don't overlap. Each pair's terms are added to i and
+ * subtracted from j, with G already applied.
+ * @param ax Acceleration x components indexed like src, and ay and az
+ * @param phi Potentials indexed like src, only the potential instantiations
+ * use it
+ */
+typedef void (*pair_kernel)(const body_soa &src, uint32_t i_begin,
+	uint32_t i_end, uint32_t j_begin, uint32_t j_end, double G, double eps2,
+	double *ax, double *ay, double *az, double *phi);
+
+/**
+ * @brief Acceleration on the tracers in [i_begin, i_end) from the sources in
+ * [j_begin, j_end), written (not added) to the tracers' ax, ay and az with G
+ * applied. The SIMD versions load a block of tracers and broadcast one source
+ * at a time against it, so a short source list still fills every lane.
+ */
+typedef void (*tracer_kernel)(const body_soa &src, uint32_t j_begin,
+	uint32_t j_end, tracer_soa &t, uint32_t i_begin, uint32_t i_end,
+	double G, double eps2);
+
+/**
+ * @param potential Pick the instantiation that also sums the potential
+ */
+accel_kernel get_accel_kernel(simd_isa isa, bool softened = false,
+	bool unit_g = false, bool potential = false);
+/**
+ * @param prec precision::fp32 or precision::mixed
+ */
+accel_kernel_f get_accel_kernel_f(simd_isa isa, precision prec,
+	bool softened = false, bool unit_g = false, bool potential = false);
+jerk_kernel get_jerk_kernel(bool softened = false, bool unit_g = false,
+	bool potential = false);
+pair_kernel get_pair_kernel(simd_isa isa, bool softened = false,
+	bool unit_g = false, bool potential = false);
+/**
+ * @brief Tracers have no potential energy (they are massless) so there are
+ * only the four softened and unit G instantiations
+ */
+tracer_kernel get_tracer_kernel(simd_isa isa, bool softened = false,
+	bool unit_g = false);
+
+/**
+ * @brief Per instruction set selection, each is in the translation unit
+ * built for that instruction set
+ */
+accel_kernel get_accel_scalar(bool softened, bool unit_g, bool potential);
+accel_kernel get_accel_avx(bool softened, bool unit_g, bool potential);
+accel_kernel get_accel_avx512(bool softened, bool unit_g, bool potential);
+accel_kernel_f get_accel_scalar_f(bool mixed, bool softened, bool unit_g,
+	bool potential);
+accel_kernel_f get_accel_avx_f(bool mixed, bool softened, bool unit_g,
+	bool potential);
+accel_kernel_f get_accel_avx512_f(bool mixed, bool softened, bool unit_g,
+	bool potential);
+pair_kernel get_pair_scalar(bool softened, bool unit_g, bool potential);
+pair_kernel get_pair_avx(bool softened, bool unit_g, bool potential);
+pair_kernel get_pair_avx512(bool softened, bool unit_g, bool potential);
+tracer_kernel get_tracer_scalar(bool softened, bool unit_g);
+tracer_kernel get_tracer_avx(bool softened, bool unit_g);
+tracer_kernel get_tracer_avx512(bool softened, bool unit_g);
+
+/**
+ * @brief Portable direct sum, pairwise terms in T and the sum in acc_t. This
+ * is also the remainder loop of the AVX kernels, it must not be instantiated
+ * in kernels_avx512.cpp where it would be built with AVX-512 enabled.
+ */
+template<typename policy, typename T, typename acc_t>
+void accel_scalar_t(const basic_body_soa<T> &src, uint32_t begin,
+	uint32_t end, const double *p, double G, double eps2, double *a,
+	double *phi)
+{
+	const T *x = src.x.data();
+	const T *y = src.y.data();
+	const T *z = src.z.data();
+	const T *m = src.m.data();
+	const T px = (T)p[0];
+	const T py = (T)p[1];
+	const T pz = (T)p[2];
+	const T e2 = (T)eps2;
+	acc_t ax = 0, ay = 0, az = 0;
+	acc_t pot = 0;
+	for(uint32_t j = begin; j < end; j++)
+	{
+		T dx = x[j] - px;
+		T dy = y[j] - py;
+		T dz = z[j] - pz;
+		T r2 = dx * dx + dy * dy + dz * dz;
+		if(policy::softened)
+			r2 += e2;
+		T inv_r = (T)1 / std::sqrt(r2);
+		T s = m[j] * inv_r * inv_r * inv_r;
+		ax += dx * s;
+		ay += dy * s;
+		az += dz * s;
+		if(policy::potential)
+			pot += m[j] * inv_r;
+	}
+	if(policy::unit_g)
+		G = 1.0;
+	a[0] += G * (double)ax;
+	a[1] += G * (double)ay;
+	a[2] += G * (double)az;
+	if(policy::potential)
+		*phi -= G * (double)pot;
+}
+
+/**
+ * @brief One row of a pair_kernel, source i against [j_begin, j_end), also
+ * the remainder loop of the AVX row with the same restriction as
+ * accel_scalar_t()
+ */
+template<typename policy>
+void pair_row_scalar_t(const body_soa &src, uint32_t i, uint32_t j_begin,
+	uint32_t j_end, double G, double eps2, double *ax, double *ay,
+	double *az, double *phi)
+{
+	const double *x = src.x.data();
+	const double *y = src.y.data();
+	const double *z = src.z.data();
+	const double *m = src.m.data();
+	if(policy::unit_g)
+		G = 1.0;
+	const double xi = x[i];
+	const double yi = y[i];
+	const double zi = z[i];
+	// i's mass with G folded in for the j side, the i side is scaled once
+	const double gmi = G * m[i];
+	double sx = 0.0, sy = 0.0, sz = 0.0;
+	double pot = 0.0;
+	for(uint32_t j = j_begin; j < j_end; j++)
+	{
+		double dx = x[j] - xi;
+		double dy = y[j] - yi;
+		double dz = z[j] - zi;
+		double r2 = dx * dx + dy * dy + dz * dz;
+		if(policy::softened)
+			r2 += eps2;
+		double inv_r = 1.0 / std::sqrt(r2);
+		double w = inv_r * inv_r * inv_r;
+		double wj = m[j] * w;
+		double wi = gmi * w;
+		sx += dx * wj;
+		sy += dy * wj;
+		sz += dz * wj;
+		ax[j] -= dx * wi;
+		ay[j] -= dy * wi;
+		az[j] -= dz * wi;
+		if(policy::potential)
+		{
+			pot += m[j] * inv_r;
+			phi[j] -= gmi * inv_r;
+		}
+	}
+	ax[i] += G * sx;
+	ay[i] += G * sy;
+	az[i] += G * sz;
+	if(policy::potential)
+		phi[i] -= G * pot;
+}
+
+/**
+ * @brief A tracer_kernel one tracer at a time, also the remainder loop of the
+ * AVX tracer kernel with the same restriction as accel_scalar_t()
+ */
+template<typename policy>
+void tracer_scalar_t(const body_soa &src, uint32_t j_begin, uint32_t j_end,
+	tracer_soa &t, uint32_t i_begin, uint32_t i_end, double G, double eps2)
+{
+	const double *x = src.x.data();
+	const double *y = src.y.data();
+	const double *z = src.z.data();
+	const double *m = src.m.data();
+	if(policy::unit_g)
+		G = 1.0;
+	for(uint32_t i = i_begin; i < i_end; i++)
+	{
+		const double px = t.x[i];
+		const double py = t.y[i];
+		const double pz = t.z[i];
+		double ax = 0.0, ay = 0.0, az = 0.0;
+		for(uint32_t j = j_begin; j < j_end; j++)
+		{
+			double dx = x[j] - px;
+			double dy = y[j] - py;
+			double dz = z[j] - pz;
+			double r2 = dx * dx + dy * dy + dz * dz;
+			if(policy::softened)
+				r2 += eps2;
+			double inv_r = 1.0 / std::sqrt(r2);
+			double s = m[j] * inv_r * inv_r * inv_r;
+			ax += dx * s;
+			ay += dy * s;
+			az += dz * s;
+		}
+		t.ax[i] = G * ax;
+		t.ay[i] = G * ay;
+		t.az[i] = G * az;
+	}
+}
+
+/**
+ * @brief SIMD iterations the mixed kernels sum in float before adding the
+ * partial sums into the double accumulators
+ */
+const uint32_t mixed_block = 64;
+
+/**
+ * @brief True if the translation unit was compiled with the instruction set
+ * enabled, the kernel falls back to the next best one otherwise
+ */
+bool accel_avx_built();
+bool accel_avx512_built();
+
+#endif
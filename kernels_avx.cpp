@@ -0,0 +1,413 @@
+#include "kernels.hpp"
+
+#include <type_traits>
+
+#ifdef __AVX__
+#include <immintrin.h>
+
+bool accel_avx_built()
+{
+	return true;
+}
+
+template<typename policy>
+static void accel_avx(const body_soa &src, uint32_t begin, uint32_t end,
+	const double *p, double G, double eps2, double *a, double *phi)
+{
+	const double *x = src.x.data();
+	const double *y = src.y.data();
+	const double *z = src.z.data();
+	const double *m = src.m.data();
+
+	__m256d px = _mm256_set1_pd(p[0]);
+	__m256d py = _mm256_set1_pd(p[1]);
+	__m256d pz = _mm256_set1_pd(p[2]);
+	__m256d e2 = _mm256_set1_pd(eps2);
+	__m256d one = _mm256_set1_pd(1.0);
+	__m256d ax = _mm256_setzero_pd();
+	__m256d ay = _mm256_setzero_pd();
+	__m256d az = _mm256_setzero_pd();
+	__m256d pot = _mm256_setzero_pd();
+
+	uint32_t j = begin;
+	for(; j + 4 <= end; j += 4)
+	{
+		__m256d dx = _mm256_sub_pd(_mm256_loadu_pd(x + j), px);
+		__m256d dy = _mm256_sub_pd(_mm256_loadu_pd(y + j), py);
+		__m256d dz = _mm256_sub_pd(_mm256_loadu_pd(z + j), pz);
+		__m256d r2 = _mm256_add_pd(_mm256_mul_pd(dx, dx),
+			_mm256_add_pd(_mm256_mul_pd(dy, dy), _mm256_mul_pd(dz, dz)));
+		if(policy::softened)
+			r2 = _mm256_add_pd(r2, e2);
+		__m256d inv_r = _mm256_div_pd(one, _mm256_sqrt_pd(r2));
+		__m256d s = _mm256_mul_pd(_mm256_loadu_pd(m + j),
+			_mm256_mul_pd(inv_r, _mm256_mul_pd(inv_r, inv_r)));
+		ax = _mm256_add_pd(ax, _mm256_mul_pd(dx, s));
+		ay = _mm256_add_pd(ay, _mm256_mul_pd(dy, s));
+		az = _mm256_add_pd(az, _mm256_mul_pd(dz, s));
+		if(policy::potential)
+			pot = _mm256_add_pd(pot, _mm256_mul_pd(_mm256_loadu_pd(m + j),
+				inv_r));
+	}
+
+	alignas(32) double lanes[4][4];
+	_mm256_store_pd(lanes[0], ax);
+	_mm256_store_pd(lanes[1], ay);
+	_mm256_store_pd(lanes[2], az);
+	_mm256_store_pd(lanes[3], pot);
+	double sum[4];
+	for(int k = 0; k < (policy::potential ? 4 : 3); k++)
+		sum[k] = (lanes[k][0] + lanes[k][1]) + (lanes[k][2] + lanes[k][3]);
+	double g = policy::unit_g ? 1.0 : G;
+	a[0] += g * sum[0];
+	a[1] += g * sum[1];
+	a[2] += g * sum[2];
+	if(policy::potential)
+		*phi -= g * sum[3];
+
+	// remainder
+	if(j < end)
+		accel_scalar_t<policy, double, double>(src, j, end, p, G, eps2, a,
+			phi);
+}
+
+/**
+ * @brief Adds the 8 float lanes of v to the 4 double lanes of acc
+ */
+static inline __m256d add_ps_to_pd(__m256d acc, __m256 v)
+{
+	acc = _mm256_add_pd(acc, _mm256_cvtps_pd(_mm256_castps256_ps128(v)));
+	return _mm256_add_pd(acc, _mm256_cvtps_pd(_mm256_extractf128_ps(v, 1)));
+}
+
+template<typename policy, bool mixed>
+static void accel_avx_f(const body_soa_f &src, uint32_t begin, uint32_t end,
+	const double *p, double G, double eps2, double *a, double *phi)
+{
+	const float *x = src.x.data();
+	const float *y = src.y.data();
+	const float *z = src.z.data();
+	const float *m = src.m.data();
+
+	__m256 px = _mm256_set1_ps((float)p[0]);
+	__m256 py = _mm256_set1_ps((float)p[1]);
+	__m256 pz = _mm256_set1_ps((float)p[2]);
+	__m256 e2 = _mm256_set1_ps((float)eps2);
+	__m256 one = _mm256_set1_ps(1.0f);
+	__m256 ax = _mm256_setzero_ps();
+	__m256 ay = _mm256_setzero_ps();
+	__m256 az = _mm256_setzero_ps();
+	__m256 pot = _mm256_setzero_ps();
+	// only used when mixed
+	__m256d dax = _mm256_setzero_pd();
+	__m256d day = _mm256_setzero_pd();
+	__m256d daz = _mm256_setzero_pd();
+	__m256d dpot = _mm256_setzero_pd();
+
+	uint32_t j = begin;
+	uint32_t block = 0;
+	for(; j + 8 <= end; j += 8)
+	{
+		__m256 dx = _mm256_sub_ps(_mm256_loadu_ps(x + j), px);
+		__m256 dy = _mm256_sub_ps(_mm256_loadu_ps(y + j), py);
+		__m256 dz = _mm256_sub_ps(_mm256_loadu_ps(z + j), pz);
+		__m256 r2 = _mm256_add_ps(_mm256_mul_ps(dx, dx),
+			_mm256_add_ps(_mm256_mul_ps(dy, dy), _mm256_mul_ps(dz, dz)));
+		if(policy::softened)
+			r2 = _mm256_add_ps(r2, e2);
+		__m256 inv_r = _mm256_div_ps(one, _mm256_sqrt_ps(r2));
+		__m256 s = _mm256_mul_ps(_mm256_loadu_ps(m + j),
+			_mm256_mul_ps(inv_r, _mm256_mul_ps(inv_r, inv_r)));
+		ax = _mm256_add_ps(ax, _mm256_mul_ps(dx, s));
+		ay = _mm256_add_ps(ay, _mm256_mul_ps(dy, s));
+		az = _mm256_add_ps(az, _mm256_mul_ps(dz, s));
+		if(policy::potential)
+			pot = _mm256_add_ps(pot, _mm256_mul_ps(_mm256_loadu_ps(m + j),
+				inv_r));
+
+		if(mixed && ++block == mixed_block)
+		{
+			dax = add_ps_to_pd(dax, ax);
+			day = add_ps_to_pd(day, ay);
+			daz = add_ps_to_pd(daz, az);
+			ax = _mm256_setzero_ps();
+			ay = _mm256_setzero_ps();
+			az = _mm256_setzero_ps();
+			if(policy::potential)
+			{
+				dpot = add_ps_to_pd(dpot, pot);
+				pot = _mm256_setzero_ps();
+			}
+			block = 0;
+		}
+	}
+
+	const int rows = policy::potential ? 4 : 3;
+	double sum[4];
+	if(mixed)
+	{
+		dax = add_ps_to_pd(dax, ax);
+		day = add_ps_to_pd(day, ay);
+		daz = add_ps_to_pd(daz, az);
+		dpot = add_ps_to_pd(dpot, pot);
+		alignas(32) double lanes[4][4];
+		_mm256_store_pd(lanes[0], dax);
+		_mm256_store_pd(lanes[1], day);
+		_mm256_store_pd(lanes[2], daz);
+		_mm256_store_pd(lanes[3], dpot);
+		for(int k = 0; k < rows; k++)
+			sum[k] = (lanes[k][0] + lanes[k][1]) + (lanes[k][2] + lanes[k][3]);
+	}
+	else
+	{
+		alignas(32) float lanes[4][8];
+		_mm256_store_ps(lanes[0], ax);
+		_mm256_store_ps(lanes[1], ay);
+		_mm256_store_ps(lanes[2], az);
+		_mm256_store_ps(lanes[3], pot);
+		for(int k = 0; k < rows; k++)
+		{
+			float f = ((lanes[k][0] + lanes[k][1]) + (lanes[k][2] + lanes[k][3])) +
+				((lanes[k][4] + lanes[k][5]) + (lanes[k][6] + lanes[k][7]));
+			sum[k] = f;
+		}
+	}
+	double g = policy::unit_g ? 1.0 : G;
+	a[0] += g * sum[0];
+	a[1] += g * sum[1];
+	a[2] += g * sum[2];
+	if(policy::potential)
+		*phi -= g * sum[3];
+
+	// remainder
+	if(j < end)
+		accel_scalar_t<policy, float, typename std::conditional<mixed, double,
+			float>::type>(src, j, end, p, G, eps2, a, phi);
+}
+
+template<typename policy>
+static void pair_row_avx(const body_soa &src, uint32_t i, uint32_t j_begin,
+	uint32_t j_end, double G, double eps2, double *ax, double *ay,
+	double *az, double *phi)
+{
+	const double *x = src.x.data();
+	const double *y = src.y.data();
+	const double *z = src.z.data();
+	const double *m = src.m.data();
+	double g = policy::unit_g ? 1.0 : G;
+
+	__m256d xi = _mm256_set1_pd(x[i]);
+	__m256d yi = _mm256_set1_pd(y[i]);
+	__m256d zi = _mm256_set1_pd(z[i]);
+	__m256d gmi = _mm256_set1_pd(g * m[i]);
+	__m256d e2 = _mm256_set1_pd(eps2);
+	__m256d one = _mm256_set1_pd(1.0);
+	__m256d sx = _mm256_setzero_pd();
+	__m256d sy = _mm256_setzero_pd();
+	__m256d sz = _mm256_setzero_pd();
+	__m256d pot = _mm256_setzero_pd();
+
+	uint32_t j = j_begin;
+	for(; j + 4 <= j_end; j += 4)
+	{
+		__m256d dx = _mm256_sub_pd(_mm256_loadu_pd(x + j), xi);
+		__m256d dy = _mm256_sub_pd(_mm256_loadu_pd(y + j), yi);
+		__m256d dz = _mm256_sub_pd(_mm256_loadu_pd(z + j), zi);
+		__m256d r2 = _mm256_add_pd(_mm256_mul_pd(dx, dx),
+			_mm256_add_pd(_mm256_mul_pd(dy, dy), _mm256_mul_pd(dz, dz)));
+		if(policy::softened)
+			r2 = _mm256_add_pd(r2, e2);
+		__m256d inv_r = _mm256_div_pd(one, _mm256_sqrt_pd(r2));
+		__m256d w = _mm256_mul_pd(inv_r, _mm256_mul_pd(inv_r, inv_r));
+		__m256d mj = _mm256_loadu_pd(m + j);
+		__m256d wj = _mm256_mul_pd(mj, w);
+		__m256d wi = _mm256_mul_pd(gmi, w);
+		sx = _mm256_add_pd(sx, _mm256_mul_pd(dx, wj));
+		sy = _mm256_add_pd(sy, _mm256_mul_pd(dy, wj));
+		sz = _mm256_add_pd(sz, _mm256_mul_pd(dz, wj));
+		// the j side goes straight back, the tile keeps it in cache
+		_mm256_storeu_pd(ax + j, _mm256_sub_pd(_mm256_loadu_pd(ax + j),
+			_mm256_mul_pd(dx, wi)));
+		_mm256_storeu_pd(ay + j, _mm256_sub_pd(_mm256_loadu_pd(ay + j),
+			_mm256_mul_pd(dy, wi)));
+		_mm256_storeu_pd(az + j, _mm256_sub_pd(_mm256_loadu_pd(az + j),
+			_mm256_mul_pd(dz, wi)));
+		if(policy::potential)
+		{
+			pot = _mm256_add_pd(pot, _mm256_mul_pd(mj, inv_r));
+			_mm256_storeu_pd(phi + j, _mm256_sub_pd(_mm256_loadu_pd(phi + j),
+				_mm256_mul_pd(gmi, inv_r)));
+		}
+	}
+
+	alignas(32) double lanes[4][4];
+	_mm256_store_pd(lanes[0], sx);
+	_mm256_store_pd(lanes[1], sy);
+	_mm256_store_pd(lanes[2], sz);
+	_mm256_store_pd(lanes[3], pot);
+	double sum[4];
+	for(int k = 0; k < (policy::potential ? 4 : 3); k++)
+		sum[k] = (lanes[k][0] + lanes[k][1]) + (lanes[k][2] + lanes[k][3]);
+	ax[i] += g * sum[0];
+	ay[i] += g * sum[1];
+	az[i] += g * sum[2];
+	if(policy::potential)
+		phi[i] -= g * sum[3];
+
+	// remainder
+	if(j < j_end)
+		pair_row_scalar_t<policy>(src, i, j, j_end, G, eps2, ax, ay, az,
+			phi);
+}
+
+template<typename policy>
+static void pair_avx(const body_soa &src, uint32_t i_begin, uint32_t i_end,
+	uint32_t j_begin, uint32_t j_end, double G, double eps2, double *ax,
+	double *ay, double *az, double *phi)
+{
+	// within one range each pair is done from its lower index
+	for(uint32_t i = i_begin; i < i_end; i++)
+		pair_row_avx<policy>(src, i, j_begin == i_begin ? i + 1 : j_begin,
+			j_end, G, eps2, ax, ay, az, phi);
+}
+
+template<typename policy>
+static void tracer_avx(const body_soa &src, uint32_t j_begin, uint32_t j_end,
+	tracer_soa &t, uint32_t i_begin, uint32_t i_end, double G, double eps2)
+{
+	const double *x = src.x.data();
+	const double *y = src.y.data();
+	const double *z = src.z.data();
+	const double *m = src.m.data();
+
+	__m256d g = _mm256_set1_pd(policy::unit_g ? 1.0 : G);
+	__m256d e2 = _mm256_set1_pd(eps2);
+	__m256d one = _mm256_set1_pd(1.0);
+
+	uint32_t i = i_begin;
+	for(; i + 4 <= i_end; i += 4)
+	{
+		__m256d px = _mm256_loadu_pd(t.x.data() + i);
+		__m256d py = _mm256_loadu_pd(t.y.data() + i);
+		__m256d pz = _mm256_loadu_pd(t.z.data() + i);
+		__m256d ax = _mm256_setzero_pd();
+		__m256d ay = _mm256_setzero_pd();
+		__m256d az = _mm256_setzero_pd();
+		// the sources are few enough to stay in L1 while every block of
+		// tracers goes over them
+		for(uint32_t j = j_begin; j < j_end; j++)
+		{
+			__m256d dx = _mm256_sub_pd(_mm256_set1_pd(x[j]), px);
+			__m256d dy = _mm256_sub_pd(_mm256_set1_pd(y[j]), py);
+			__m256d dz = _mm256_sub_pd(_mm256_set1_pd(z[j]), pz);
+			__m256d r2 = _mm256_add_pd(_mm256_mul_pd(dx, dx),
+				_mm256_add_pd(_mm256_mul_pd(dy, dy), _mm256_mul_pd(dz, dz)));
+			if(policy::softened)
+				r2 = _mm256_add_pd(r2, e2);
+			__m256d inv_r = _mm256_div_pd(one, _mm256_sqrt_pd(r2));
+			__m256d s = _mm256_mul_pd(_mm256_set1_pd(m[j]),
+				_mm256_mul_pd(inv_r, _mm256_mul_pd(inv_r, inv_r)));
+			ax = _mm256_add_pd(ax, _mm256_mul_pd(dx, s));
+			ay = _mm256_add_pd(ay, _mm256_mul_pd(dy, s));
+			az = _mm256_add_pd(az, _mm256_mul_pd(dz, s));
+		}
+		_mm256_storeu_pd(t.ax.data() + i, _mm256_mul_pd(g, ax));
+		_mm256_storeu_pd(t.ay.data() + i, _mm256_mul_pd(g, ay));
+		_mm256_storeu_pd(t.az.data() + i, _mm256_mul_pd(g, az));
+	}
+
+	// remainder
+	if(i < i_end)
+		tracer_scalar_t<policy>(src, j_begin, j_end, t, i, i_end, G, eps2);
+}
+
+accel_kernel get_accel_avx(bool softened, bool unit_g, bool potential)
+{
+	return select_policy<accel_kernel>(softened, unit_g, potential,
+		accel_avx<force_policy<false, false>>,
+		accel_avx<force_policy<true, false>>,
+		accel_avx<force_policy<false, true>>,
+		accel_avx<force_policy<true, true>>,
+		accel_avx<force_policy<false, false, true>>,
+		accel_avx<force_policy<true, false, true>>,
+		accel_avx<force_policy<false, true, true>>,
+		accel_avx<force_policy<true, true, true>>);
+}
+
+accel_kernel_f get_accel_avx_f(bool mixed, bool softened, bool unit_g,
+	bool potential)
+{
+	if(mixed)
+	{
+		return select_policy<accel_kernel_f>(softened, unit_g, potential,
+			accel_avx_f<force_policy<false, false>, true>,
+			accel_avx_f<force_policy<true, false>, true>,
+			accel_avx_f<force_policy<false, true>, true>,
+			accel_avx_f<force_policy<true, true>, true>,
+			accel_avx_f<force_policy<false, false, true>, true>,
+			accel_avx_f<force_policy<true, false, true>, true>,
+			accel_avx_f<force_policy<false, true, true>, true>,
+			accel_avx_f<force_policy<true, true, true>, true>);
+	}
+	return select_policy<accel_kernel_f>(softened, unit_g, potential,
+		accel_avx_f<force_policy<false, false>, false>,
+		accel_avx_f<force_policy<true, false>, false>,
+		accel_avx_f<force_policy<false, true>, false>,
+		accel_avx_f<force_policy<true, true>, false>,
+		accel_avx_f<force_policy<false, false, true>, false>,
+		accel_avx_f<force_policy<true, false, true>, false>,
+		accel_avx_f<force_policy<false, true, true>, false>,
+		accel_avx_f<force_policy<true, true, true>, false>);
+}
+
+pair_kernel get_pair_avx(bool softened, bool unit_g, bool potential)
+{
+	return select_policy<pair_kernel>(softened, unit_g, potential,
+		pair_avx<force_policy<false, false>>,
+		pair_avx<force_policy<true, false>>,
+		pair_avx<force_policy<false, true>>,
+		pair_avx<force_policy<true, true>>,
+		pair_avx<force_policy<false, false, true>>,
+		pair_avx<force_policy<true, false, true>>,
+		pair_avx<force_policy<false, true, true>>,
+		pair_avx<force_policy<true, true, true>>);
+}
+
+tracer_kernel get_tracer_avx(bool softened, bool unit_g)
+{
+	return select_policy<tracer_kernel>(softened, unit_g,
+		tracer_avx<force_policy<false, false>>,
+		tracer_avx<force_policy<true, false>>,
+		tracer_avx<force_policy<false, true>>,
+		tracer_avx<force_policy<true, true>>);
+}
+
+#else
+
+bool accel_avx_built()
+{
+	return false;
+}
+
+accel_kernel get_accel_avx(bool softened, bool unit_g, bool potential)
+{
+	return get_accel_scalar(softened, unit_g, potential);
+}
+
+accel_kernel_f get_accel_avx_f(bool mixed, bool softened, bool unit_g,
+	bool potential)
+{
+	return get_accel_scalar_f(mixed, softened, unit_g, potential);
+}
+
+pair_kernel get_pair_avx(bool softened, bool unit_g, bool potential)
+{
+	return get_pair_scalar(softened, unit_g, potential);
+}
+
+tracer_kernel get_tracer_avx(bool softened, bool unit_g)
+{
+	return get_tracer_scalar(softened, unit_g);
+}
+
+#endif
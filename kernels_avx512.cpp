@@ -0,0 +1,349 @@
+#include "kernels.hpp"
+
+// this file is the only one built with AVX-512 enabled, nothing in it may be
+// called unless detect_simd_isa() said the CPU supports it
+#ifdef __AVX512F__
+#include <immintrin.h>
+
+bool accel_avx512_built()
+{
+	return true;
+}
+
+template<typename policy>
+static void accel_avx512(const body_soa &src, uint32_t begin, uint32_t end,
+	const double *p, double G, double eps2, double *a, double *phi)
+{
+	const double *x = src.x.data();
+	const double *y = src.y.data();
+	const double *z = src.z.data();
+	const double *m = src.m.data();
+
+	__m512d px = _mm512_set1_pd(p[0]);
+	__m512d py = _mm512_set1_pd(p[1]);
+	__m512d pz = _mm512_set1_pd(p[2]);
+	__m512d e2 = _mm512_set1_pd(eps2);
+	__m512d one = _mm512_set1_pd(1.0);
+	__m512d ax = _mm512_setzero_pd();
+	__m512d ay = _mm512_setzero_pd();
+	__m512d az = _mm512_setzero_pd();
+	__m512d pot = _mm512_setzero_pd();
+
+	for(uint32_t j = begin; j < end; j += 8)
+	{
+		// the last iteration only loads and accumulates the lanes in range
+		__mmask8 k = end - j >= 8 ? (__mmask8)0xff :
+			(__mmask8)((1u << (end - j)) - 1);
+		__m512d dx = _mm512_sub_pd(_mm512_maskz_loadu_pd(k, x + j), px);
+		__m512d dy = _mm512_sub_pd(_mm512_maskz_loadu_pd(k, y + j), py);
+		__m512d dz = _mm512_sub_pd(_mm512_maskz_loadu_pd(k, z + j), pz);
+		__m512d r2 = _mm512_fmadd_pd(dx, dx,
+			_mm512_fmadd_pd(dy, dy, _mm512_mul_pd(dz, dz)));
+		if(policy::softened)
+			r2 = _mm512_add_pd(r2, e2);
+		__m512d inv_r = _mm512_div_pd(one, _mm512_sqrt_pd(r2));
+		__m512d mj = _mm512_maskz_loadu_pd(k, m + j);
+		__m512d s = _mm512_mul_pd(mj,
+			_mm512_mul_pd(inv_r, _mm512_mul_pd(inv_r, inv_r)));
+		ax = _mm512_mask3_fmadd_pd(dx, s, ax, k);
+		ay = _mm512_mask3_fmadd_pd(dy, s, ay, k);
+		az = _mm512_mask3_fmadd_pd(dz, s, az, k);
+		// masked so a lane past the end at the point itself can't add a NaN
+		if(policy::potential)
+			pot = _mm512_mask3_fmadd_pd(mj, inv_r, pot, k);
+	}
+
+	double g = policy::unit_g ? 1.0 : G;
+	a[0] += g * _mm512_reduce_add_pd(ax);
+	a[1] += g * _mm512_reduce_add_pd(ay);
+	a[2] += g * _mm512_reduce_add_pd(az);
+	if(policy::potential)
+		*phi -= g * _mm512_reduce_add_pd(pot);
+}
+
+template<typename policy>
+static void pair_row_avx512(const body_soa &src, uint32_t i,
+	uint32_t j_begin, uint32_t j_end, double G, double eps2, double *ax,
+	double *ay, double *az, double *phi)
+{
+	const double *x = src.x.data();
+	const double *y = src.y.data();
+	const double *z = src.z.data();
+	const double *m = src.m.data();
+	double g = policy::unit_g ? 1.0 : G;
+
+	__m512d xi = _mm512_set1_pd(x[i]);
+	__m512d yi = _mm512_set1_pd(y[i]);
+	__m512d zi = _mm512_set1_pd(z[i]);
+	__m512d gmi = _mm512_set1_pd(g * m[i]);
+	__m512d e2 = _mm512_set1_pd(eps2);
+	__m512d one = _mm512_set1_pd(1.0);
+	__m512d sx = _mm512_setzero_pd();
+	__m512d sy = _mm512_setzero_pd();
+	__m512d sz = _mm512_setzero_pd();
+	__m512d pot = _mm512_setzero_pd();
+
+	for(uint32_t j = j_begin; j < j_end; j += 8)
+	{
+		// the last iteration only loads, accumulates and stores the lanes in
+		// range
+		__mmask8 k = j_end - j >= 8 ? (__mmask8)0xff :
+			(__mmask8)((1u << (j_end - j)) - 1);
+		__m512d dx = _mm512_sub_pd(_mm512_maskz_loadu_pd(k, x + j), xi);
+		__m512d dy = _mm512_sub_pd(_mm512_maskz_loadu_pd(k, y + j), yi);
+		__m512d dz = _mm512_sub_pd(_mm512_maskz_loadu_pd(k, z + j), zi);
+		__m512d r2 = _mm512_fmadd_pd(dx, dx,
+			_mm512_fmadd_pd(dy, dy, _mm512_mul_pd(dz, dz)));
+		if(policy::softened)
+			r2 = _mm512_add_pd(r2, e2);
+		__m512d inv_r = _mm512_div_pd(one, _mm512_sqrt_pd(r2));
+		__m512d w = _mm512_mul_pd(inv_r, _mm512_mul_pd(inv_r, inv_r));
+		__m512d mj = _mm512_maskz_loadu_pd(k, m + j);
+		__m512d wj = _mm512_mul_pd(mj, w);
+		__m512d wi = _mm512_mul_pd(gmi, w);
+		sx = _mm512_mask3_fmadd_pd(dx, wj, sx, k);
+		sy = _mm512_mask3_fmadd_pd(dy, wj, sy, k);
+		sz = _mm512_mask3_fmadd_pd(dz, wj, sz, k);
+		_mm512_mask_storeu_pd(ax + j, k, _mm512_fnmadd_pd(dx, wi,
+			_mm512_maskz_loadu_pd(k, ax + j)));
+		_mm512_mask_storeu_pd(ay + j, k, _mm512_fnmadd_pd(dy, wi,
+			_mm512_maskz_loadu_pd(k, ay + j)));
+		_mm512_mask_storeu_pd(az + j, k, _mm512_fnmadd_pd(dz, wi,
+			_mm512_maskz_loadu_pd(k, az + j)));
+		if(policy::potential)
+		{
+			pot = _mm512_mask3_fmadd_pd(mj, inv_r, pot, k);
+			_mm512_mask_storeu_pd(phi + j, k, _mm512_fnmadd_pd(gmi, inv_r,
+				_mm512_maskz_loadu_pd(k, phi + j)));
+		}
+	}
+
+	ax[i] += g * _mm512_reduce_add_pd(sx);
+	ay[i] += g * _mm512_reduce_add_pd(sy);
+	az[i] += g * _mm512_reduce_add_pd(sz);
+	if(policy::potential)
+		phi[i] -= g * _mm512_reduce_add_pd(pot);
+}
+
+template<typename policy>
+static void pair_avx512(const body_soa &src, uint32_t i_begin,
+	uint32_t i_end, uint32_t j_begin, uint32_t j_end, double G, double eps2,
+	double *ax, double *ay, double *az, double *phi)
+{
+	// within one range each pair is done from its lower index
+	for(uint32_t i = i_begin; i < i_end; i++)
+		pair_row_avx512<policy>(src, i, j_begin == i_begin ? i + 1 :
+			j_begin, j_end, G, eps2, ax, ay, az, phi);
+}
+
+template<typename policy>
+static void tracer_avx512(const body_soa &src, uint32_t j_begin,
+	uint32_t j_end, tracer_soa &t, uint32_t i_begin, uint32_t i_end,
+	double G, double eps2)
+{
+	const double *x = src.x.data();
+	const double *y = src.y.data();
+	const double *z = src.z.data();
+	const double *m = src.m.data();
+
+	__m512d g = _mm512_set1_pd(policy::unit_g ? 1.0 : G);
+	__m512d e2 = _mm512_set1_pd(eps2);
+	__m512d one = _mm512_set1_pd(1.0);
+
+	for(uint32_t i = i_begin; i < i_end; i += 8)
+	{
+		// the last block only loads and stores the tracers in range, the
+		// lanes past the end can hold anything
+		__mmask8 k = i_end - i >= 8 ? (__mmask8)0xff :
+			(__mmask8)((1u << (i_end - i)) - 1);
+		__m512d px = _mm512_maskz_loadu_pd(k, t.x.data() + i);
+		__m512d py = _mm512_maskz_loadu_pd(k, t.y.data() + i);
+		__m512d pz = _mm512_maskz_loadu_pd(k, t.z.data() + i);
+		__m512d ax = _mm512_setzero_pd();
+		__m512d ay = _mm512_setzero_pd();
+		__m512d az = _mm512_setzero_pd();
+		for(uint32_t j = j_begin; j < j_end; j++)
+		{
+			__m512d dx = _mm512_sub_pd(_mm512_set1_pd(x[j]), px);
+			__m512d dy = _mm512_sub_pd(_mm512_set1_pd(y[j]), py);
+			__m512d dz = _mm512_sub_pd(_mm512_set1_pd(z[j]), pz);
+			__m512d r2 = _mm512_fmadd_pd(dx, dx,
+				_mm512_fmadd_pd(dy, dy, _mm512_mul_pd(dz, dz)));
+			if(policy::softened)
+				r2 = _mm512_add_pd(r2, e2);
+			__m512d inv_r = _mm512_div_pd(one, _mm512_sqrt_pd(r2));
+			__m512d s = _mm512_mul_pd(_mm512_set1_pd(m[j]),
+				_mm512_mul_pd(inv_r, _mm512_mul_pd(inv_r, inv_r)));
+			ax = _mm512_fmadd_pd(dx, s, ax);
+			ay = _mm512_fmadd_pd(dy, s, ay);
+			az = _mm512_fmadd_pd(dz, s, az);
+		}
+		_mm512_mask_storeu_pd(t.ax.data() + i, k, _mm512_mul_pd(g, ax));
+		_mm512_mask_storeu_pd(t.ay.data() + i, k, _mm512_mul_pd(g, ay));
+		_mm512_mask_storeu_pd(t.az.data() + i, k, _mm512_mul_pd(g, az));
+	}
+}
+
+template<typename policy, bool mixed>
+static void accel_avx512_f(const body_soa_f &src, uint32_t begin,
+	uint32_t end, const double *p, double G, double eps2, double *a,
+	double *phi)
+{
+	const float *x = src.x.data();
+	const float *y = src.y.data();
+	const float *z = src.z.data();
+	const float *m = src.m.data();
+
+	__m512 px = _mm512_set1_ps((float)p[0]);
+	__m512 py = _mm512_set1_ps((float)p[1]);
+	__m512 pz = _mm512_set1_ps((float)p[2]);
+	__m512 e2 = _mm512_set1_ps((float)eps2);
+	__m512 one = _mm512_set1_ps(1.0f);
+	__m512 ax = _mm512_setzero_ps();
+	__m512 ay = _mm512_setzero_ps();
+	__m512 az = _mm512_setzero_ps();
+	__m512 pot = _mm512_setzero_ps();
+	// only used when mixed
+	double sum[4] = {0.0, 0.0, 0.0, 0.0};
+
+	uint32_t block = 0;
+	for(uint32_t j = begin; j < end; j += 16)
+	{
+		// the last iteration only loads and accumulates the lanes in range
+		__mmask16 k = end - j >= 16 ? (__mmask16)0xffff :
+			(__mmask16)((1u << (end - j)) - 1);
+		__m512 dx = _mm512_sub_ps(_mm512_maskz_loadu_ps(k, x + j), px);
+		__m512 dy = _mm512_sub_ps(_mm512_maskz_loadu_ps(k, y + j), py);
+		__m512 dz = _mm512_sub_ps(_mm512_maskz_loadu_ps(k, z + j), pz);
+		__m512 r2 = _mm512_fmadd_ps(dx, dx,
+			_mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dz, dz)));
+		if(policy::softened)
+			r2 = _mm512_add_ps(r2, e2);
+		__m512 inv_r = _mm512_div_ps(one, _mm512_sqrt_ps(r2));
+		__m512 mj = _mm512_maskz_loadu_ps(k, m + j);
+		__m512 s = _mm512_mul_ps(mj,
+			_mm512_mul_ps(inv_r, _mm512_mul_ps(inv_r, inv_r)));
+		ax = _mm512_mask3_fmadd_ps(dx, s, ax, k);
+		ay = _mm512_mask3_fmadd_ps(dy, s, ay, k);
+		az = _mm512_mask3_fmadd_ps(dz, s, az, k);
+		if(policy::potential)
+			pot = _mm512_mask3_fmadd_ps(mj, inv_r, pot, k);
+
+		if(mixed && ++block == mixed_block)
+		{
+			sum[0] += _mm512_reduce_add_ps(ax);
+			sum[1] += _mm512_reduce_add_ps(ay);
+			sum[2] += _mm512_reduce_add_ps(az);
+			ax = _mm512_setzero_ps();
+			ay = _mm512_setzero_ps();
+			az = _mm512_setzero_ps();
+			if(policy::potential)
+			{
+				sum[3] += _mm512_reduce_add_ps(pot);
+				pot = _mm512_setzero_ps();
+			}
+			block = 0;
+		}
+	}
+
+	sum[0] += _mm512_reduce_add_ps(ax);
+	sum[1] += _mm512_reduce_add_ps(ay);
+	sum[2] += _mm512_reduce_add_ps(az);
+	double g = policy::unit_g ? 1.0 : G;
+	a[0] += g * sum[0];
+	a[1] += g * sum[1];
+	a[2] += g * sum[2];
+	if(policy::potential)
+		*phi -= g * (sum[3] + _mm512_reduce_add_ps(pot));
+}
+
+accel_kernel get_accel_avx512(bool softened, bool unit_g, bool potential)
+{
+	return select_policy<accel_kernel>(softened, unit_g, potential,
+		accel_avx512<force_policy<false, false>>,
+		accel_avx512<force_policy<true, false>>,
+		accel_avx512<force_policy<false, true>>,
+		accel_avx512<force_policy<true, true>>,
+		accel_avx512<force_policy<false, false, true>>,
+		accel_avx512<force_policy<true, false, true>>,
+		accel_avx512<force_policy<false, true, true>>,
+		accel_avx512<force_policy<true, true, true>>);
+}
+
+accel_kernel_f get_accel_avx512_f(bool mixed, bool softened, bool unit_g,
+	bool potential)
+{
+	if(mixed)
+	{
+		return select_policy<accel_kernel_f>(softened, unit_g, potential,
+			accel_avx512_f<force_policy<false, false>, true>,
+			accel_avx512_f<force_policy<true, false>, true>,
+			accel_avx512_f<force_policy<false, true>, true>,
+			accel_avx512_f<force_policy<true, true>, true>,
+			accel_avx512_f<force_policy<false, false, true>, true>,
+			accel_avx512_f<force_policy<true, false, true>, true>,
+			accel_avx512_f<force_policy<false, true, true>, true>,
+			accel_avx512_f<force_policy<true, true, true>, true>);
+	}
+	return select_policy<accel_kernel_f>(softened, unit_g, potential,
+		accel_avx512_f<force_policy<false, false>, false>,
+		accel_avx512_f<force_policy<true, false>, false>,
+		accel_avx512_f<force_policy<false, true>, false>,
+		accel_avx512_f<force_policy<true, true>, false>,
+		accel_avx512_f<force_policy<false, false, true>, false>,
+		accel_avx512_f<force_policy<true, false, true>, false>,
+		accel_avx512_f<force_policy<false, true, true>, false>,
+		accel_avx512_f<force_policy<true, true, true>, false>);
+}
+
+pair_kernel get_pair_avx512(bool softened, bool unit_g, bool potential)
+{
+	return select_policy<pair_kernel>(softened, unit_g, potential,
+		pair_avx512<force_policy<false, false>>,
+		pair_avx512<force_policy<true, false>>,
+		pair_avx512<force_policy<false, true>>,
+		pair_avx512<force_policy<true, true>>,
+		pair_avx512<force_policy<false, false, true>>,
+		pair_avx512<force_policy<true, false, true>>,
+		pair_avx512<force_policy<false, true, true>>,
+		pair_avx512<force_policy<true, true, true>>);
+}
+
+tracer_kernel get_tracer_avx512(bool softened, bool unit_g)
+{
+	return select_policy<tracer_kernel>(softened, unit_g,
+		tracer_avx512<force_policy<false, false>>,
+		tracer_avx512<force_policy<true, false>>,
+		tracer_avx512<force_policy<false, true>>,
+		tracer_avx512<force_policy<true, true>>);
+}
+
+#else
+
+bool accel_avx512_built()
+{
+	return false;
+}
+
+accel_kernel get_accel_avx512(bool softened, bool unit_g, bool potential)
+{
+	return get_accel_avx(softened, unit_g, potential);
+}
+
+accel_kernel_f get_accel_avx512_f(bool mixed, bool softened, bool unit_g,
+	bool potential)
+{
+	return get_accel_avx_f(mixed, softened, unit_g, potential);
+}
+
+pair_kernel get_pair_avx512(bool softened, bool unit_g, bool potential)
+{
+	return get_pair_avx(softened, unit_g, potential);
+}
+
+tracer_kernel get_tracer_avx512(bool softened, bool unit_g)
+{
+	return get_tracer_avx(softened, unit_g);
+}
+
+#endif
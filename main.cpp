@@ -1,16 +1,72 @@
+#include <iostream>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <boost/program_options.hpp>
 
 #include "gfx.hpp"
+#include "profiler.hpp"
+
+namespace po = boost::program_options;
 
 int main(int argc, char **argv)
 {
+	std::string replay, trace;
+	uint32_t tracer_count;
+
+	po::options_description desc("grav_sim2 options");
+	desc.add_options()
+		("help,h", "print this message")
+		("replay", po::value<std::string>(&replay),
+			"play back this trajectory in place of simulating")
+		("tracers", po::value<uint32_t>(&tracer_count)->default_value(0),
+			"massless tracers simulated and drawn with the bodies, they feel "
+			"the bodies' gravity but exert none")
+		("profile", "time each phase and print percentiles and per thread "
+			"totals on exit")
+		("trace", po::value<std::string>(&trace),
+			"also write the phase timings as a Chrome trace to this file")
+	;
+
+	po::variables_map vm;
+	try
+	{
+		po::store(po::parse_command_line(argc, argv, desc), vm);
+		po::notify(vm);
+	}
+	catch(const po::error &e)
+	{
+		std::cerr << "ERROR: " << e.what() << "\n" << desc << std::endl;
+		return 1;
+	}
+
+	if(vm.count("help"))
+	{
+		std::cout << desc << std::endl;
+		return 0;
+	}
+
 	gfx *g = new gfx();
-	
+	if(!replay.empty())
+		g->set_replay(replay);
+	g->set_tracer_count(tracer_count);
+
+	bool profile = vm.count("profile") > 0 || !trace.empty();
+	profiler::set_enabled(profile);
+	profiler::set_tracing(!trace.empty());
+	if(profile)
+		profiler::set_thread_name("render");
 	g->init();
 	
 	while(!g->main_loop())
 		g->render();
 	
+	// deinit() stops the physics thread so nothing is timed any more
 	g->deinit();
+	if(profile)
+		profiler::report(stdout);
+	if(!trace.empty())
+		profiler::write_chrome_trace(trace);
 	
 	delete g;
 	
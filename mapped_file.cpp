@@ -0,0 +1,127 @@
+#include "mapped_file.hpp"
+
+#include <cstdio>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+mapped_file::mapped_file()
+{
+	ptr = nullptr;
+	length = 0;
+#ifdef _WIN32
+	file = INVALID_HANDLE_VALUE;
+	mapping = NULL;
+#else
+	fd = -1;
+#endif
+}
+
+mapped_file::~mapped_file()
+{
+	close();
+}
+
+#ifdef _WIN32
+
+bool mapped_file::open(const std::string &fname)
+{
+	close();
+
+	file = CreateFileA(fname.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if(file == INVALID_HANDLE_VALUE)
+	{
+		printf("ERROR couldn't open %s\n", fname.c_str());
+		return false;
+	}
+	LARGE_INTEGER file_size;
+	if(!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+	{
+		printf("ERROR %s is empty\n", fname.c_str());
+		close();
+		return false;
+	}
+	mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if(mapping == NULL)
+	{
+		printf("ERROR couldn't map %s\n", fname.c_str());
+		close();
+		return false;
+	}
+	ptr = (const uint8_t *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if(ptr == nullptr)
+	{
+		printf("ERROR couldn't map %s\n", fname.c_str());
+		close();
+		return false;
+	}
+	length = (size_t)file_size.QuadPart;
+	return true;
+}
+
+void mapped_file::close()
+{
+	if(ptr != nullptr)
+		UnmapViewOfFile(ptr);
+	if(mapping != NULL)
+		CloseHandle(mapping);
+	if(file != INVALID_HANDLE_VALUE)
+		CloseHandle(file);
+	ptr = nullptr;
+	length = 0;
+	mapping = NULL;
+	file = INVALID_HANDLE_VALUE;
+}
+
+#else
+
+bool mapped_file::open(const std::string &fname)
+{
+	close();
+
+	fd = ::open(fname.c_str(), O_RDONLY);
+	if(fd < 0)
+	{
+		printf("ERROR couldn't open %s\n", fname.c_str());
+		return false;
+	}
+	struct stat st;
+	if(fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		printf("ERROR %s is empty\n", fname.c_str());
+		close();
+		return false;
+	}
+	void *p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if(p == MAP_FAILED)
+	{
+		printf("ERROR couldn't map %s\n", fname.c_str());
+		close();
+		return false;
+	}
+	// everything is read front to back
+	madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL);
+	ptr = (const uint8_t *)p;
+	length = (size_t)st.st_size;
+	return true;
+}
+
+void mapped_file::close()
+{
+	if(ptr != nullptr)
+		munmap((void *)ptr, length);
+	if(fd >= 0)
+		::close(fd);
+	ptr = nullptr;
+	length = 0;
+	fd = -1;
+}
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief A whole file mapped read only into memory, pages are read in by the
+ * OS as they are touched
+ */
+class mapped_file
+{
+public:
+	mapped_file();
+	virtual ~mapped_file();
+
+	/**
+	 * @brief Maps fname, closing anything already mapped
+	 * @return False (with an error printed) if it couldn't be opened or mapped
+	 */
+	bool open(const std::string &fname);
+	void close();
+
+	const uint8_t *data() const {return ptr;}
+	size_t size() const {return length;}
+
+private:
+	mapped_file(const mapped_file &) = delete;
+	mapped_file &operator=(const mapped_file &) = delete;
+
+	const uint8_t *ptr;
+	size_t length;
+#ifdef _WIN32
+	void *file;
+	void *mapping;
+#else
+	int fd;
+#endif
+};
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef MORTON_HPP
+#define MORTON_HPP
+
+#include <cstdint>
+#include <algorithm>
+#include <Eigen/Core>
+
+/**
+ * @brief Bits per axis in a Morton key, 3 * 21 = 63 bits in total
+ */
+const uint32_t morton_bits = 21;
+
+/**
+ * @brief Spreads the low 21 bits of v out to every third bit
+ */
+inline uint64_t morton_spread(uint64_t v)
+{
+	v &= 0x1fffff;
+	v = (v | v << 32) & 0x1f00000000ffffull;
+	v = (v | v << 16) & 0x1f0000ff0000ffull;
+	v = (v | v << 8) & 0x100f00f00f00f00full;
+	v = (v | v << 4) & 0x10c30c30c30c30c3ull;
+	v = (v | v << 2) & 0x1249249249249249ull;
+	return v;
+}
+
+/**
+ * @brief Z-order key of p in the cube from lo with 2^21 cells per axis, the
+ * top 3k bits are the level k octree cell so sorting by key puts the bodies
+ * in depth first octree order
+ * @param scale 2^21 / cube width
+ */
+inline uint64_t morton_key(const Eigen::Vector3d &p, const Eigen::Vector3d &lo,
+	double scale)
+{
+	const double top = (double)((1u << morton_bits) - 1);
+	uint64_t k[3];
+	for(int d = 0; d < 3; d++)
+		k[d] = (uint64_t)std::min(std::max((p[d] - lo[d]) * scale, 0.0), top);
+	return morton_spread(k[0]) | morton_spread(k[1]) << 1 |
+		morton_spread(k[2]) << 2;
+}
+
+#endif
@@ -0,0 +1,277 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <random>
+#include <cmath>
+#include <algorithm>
+#include <mpi.h>
+#include <omp.h>
+#include <boost/program_options.hpp>
+
+#include "physics.hpp"
+#include "domain.hpp"
+#include "profiler.hpp"
+
+namespace po = boost::program_options;
+
+/**
+ * @brief Every rank's value of v gathered on rank 0 as min, mean and max
+ */
+static void print_spread(MPI_Comm comm, const char *name, double v)
+{
+	int rank, size;
+	MPI_Comm_rank(comm, &rank);
+	MPI_Comm_size(comm, &size);
+	std::vector<double> all(size);
+	MPI_Gather(&v, 1, MPI_DOUBLE, all.data(), 1, MPI_DOUBLE, 0, comm);
+	if(rank != 0)
+		return;
+	double sum = 0.0;
+	for(double a : all)
+		sum += a;
+	double mean = sum / size;
+	double max = *std::max_element(all.begin(), all.end());
+	printf("%-19s %12.6g %12.6g %12.6g %9.3f\n", name,
+		*std::min_element(all.begin(), all.end()), mean, max,
+		mean > 0.0 ? max / mean : 1.0);
+}
+
+int main(int argc, char **argv)
+{
+	int provided;
+	MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+	int rank, size;
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+	MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+	uint64_t obj_count;
+	uint64_t seed;
+	uint64_t steps;
+	double dt;
+	std::string checkpoint, restart, trace;
+	uint32_t rebalance;
+	double theta, softening, G;
+	int threads;
+	double mass[2], radius[2], distance;
+
+	po::options_description desc("grav_sim2_mpi options");
+	desc.add_options()
+		("help,h", "print this message")
+		("count,n", po::value<uint64_t>(&obj_count)->default_value(65536),
+			"number of bodies over all ranks")
+		("seed,s", po::value<uint64_t>(&seed),
+			"random seed, picked from std::random_device if not given")
+		("steps", po::value<uint64_t>(&steps)->default_value(100),
+			"number of steps")
+		("dt", po::value<double>(&dt)->default_value(0.01), "step size")
+		("theta", po::value<double>(&theta)->default_value(0.5),
+			"Barnes-Hut opening angle")
+		("softening", po::value<double>(&softening)->default_value(0.0),
+			"Plummer softening length, 0 for none")
+		("G", po::value<double>(&G)->default_value(6.67408e-11),
+			"gravitational constant, 1 for N-body units")
+		("threads,t", po::value<int>(&threads)->default_value(0),
+			"OpenMP threads per rank, 0 for the OpenMP default")
+		("rebalance", po::value<uint32_t>(&rebalance)->default_value(10),
+			"rebalance by measured cost every this many steps, 0 for only at "
+			"the start")
+		("mass-min", po::value<double>(&mass[0])->default_value(5e7), "")
+		("mass-max", po::value<double>(&mass[1])->default_value(1e8), "")
+		("radius-min", po::value<double>(&radius[0])->default_value(0.05), "")
+		("radius-max", po::value<double>(&radius[1])->default_value(0.25), "")
+		("distance", po::value<double>(&distance)->default_value(0.0),
+			"bodies start in a cube from -distance to distance, 0 for "
+			"4 * cbrt(count / 1024), the headless density")
+		("energy", "report the relative energy drift over the run")
+		("checkpoint", po::value<std::string>(&checkpoint),
+			"write all bodies to this file at the end of the run")
+		("restart", po::value<std::string>(&restart),
+			"start from this checkpoint (from any of the simulators) in place "
+			"of new bodies, the count, G and softening come from the file")
+		("profile", "time each phase on every rank and print rank 0's")
+		("trace", po::value<std::string>(&trace),
+			"write each rank's phase timings as a Chrome trace to this file "
+			"with the rank appended")
+	;
+
+	po::variables_map vm;
+	try
+	{
+		po::store(po::parse_command_line(argc, argv, desc), vm);
+		po::notify(vm);
+	}
+	catch(const po::error &e)
+	{
+		if(rank == 0)
+			std::cerr << "ERROR: " << e.what() << "\n" << desc << std::endl;
+		MPI_Finalize();
+		return 1;
+	}
+
+	if(vm.count("help"))
+	{
+		if(rank == 0)
+			std::cout << desc << std::endl;
+		MPI_Finalize();
+		return 0;
+	}
+	if(restart.empty() && (obj_count < 2 || obj_count > UINT32_MAX))
+	{
+		if(rank == 0)
+			std::cerr << "ERROR: count must be 2 to " << UINT32_MAX <<
+				std::endl;
+		MPI_Finalize();
+		return 1;
+	}
+
+	if(distance <= 0.0)
+		distance = 4.0 * std::cbrt(obj_count / 1024.0);
+
+	// every rank must draw from a different stream
+	if(!vm.count("seed"))
+		seed = std::random_device{}();
+	MPI_Bcast(&seed, 1, MPI_UINT64_T, 0, MPI_COMM_WORLD);
+	if(threads > 0)
+		omp_set_num_threads(threads);
+
+	bool profile = vm.count("profile") > 0 || !trace.empty();
+	profiler::set_enabled(profile);
+	profiler::set_tracing(!trace.empty());
+	if(profile)
+		profiler::set_thread_name("rank" + std::to_string(rank));
+
+	domain *d = new domain(MPI_COMM_WORLD);
+	d->set_theta(theta);
+	d->set_rebalance_interval(rebalance);
+
+	if(rank == 0)
+	{
+		printf("ranks:      %d\n", size);
+		printf("threads:    %d per rank\n", omp_get_max_threads());
+		printf("seed:       %llu\n", (unsigned long long)seed);
+		printf("steps:      %llu\n", (unsigned long long)steps);
+		printf("dt:         %g\n", dt);
+		printf("theta:      %g\n", theta);
+		printf("rebalance:  %u\n", rebalance);
+		if(!restart.empty())
+			printf("restart:    %s\n", restart.c_str());
+		else
+			printf("distance:   %g\n", distance);
+		fflush(stdout);
+	}
+
+	double t0 = MPI_Wtime();
+	if(restart.empty())
+	{
+		// each rank places its share of a uniform cube at rest, the union is
+		// a uniform cube too, the other distributions need the whole system
+		// so start those from a checkpoint. Only the bodies of one rank are
+		// kept apart, bodies of different ranks may overlap since there are
+		// no collisions here.
+		uint32_t local = (uint32_t)(obj_count * (rank + 1) / size -
+			obj_count * rank / size);
+		physics *p = new physics();
+		p->seed(seed + (uint64_t)rank * 0x9e3779b97f4a7c15ull);
+		p->set_mass_range(mass[0], mass[1]);
+		p->set_radius_range(radius[0], radius[1]);
+		p->set_distance_range(-distance, distance);
+		if(!p->init(local))
+			MPI_Abort(MPI_COMM_WORLD, 1);
+		array_view<Eigen::Vector3d> x = p->get_pos_view();
+		array_view<Eigen::Vector3d> v = p->get_vel_view();
+		array_view<double> m = p->get_mass_view();
+		array_view<double> r = p->get_radii_view();
+		d->set_bodies(std::vector<Eigen::Vector3d>(x.begin(), x.end()),
+			std::vector<Eigen::Vector3d>(v.begin(), v.end()),
+			std::vector<double>(m.begin(), m.end()),
+			std::vector<double>(r.begin(), r.end()));
+		p->deinit();
+		delete p;
+		d->set_softening(softening);
+		d->set_G(G);
+	}
+	else if(!d->load_checkpoint(restart))
+	{
+		MPI_Finalize();
+		return 1;
+	}
+	obj_count = d->get_global_count();
+	MPI_Barrier(MPI_COMM_WORLD);
+	double t1 = MPI_Wtime();
+	if(rank == 0)
+	{
+		printf("bodies:     %llu\n", (unsigned long long)obj_count);
+		printf("softening:  %g\n", d->get_softening());
+		printf("G:          %g\n", d->get_G());
+		fflush(stdout);
+	}
+
+	bool energy = vm.count("energy") > 0;
+	double e0 = energy ? d->get_energy() : 0.0;
+	if(profile)
+		profiler::reset();
+	MPI_Barrier(MPI_COMM_WORLD);
+	t1 = MPI_Wtime();
+
+	for(uint64_t i = 0; i < steps; i++)
+		d->step(dt);
+	MPI_Barrier(MPI_COMM_WORLD);
+	double t2 = MPI_Wtime();
+
+	uint64_t interactions = d->get_interactions();
+	MPI_Allreduce(MPI_IN_PLACE, &interactions, 1, MPI_UINT64_T, MPI_SUM,
+		MPI_COMM_WORLD);
+	double init_time = t1 - t0;
+	double run_time = t2 - t1;
+	if(rank == 0)
+	{
+		printf("init time:          %.6f s\n", init_time);
+		printf("run time:           %.6f s\n", run_time);
+		printf("steps/sec:          %.3f\n", steps / run_time);
+		printf("interactions:       %llu\n", (unsigned long long)interactions);
+		printf("interactions/sec:   %.6g\n", interactions / run_time);
+		printf("rebalances:         %u\n", d->get_rebalance_count());
+		printf("\n%-19s %12s %12s %12s %9s\n", "per rank", "min", "mean",
+			"max", "max/mean");
+	}
+	print_spread(MPI_COMM_WORLD, "bodies", d->get_local_count());
+	print_spread(MPI_COMM_WORLD, "ghosts", d->get_ghost_count());
+	print_spread(MPI_COMM_WORLD, "interactions",
+		(double)d->get_interactions());
+	print_spread(MPI_COMM_WORLD, "force s", d->get_force_time());
+	print_spread(MPI_COMM_WORLD, "build s", d->get_build_time());
+	print_spread(MPI_COMM_WORLD, "exchange s", d->get_exchange_time());
+
+	if(energy)
+	{
+		double e1 = d->get_energy();
+		if(rank == 0)
+		{
+			printf("\nenergy start:       %.9g\n", e0);
+			printf("energy end:         %.9g\n", e1);
+			printf("energy drift:       %.6g\n", std::fabs(e1 - e0) /
+				std::fabs(e0));
+		}
+	}
+
+	if(profile && rank == 0)
+	{
+		printf("\n");
+		profiler::report(stdout);
+	}
+	fflush(stdout);
+	int failed = 0;
+	if(!trace.empty() &&
+		!profiler::write_chrome_trace(trace + "." + std::to_string(rank)))
+		failed = 1;
+	if(!checkpoint.empty() && !d->save_checkpoint(checkpoint))
+		failed = 1;
+	MPI_Allreduce(MPI_IN_PLACE, &failed, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+
+	delete d;
+	MPI_Finalize();
+
+	return failed;
+}
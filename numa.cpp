@@ -0,0 +1,149 @@
+#include "numa.hpp"
+
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include <omp.h>
+
+#ifdef __linux__
+#include <sched.h>
+#include <unistd.h>
+#endif
+#ifdef HAVE_LIBNUMA
+#include <numa.h>
+#endif
+
+const char *thread_pinning_name(thread_pinning p)
+{
+	switch(p)
+	{
+		case thread_pinning::compact:
+			return "compact";
+		case thread_pinning::spread:
+			return "spread";
+		default:
+			return "none";
+	}
+}
+
+bool parse_thread_pinning(const std::string &name, thread_pinning &p)
+{
+	for(thread_pinning k : {thread_pinning::none, thread_pinning::compact,
+		thread_pinning::spread})
+	{
+		if(name == thread_pinning_name(k))
+		{
+			p = k;
+			return true;
+		}
+	}
+	return false;
+}
+
+#ifdef __linux__
+/**
+ * @brief The CPUs the process could run on before anything was pinned, the
+ * first call has to come from a thread that isn't pinned yet
+ */
+static const cpu_set_t &allowed_cpus()
+{
+	static cpu_set_t allowed;
+	static bool read = false;
+	if(!read)
+	{
+		CPU_ZERO(&allowed);
+		if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+		{
+			for(int c = 0; c < (int)sysconf(_SC_NPROCESSORS_ONLN) &&
+				c < CPU_SETSIZE; c++)
+				CPU_SET(c, &allowed);
+		}
+		read = true;
+	}
+	return allowed;
+}
+#endif
+
+bool pin_threads(thread_pinning p)
+{
+#ifdef __linux__
+	const cpu_set_t &allowed = allowed_cpus();
+	std::vector<int> cpus;
+	for(int c = 0; c < CPU_SETSIZE; c++)
+	{
+		if(CPU_ISSET(c, &allowed))
+			cpus.push_back(c);
+	}
+	if(cpus.empty())
+	{
+		printf("ERROR couldn't find the CPUs to pin threads to\n");
+		return false;
+	}
+
+	// sched_setaffinity() with pid 0 sets the calling thread on Linux
+	bool ok = true;
+	#pragma omp parallel reduction(&&:ok)
+	{
+		size_t t = omp_get_thread_num();
+		size_t threads = omp_get_num_threads();
+		cpu_set_t set = allowed;
+		if(p != thread_pinning::none)
+		{
+			size_t k = p == thread_pinning::compact ? t % cpus.size() :
+				t * cpus.size() / threads;
+			CPU_ZERO(&set);
+			CPU_SET(cpus[k], &set);
+		}
+		ok = sched_setaffinity(0, sizeof(set), &set) == 0;
+	}
+	if(!ok)
+		printf("ERROR couldn't pin the threads %s\n", thread_pinning_name(p));
+	return ok;
+#else
+	if(p == thread_pinning::none)
+		return true;
+	printf("ERROR thread pinning is only supported on Linux\n");
+	return false;
+#endif
+}
+
+int numa_node_count()
+{
+#ifdef HAVE_LIBNUMA
+	if(numa_available() >= 0)
+		return numa_num_configured_nodes();
+#endif
+	return 1;
+}
+
+int numa_current_node()
+{
+#ifdef HAVE_LIBNUMA
+	if(numa_available() >= 0)
+	{
+		int cpu = sched_getcpu();
+		if(cpu >= 0)
+			return std::max(numa_node_of_cpu(cpu), 0);
+	}
+#endif
+	return 0;
+}
+
+void numa_interleave(const void *p, size_t bytes)
+{
+#ifdef HAVE_LIBNUMA
+	if(bytes == 0 || numa_available() < 0 || numa_num_configured_nodes() < 2)
+		return;
+	// the policy is per page, the partial pages at the ends are shared with
+	// whatever is next to the array so they are left out
+	uintptr_t page = (uintptr_t)numa_pagesize();
+	uintptr_t begin = ((uintptr_t)p + page - 1) & ~(page - 1);
+	uintptr_t end = ((uintptr_t)p + bytes) & ~(page - 1);
+	if(end > begin)
+		numa_interleave_memory((void *)begin, end - begin, numa_all_nodes_ptr);
+#else
+	(void)p;
+	(void)bytes;
+#endif
+}
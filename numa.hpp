@@ -0,0 +1,56 @@
+#ifndef NUMA_HPP
+#define NUMA_HPP
+
+#include <string>
+#include <cstddef>
+
+/**
+ * @brief How pin_threads() places the OpenMP threads on the CPUs the process
+ * is allowed to run on
+ */
+enum class thread_pinning
+{
+	/**
+	 * @brief Left to the OS (or OMP_PROC_BIND), the default
+	 */
+	none,
+	/**
+	 * @brief Thread t on the t-th CPU, fills one socket before the next
+	 */
+	compact,
+	/**
+	 * @brief Threads spread evenly over the CPUs, so a team smaller than the
+	 * machine gets every socket's memory bandwidth
+	 */
+	spread
+};
+
+const char *thread_pinning_name(thread_pinning p);
+bool parse_thread_pinning(const std::string &name, thread_pinning &p);
+
+/**
+ * @brief Pins every thread of a team of omp_get_max_threads() to one CPU,
+ * call it after omp_set_num_threads(). OpenMP keeps the same threads while
+ * the team size stays the same, so thread t stays where it is and the pages
+ * it touches first stay local to it. thread_pinning::none lets them run
+ * anywhere again.
+ * @return False (with an error printed) if the OS can't pin threads
+ */
+bool pin_threads(thread_pinning p);
+
+/**
+ * @brief NUMA nodes with memory, 1 on one node or without libnuma
+ */
+int numa_node_count();
+/**
+ * @brief Node of the CPU the calling thread runs on, 0 without libnuma
+ */
+int numa_current_node();
+/**
+ * @brief Asks for the pages of [p, p + bytes) that haven't been touched yet
+ * to be spread round robin over the nodes, for arrays every thread reads all
+ * of. Nothing happens on one node or without libnuma.
+ */
+void numa_interleave(const void *p, size_t bytes);
+
+#endif
@@ -0,0 +1,297 @@
+#include "octree.hpp"
+
+#include <cmath>
+#include <algorithm>
+
+octree::octree()
+{
+	theta = 0.5;
+	x_src = nullptr;
+}
+
+octree::~octree()
+{
+
+}
+
+void octree::build(const std::vector<Eigen::Vector3d> &x, array_view<double> m)
+{
+	uint32_t count = (uint32_t)x.size();
+	x_src = &x;
+	m_src = m;
+
+	nodes.clear();
+	index.resize(count);
+	scratch.resize(count);
+	slot.resize(count);
+	x_sorted.resize(count);
+	m_sorted.resize(count);
+
+	if(count == 0)
+		return;
+
+	Eigen::Vector3d lo = x[0];
+	Eigen::Vector3d hi = x[0];
+	for(uint32_t i = 0; i < count; i++)
+	{
+		index[i] = i;
+		lo = lo.cwiseMin(x[i]);
+		hi = hi.cwiseMax(x[i]);
+	}
+
+	// the root is a cube around everything, pad it a little so bodies on the
+	// max faces fall inside
+	node root;
+	root.center = 0.5 * (lo + hi);
+	root.half_width = 0.5 * (hi - lo).maxCoeff() * 1.0001 + 1e-12;
+	root.begin = 0;
+	root.end = count;
+	root.first_child = 0;
+	root.child_count = 0;
+	root.mass = 0.0;
+	root.com = Eigen::Vector3d(0.0, 0.0, 0.0);
+	// roughly 2N / leaf_size nodes for random distributions
+	nodes.reserve(2 * count / leaf_size + 64);
+	nodes.push_back(root);
+
+	build_node(0, 0);
+
+	for(uint32_t i = 0; i < count; i++)
+	{
+		slot[index[i]] = i;
+		x_sorted[i] = x[index[i]];
+		m_sorted[i] = m[index[i]];
+	}
+
+	x_src = nullptr;
+	m_src = array_view<double>();
+}
+
+void octree::build_node(uint32_t n, uint32_t depth)
+{
+	const std::vector<Eigen::Vector3d> &x = *x_src;
+	const array_view<double> &m = m_src;
+	uint32_t begin = nodes[n].begin;
+	uint32_t end = nodes[n].end;
+	Eigen::Vector3d center = nodes[n].center;
+
+	if(end - begin <= leaf_size || depth >= max_depth)
+	{
+		Eigen::Vector3d com(0.0, 0.0, 0.0);
+		double mass = 0.0;
+		for(uint32_t k = begin; k < end; k++)
+		{
+			com += m[index[k]] * x[index[k]];
+			mass += m[index[k]];
+		}
+		nodes[n].com = mass > 0.0 ? Eigen::Vector3d(com / mass) : center;
+		nodes[n].mass = mass;
+		return;
+	}
+
+	// counting sort the bodies into octants
+	uint32_t counts[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+	for(uint32_t k = begin; k < end; k++)
+	{
+		const Eigen::Vector3d &p = x[index[k]];
+		uint32_t o = (p[0] >= center[0]) | ((p[1] >= center[1]) << 1) |
+			((p[2] >= center[2]) << 2);
+		counts[o]++;
+	}
+	uint32_t offsets[9];
+	offsets[0] = begin;
+	for(uint32_t o = 0; o < 8; o++)
+		offsets[o + 1] = offsets[o] + counts[o];
+	uint32_t fill[8];
+	std::copy(offsets, offsets + 8, fill);
+	for(uint32_t k = begin; k < end; k++)
+	{
+		const Eigen::Vector3d &p = x[index[k]];
+		uint32_t o = (p[0] >= center[0]) | ((p[1] >= center[1]) << 1) |
+			((p[2] >= center[2]) << 2);
+		scratch[fill[o]++] = index[k];
+	}
+	std::copy(scratch.begin() + begin, scratch.begin() + end,
+		index.begin() + begin);
+
+	// allocate the non empty children together so they are contiguous
+	double hw = 0.5 * nodes[n].half_width;
+	uint32_t first = (uint32_t)nodes.size();
+	uint8_t child_count = 0;
+	for(uint32_t o = 0; o < 8; o++)
+	{
+		if(counts[o] == 0)
+			continue;
+		node c;
+		c.center = center + Eigen::Vector3d(
+			(o & 1) ? hw : -hw,
+			(o & 2) ? hw : -hw,
+			(o & 4) ? hw : -hw);
+		c.half_width = hw;
+		c.begin = offsets[o];
+		c.end = offsets[o + 1];
+		c.first_child = 0;
+		c.child_count = 0;
+		c.mass = 0.0;
+		c.com = Eigen::Vector3d(0.0, 0.0, 0.0);
+		nodes.push_back(c);
+		child_count++;
+	}
+	nodes[n].first_child = first;
+	nodes[n].child_count = child_count;
+
+	Eigen::Vector3d com(0.0, 0.0, 0.0);
+	double mass = 0.0;
+	for(uint32_t c = first; c < first + child_count; c++)
+	{
+		build_node(c, depth + 1);
+		com += nodes[c].mass * nodes[c].com;
+		mass += nodes[c].mass;
+	}
+	nodes[n].com = mass > 0.0 ? Eigen::Vector3d(com / mass) : center;
+	nodes[n].mass = mass;
+}
+
+Eigen::Vector3d octree::accel(const Eigen::Vector3d &x_i, uint32_t skip_index,
+	double G, double eps2, uint64_t &interactions, double *phi) const
+{
+	double pot = 0.0;
+	Eigen::Vector3d a;
+	if(phi == nullptr)
+	{
+		if(eps2 > 0.0)
+			return G * walk<true, false>(x_i, skip_index, eps2, interactions,
+				pot);
+		return G * walk<false, false>(x_i, skip_index, eps2, interactions,
+			pot);
+	}
+	if(eps2 > 0.0)
+		a = walk<true, true>(x_i, skip_index, eps2, interactions, pot);
+	else
+		a = walk<false, true>(x_i, skip_index, eps2, interactions, pot);
+	*phi -= G * pot;
+	return G * a;
+}
+
+template<bool softened, bool potential>
+Eigen::Vector3d octree::walk(const Eigen::Vector3d &x_i, uint32_t skip_index,
+	double eps2, uint64_t &interactions, double &pot) const
+{
+	Eigen::Vector3d a(0.0, 0.0, 0.0);
+	if(nodes.empty())
+		return a;
+
+	// bodies past the end (ie. a point that isn't in the tree) never match
+	uint32_t skip_slot = skip_index < slot.size() ? slot[skip_index] :
+		UINT32_MAX;
+	double theta2 = theta * theta;
+
+	// depth first, at most 7 siblings wait on the stack per level
+	uint32_t stack[8 * max_depth + 8];
+	uint32_t top = 0;
+	uint64_t count = 0;
+	stack[top++] = 0;
+	while(top > 0)
+	{
+		const node &n = nodes[stack[--top]];
+		bool contains_self = skip_slot >= n.begin && skip_slot < n.end;
+
+		if(n.child_count == 0)
+		{
+			// sum either side of the body itself so the loop has no branch
+			uint32_t split = contains_self ? skip_slot : n.end;
+			count += n.end - n.begin - (contains_self ? 1 : 0);
+			a += leaf_sum<softened, potential>(n.begin, split, x_i, eps2, pot);
+			if(contains_self)
+				a += leaf_sum<softened, potential>(split + 1, n.end, x_i, eps2,
+					pot);
+			continue;
+		}
+
+		Eigen::Vector3d r = n.com - x_i;
+		double r2 = r.squaredNorm();
+		double s = 2.0 * n.half_width;
+		bool inside = (x_i - n.center).cwiseAbs().maxCoeff() <= n.half_width;
+		// open nodes that are too close, that hold the point or that hold the
+		// body we are calculating for
+		if(contains_self || inside || s * s >= theta2 * r2)
+		{
+			for(uint32_t c = 0; c < n.child_count; c++)
+				stack[top++] = n.first_child + c;
+			continue;
+		}
+
+		if(softened)
+			r2 += eps2;
+		double d = std::sqrt(r2);
+		a += (n.mass / (r2 * d)) * r;
+		if(potential)
+			pot += n.mass / d;
+		count++;
+	}
+	interactions += count;
+	return a;
+}
+
+void octree::essential(const Eigen::Vector3d &lo, const Eigen::Vector3d &hi,
+	std::vector<Eigen::Vector3d> &x, std::vector<double> &m) const
+{
+	if(nodes.empty())
+		return;
+	double theta2 = theta * theta;
+
+	uint32_t stack[8 * max_depth + 8];
+	uint32_t top = 0;
+	stack[top++] = 0;
+	while(top > 0)
+	{
+		const node &n = nodes[stack[--top]];
+		if(n.child_count == 0)
+		{
+			for(uint32_t k = n.begin; k < n.end; k++)
+			{
+				x.push_back(x_sorted[k]);
+				m.push_back(m_sorted[k]);
+			}
+			continue;
+		}
+
+		// the nearest point of the box to the center of mass is where the
+		// walk is least likely to accept the node, and the box must not
+		// touch the node or a walk from inside it always opens the node
+		Eigen::Vector3d d = (lo - n.com).cwiseMax(n.com - hi).cwiseMax(0.0);
+		double s = 2.0 * n.half_width;
+		Eigen::Vector3d n_lo = n.center.array() - n.half_width;
+		Eigen::Vector3d n_hi = n.center.array() + n.half_width;
+		bool touches = (lo.array() <= n_hi.array()).all() &&
+			(hi.array() >= n_lo.array()).all();
+		if(touches || s * s >= theta2 * d.squaredNorm())
+		{
+			for(uint32_t c = 0; c < n.child_count; c++)
+				stack[top++] = n.first_child + c;
+			continue;
+		}
+
+		x.push_back(n.com);
+		m.push_back(n.mass);
+	}
+}
+
+template<bool softened, bool potential>
+Eigen::Vector3d octree::leaf_sum(uint32_t begin, uint32_t end,
+	const Eigen::Vector3d &x_i, double eps2, double &pot) const
+{
+	Eigen::Vector3d a(0.0, 0.0, 0.0);
+	for(uint32_t k = begin; k < end; k++)
+	{
+		Eigen::Vector3d r = x_sorted[k] - x_i;
+		double r2 = r.squaredNorm();
+		if(softened)
+			r2 += eps2;
+		double d = std::sqrt(r2);
+		a += (m_sorted[k] / (r2 * d)) * r;
+		if(potential)
+			pot += m_sorted[k] / d;
+	}
+	return a;
+}
@@ -0,0 +1,130 @@
+#ifndef OCTREE_HPP
+#define OCTREE_HPP
+
+#include <vector>
+#include <cstdint>
+#include <Eigen/Core>
+
+#include "array_view.hpp"
+
+/**
+ * @brief A Barnes-Hut octree over a set of point masses, rebuilt from scratch
+ * every time build() is called
+ */
+class octree
+{
+public:
+	octree();
+	virtual ~octree();
+
+	/**
+	 * @brief Builds the tree from positions and masses
+	 * @param x Positions
+	 * @param m Masses, same size as x
+	 */
+	void build(const std::vector<Eigen::Vector3d> &x, array_view<double> m);
+
+	/**
+	 * @brief Finds acceleration due to gravity by walking the tree, this is
+	 * safe to call from multiple threads once build() has returned
+	 * @param x_i Position
+	 * @param skip_index The index of the object that acceleration is calc
+	 * @param G Gravitational constant
+	 * @param eps2 Softening length squared, 0 for none
+	 * @param interactions Bodies and nodes summed are added to this
+	 * @param phi If not null the potential per unit mass at x_i from the
+	 * same bodies and nodes is added to this
+	 * @return The acceleration vector
+	 */
+	Eigen::Vector3d accel(const Eigen::Vector3d &x_i, uint32_t skip_index,
+		double G, double eps2, uint64_t &interactions,
+		double *phi = nullptr) const;
+
+	/**
+	 * @brief Appends what a walk from anywhere in the box [lo, hi] needs from
+	 * this tree: nodes the walk would accept from every point in the box as
+	 * one point mass at their center of mass, everything else as the bodies
+	 * themselves. A tree built over these gives the same forces in the box
+	 * up to the opening angle, this is the locally essential tree a remote
+	 * domain gets.
+	 * @param x Positions are appended here
+	 * @param m Masses are appended here
+	 */
+	void essential(const Eigen::Vector3d &lo, const Eigen::Vector3d &hi,
+		std::vector<Eigen::Vector3d> &x, std::vector<double> &m) const;
+
+	/**
+	 * @brief Sets the opening angle, 0 opens every node (direct sum), larger
+	 * values are faster and less accurate, 0.5 is a common choice
+	 */
+	void set_theta(double theta){this->theta = theta;}
+	double get_theta(){return theta;}
+	size_t get_node_count(){return nodes.size();}
+
+private:
+	struct node
+	{
+		/**
+		 * @brief Geometric center of the cube
+		 */
+		Eigen::Vector3d center;
+		/**
+		 * @brief Center of mass
+		 */
+		Eigen::Vector3d com;
+		double half_width;
+		double mass;
+		/**
+		 * @brief Range of bodies in tree order [begin, end)
+		 */
+		uint32_t begin, end;
+		/**
+		 * @brief Children are stored contiguously, child_count == 0 is a leaf
+		 */
+		uint32_t first_child;
+		uint8_t child_count;
+	};
+
+	void build_node(uint32_t n, uint32_t depth);
+	/**
+	 * @brief accel() without the factor of G, sum m / r is added to pot when
+	 * potential is set
+	 */
+	template<bool softened, bool potential>
+	Eigen::Vector3d walk(const Eigen::Vector3d &x_i, uint32_t skip_index,
+		double eps2, uint64_t &interactions, double &pot) const;
+	/**
+	 * @brief Sum over the tree order slots [begin, end) without the factor of G
+	 */
+	template<bool softened, bool potential>
+	Eigen::Vector3d leaf_sum(uint32_t begin, uint32_t end,
+		const Eigen::Vector3d &x_i, double eps2, double &pot) const;
+
+	const static uint32_t leaf_size = 8;
+	const static uint32_t max_depth = 48;
+
+	double theta;
+	std::vector<node> nodes;
+	/**
+	 * @brief Body index for each tree order slot
+	 */
+	std::vector<uint32_t> index;
+	/**
+	 * @brief Tree order slot for each body index
+	 */
+	std::vector<uint32_t> slot;
+	/**
+	 * @brief Scratch space for partitioning
+	 */
+	std::vector<uint32_t> scratch;
+	/**
+	 * @brief Positions and masses copied into tree order so the leaves are
+	 * read sequentially
+	 */
+	std::vector<Eigen::Vector3d> x_sorted;
+	std::vector<double> m_sorted;
+	const std::vector<Eigen::Vector3d> *x_src;
+	array_view<double> m_src;
+};
+
+#endif
@@ -1,12 +1,82 @@
 #include "physics.hpp"
+#include "checkpoint.hpp"
+#include "profiler.hpp"
+#include "morton.hpp"
+#include "radix_sort.hpp"
+#include "numa.hpp"
 
 #include <omp.h>
 #include <Eigen/Geometry>
+#include <cmath>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <numeric>
+
+/**
+ * @brief The stream body i uses for attempt n in init(), splitmix64 seeded
+ * from a hash of all three so nearby bodies get unrelated streams
+ */
+static splitmix64 body_stream(uint64_t base, uint32_t i, uint32_t n)
+{
+	splitmix64 mix(base ^ ((uint64_t)n << 32 | i));
+	mix();
+	return splitmix64(mix());
+}
+
+/**
+ * @brief Uniform on the unit sphere
+ */
+static Eigen::Vector3d random_direction(splitmix64 &rng)
+{
+	std::uniform_real_distribution<double> unit(0.0, 1.0);
+	double z = 2.0 * unit(rng) - 1.0;
+	double angle = 2.0 * M_PI * unit(rng);
+	double s = std::sqrt(1.0 - z * z);
+	return Eigen::Vector3d(s * std::cos(angle), s * std::sin(angle), z);
+}
 
 physics::physics()
 {
 	this->generator = std::mt19937_64(std::random_device{}());
+	method = force_method::direct;
+	integ = integrator::leapfrog;
+	accel_valid = false;
+	hermite_eta = 0.02;
+	max_block_level = 16;
+	interactions = 0;
+	epoch = 0;
+	obj_count = 0;
+	current = 0;
+	next = 1;
+	total_time = 0.0;
 
+	mass_range[0] = 5e7;
+	mass_range[1] = 1e8;
+	radius_range[0] = 0.05;
+	radius_range[1] = 0.25;
+	radius_scale = 1.0;
+	//distance_range[0] = -radius_range[0] * 15.0;
+	//distance_range[1] = radius_range[0] * 15.0;
+	distance_range[0] = -4.0;
+	distance_range[1] = 4.0;
+	interleave = false;
+	isa = detect_simd_isa();
+	prec = precision::fp64;
+	softening = 0.0;
+	select_kernels();
+	collisions = collision_mode::none;
+	collision_count = 0;
+	dist = distribution::uniform;
+	diag_interval = 0;
+	diag_step = 0;
+	diag_sampling = false;
+	reorder_threshold = 0.1;
+	reorder_count = 0;
+	tracer_init_count = 0;
+	tracer_count = 0;
+	tracer_accel_valid = false;
 }
 
 physics::~physics()
@@ -16,66 +86,1123 @@ physics::~physics()
 
 void physics::step(double delta_t)
 {
+	profile_scope scope(profile_phase::step);
 	total_time += delta_t;
+	diag_step++;
+	diag_sampling = diag_interval > 0 && diag_step % diag_interval == 0;
+
+	if(reorder_threshold > 0.0 && ((method == force_method::barnes_hut &&
+		integ != integrator::hermite) || collisions != collision_mode::none))
+		reorder();
 
-	// TODO: collision detection
+	// tracers start the step with the bodies where they are now, the
+	// integrator leaves x[current] as it is
+	if(tracer_count > 0 && !tracer_accel_valid)
+		tracer_accel(x[current]);
+
+	switch(integ)
+	{
+		case integrator::rk4:
+			step_rk4(delta_t);
+			break;
+		case integrator::hermite:
+			step_hermite(delta_t);
+			break;
+		default:
+			step_leapfrog(delta_t);
+			break;
+	}
+
+	if(collisions != collision_mode::none)
+	{
+		profile_scope collide_scope(profile_phase::collide);
+		collide();
+	}
+
+	if(tracer_count > 0)
+		step_tracers(delta_t);
+
+	current = current ? 0 : 1;
+	next = next ? 0 : 1;
+	epoch++;
+
+	if(step_callback)
+		step_callback(*this);
+}
+
+void physics::step_leapfrog(double delta_t)
+{
+	// kick drift kick, a[current] carries over from the last step so this is
+	// one force evaluation per step
+	if(!accel_valid)
+		accel_all(x[current], a[current]);
+
+	double half_dt = 0.5 * delta_t;
+	{
+		profile_scope scope(profile_phase::integrate);
+		#pragma omp parallel for
+		for(int i = 0; i < (int)obj_count; i++)
+		{
+			v[next][i] = v[current][i] + half_dt * a[current][i];
+			x[next][i] = x[current][i] + delta_t * v[next][i];
+		}
+	}
+
+	accel_all(x[next], a[next], diag_sampling);
+
+	{
+		profile_scope scope(profile_phase::integrate);
+		#pragma omp parallel for
+		for(int i = 0; i < (int)obj_count; i++)
+			v[next][i] += half_dt * a[next][i];
+	}
+
+	accel_valid = true;
+	if(diag_sampling)
+		sample_diagnostics(x[next], v[next], total_time);
+}
+
+void physics::step_rk4(double delta_t)
+{
+	// RK4 integration, see doc/grav_sim.tex
+	// every stage moves all bodies to the stage positions before the forces
+	// are found so this is four force evaluations per step
+	rk_x.resize(obj_count);
+	rk_v.resize(obj_count);
+	rk_dx.resize(obj_count);
+	rk_dv.resize(obj_count);
+
+	const double weight[4] = {1.0, 2.0, 2.0, 1.0};
+	const double stage_dt[3] = {0.5 * delta_t, 0.5 * delta_t, delta_t};
+
+	// stage 1 is at the current state, the acceleration found there is kept
+	// in a[current], it is the only pass at a whole step so diagnostics are
+	// sampled here
+	accel_all(x[current], a[current], diag_sampling);
+	if(diag_sampling)
+		sample_diagnostics(x[current], v[current], total_time - delta_t);
+	{
+		profile_scope scope(profile_phase::integrate);
+		#pragma omp parallel for
+		for(int i = 0; i < (int)obj_count; i++)
+		{
+			rk_dx[i] = v[current][i];
+			rk_dv[i] = a[current][i];
+			rk_x[i] = x[current][i] + stage_dt[0] * v[current][i];
+			rk_v[i] = v[current][i] + stage_dt[0] * a[current][i];
+		}
+	}
+
+	for(int k = 1; k < 4; k++)
+	{
+		// a[next] is free until the end of the step so use it as scratch
+		accel_all(rk_x, a[next]);
+		profile_scope scope(profile_phase::integrate);
+		#pragma omp parallel for
+		for(int i = 0; i < (int)obj_count; i++)
+		{
+			rk_dx[i] += weight[k] * rk_v[i];
+			rk_dv[i] += weight[k] * a[next][i];
+			if(k < 3)
+			{
+				rk_x[i] = x[current][i] + stage_dt[k] * rk_v[i];
+				rk_v[i] = v[current][i] + stage_dt[k] * a[next][i];
+			}
+		}
+	}
+
+	profile_scope scope(profile_phase::integrate);
 	#pragma omp parallel for
-	for(int i = 0; i < obj_count; i++)
+	for(int i = 0; i < (int)obj_count; i++)
 	{
-		// Euler
-		//a[current][i] = accel(x[current][i], i);
-		//v[next][i] = a[current][i] * delta_t + v[current][i];
-		//x[next][i] = v[next][i] * delta_t + x[current][i];
+		x[next][i] = x[current][i] + (delta_t / 6.0) * rk_dx[i];
+		v[next][i] = v[current][i] + (delta_t / 6.0) * rk_dv[i];
+	}
 
-		// RK4 integration, see doc/grav_sim.tex
-		// this is about 4x worse than Euler
-		Eigen::Vector3d xk1 = x[current][i];
-		Eigen::Vector3d vk1 = v[current][i];
-		Eigen::Vector3d ak1 = accel(x[current][i], i);
+	// a[next] holds the last stage, not the acceleration at x[next]
+	accel_valid = false;
+}
 
-		Eigen::Vector3d xk2 = x[current][i] + 0.5 * vk1 * delta_t;
-		Eigen::Vector3d vk2 = v[current][i] + 0.5 * ak1 * delta_t;
-		Eigen::Vector3d ak2 = accel(xk1, i);
+void physics::step_hermite(double delta_t)
+{
+	const uint64_t total_ticks = (uint64_t)1 << max_block_level;
+	const double tick_dt = delta_t / (double)total_ticks;
 
-		Eigen::Vector3d xk3 = x[current][i] + 0.5 * vk2 * delta_t;
-		Eigen::Vector3d vk3 = v[current][i] + 0.5 * ak2 * delta_t;
-		Eigen::Vector3d ak3 = accel(xk3, i);
+	jerk.resize(obj_count);
+	level.resize(obj_count);
+	t_tick.resize(obj_count);
+	active.reserve(obj_count);
+	src.resize_velocities(obj_count);
+	double eps2 = softening * softening;
 
-		Eigen::Vector3d xk4 = x[current][i] + vk3 * delta_t;
-		Eigen::Vector3d vk4 = v[current][i] + ak3 * delta_t;
-		Eigen::Vector3d ak4 = accel(xk4, i);
+	// the state carried between steps is x, v, a and jerk in the current
+	// slot with every body synchronized at the start of the step
+	std::fill(t_tick.begin(), t_tick.end(), 0);
+	if(!accel_valid)
+	{
+		// a and jerk are stale or uninitialized here and even a zero length
+		// prediction would carry a NaN in them into the sources
+		#pragma omp parallel for
+		for(int i = 0; i < (int)obj_count; i++)
+		{
+			a[current][i].setZero();
+			jerk[i].setZero();
+		}
+		hermite_predict(0, tick_dt);
+		#pragma omp parallel for
+		for(int i = 0; i < (int)obj_count; i++)
+		{
+			jerk_k(src, 0, i, x[current][i].data(), v[current][i].data(), G,
+				eps2, a[current][i].data(), jerk[i].data(), nullptr);
+			jerk_k(src, i + 1, obj_count, x[current][i].data(),
+				v[current][i].data(), G, eps2, a[current][i].data(),
+				jerk[i].data(), nullptr);
 
-		v[next][i] = v[current][i] + (delta_t / 6.0) *
-				(ak1 + 2 * ak2 + 2 * ak3 + ak4);
-		x[next][i] = x[current][i] + (delta_t / 6.0) *
-				(vk1 + 2 * vk2 + 2 * vk3 + vk4);
+			// the first step is from |a| / |j| with a smaller eta
+			double jn = jerk[i].norm();
+			double dt = jn > 0.0 ? 0.01 * a[current][i].norm() / jn : delta_t;
+			level[i] = block_level(dt, delta_t, 0, 0);
+		}
+		interactions += (uint64_t)obj_count * (obj_count - 1);
 	}
 
-	current = current ? 0 : 1;
-	next = next ? 0 : 1;
+	uint64_t tick = 0;
+	while(tick < total_ticks)
+	{
+		// the next block time is the earliest any body is due
+		uint64_t t_next = total_ticks;
+		for(int i = 0; i < (int)obj_count; i++)
+		{
+			uint64_t due = t_tick[i] + ((uint64_t)1 <<
+				(max_block_level - level[i]));
+			if(due < t_next)
+				t_next = due;
+		}
+
+		active.clear();
+		for(int i = 0; i < (int)obj_count; i++)
+		{
+			if(t_tick[i] + ((uint64_t)1 << (max_block_level - level[i])) ==
+				t_next)
+				active.push_back(i);
+		}
+
+		hermite_predict(t_next, tick_dt);
+
+		// every body is due at the end of the step so the last block finds
+		// the potential of all of them
+		bool potential = diag_sampling && t_next == total_ticks;
+		jerk_kernel jk = potential ? jerk_k_pot : jerk_k;
+		if(potential)
+			zero_phi();
+
+		int active_count = (int)active.size();
+		interactions += (uint64_t)active_count * (obj_count - 1);
+		// the force and corrector together, timed per thread, the bodies all
+		// cost the same but stealing still evens out threads that run slower
+		// (shared cores, other processes) over the short blocks
+		pool.split(active_count, nullptr, omp_get_max_threads());
+		#pragma omp parallel
+		{
+			profile_scope scope(profile_phase::force);
+			uint32_t begin, end;
+			while(pool.next(begin, end))
+			{
+				for(uint32_t k = begin; k < end; k++)
+				{
+					uint32_t i = active[k];
+					double xp[3] = {src.x[i], src.y[i], src.z[i]};
+					double vp[3] = {src.vx[i], src.vy[i], src.vz[i]};
+					Eigen::Vector3d a1(0.0, 0.0, 0.0);
+					Eigen::Vector3d j1(0.0, 0.0, 0.0);
+					double *phi_i = potential ? &phi[i] : nullptr;
+					jk(src, 0, i, xp, vp, G, eps2, a1.data(), j1.data(),
+						phi_i);
+					jk(src, i + 1, obj_count, xp, vp, G, eps2, a1.data(),
+						j1.data(), phi_i);
+
+					// Hermite corrector, snap and crackle come from the
+					// Hermite interpolation of a and jerk over the step
+					const Eigen::Vector3d &a0 = a[current][i];
+					const Eigen::Vector3d &j0 = jerk[i];
+					double dt = (double)(t_next - t_tick[i]) * tick_dt;
+					double dt2 = dt * dt;
+					Eigen::Vector3d s0 = (-6.0 * (a0 - a1) - dt * (4.0 * j0 +
+						2.0 * j1)) / dt2;
+					Eigen::Vector3d c0 = (12.0 * (a0 - a1) + 6.0 * dt *
+						(j0 + j1)) / (dt2 * dt);
+
+					Eigen::Vector3d x0 = x[current][i];
+					Eigen::Vector3d v0 = v[current][i];
+					v[current][i] = v0 + dt * a0 + (dt2 / 2.0) * j0 +
+						(dt2 * dt / 6.0) * s0 + (dt2 * dt2 / 24.0) * c0;
+					x[current][i] = x0 + dt * v0 + (dt2 / 2.0) * a0 +
+						(dt2 * dt / 6.0) * j0 + (dt2 * dt2 / 24.0) * s0 +
+						(dt2 * dt2 * dt / 120.0) * c0;
+					a[current][i] = a1;
+					jerk[i] = j1;
+					t_tick[i] = t_next;
+
+					// Aarseth criterion with snap and crackle at the end of
+					// the step
+					Eigen::Vector3d s1 = s0 + dt * c0;
+					double an = a1.norm(), jn = j1.norm();
+					double sn = s1.norm(), cn = c0.norm();
+					double den = jn * cn + sn * sn;
+					double dt_new = den > 0.0 ? std::sqrt(hermite_eta *
+						(an * sn + jn * jn) / den) : delta_t;
+					level[i] = block_level(dt_new, delta_t, level[i],
+						t_next);
+				}
+			}
+		}
+
+		tick = t_next;
+	}
+
+	#pragma omp parallel for
+	for(int i = 0; i < (int)obj_count; i++)
+	{
+		x[next][i] = x[current][i];
+		v[next][i] = v[current][i];
+		a[next][i] = a[current][i];
+	}
+
+	accel_valid = true;
+	if(diag_sampling)
+		sample_diagnostics(x[next], v[next], total_time);
+}
+
+void physics::hermite_predict(uint64_t tick, double tick_dt)
+{
+	profile_scope scope(profile_phase::integrate);
+	#pragma omp parallel for
+	for(int i = 0; i < (int)obj_count; i++)
+	{
+		double dt = (double)(tick - t_tick[i]) * tick_dt;
+		Eigen::Vector3d xp = x[current][i] + dt * (v[current][i] +
+			(dt / 2.0) * (a[current][i] + (dt / 3.0) * jerk[i]));
+		Eigen::Vector3d vp = v[current][i] + dt * (a[current][i] +
+			(dt / 2.0) * jerk[i]);
+		src.x[i] = xp[0];
+		src.y[i] = xp[1];
+		src.z[i] = xp[2];
+		src.vx[i] = vp[0];
+		src.vy[i] = vp[1];
+		src.vz[i] = vp[2];
+		src.m[i] = m[i];
+	}
+}
+
+uint8_t physics::block_level(double dt, double delta_t, uint8_t level,
+	uint64_t tick)
+{
+	// smallest level whose block fits in dt
+	uint8_t want = 0;
+	double block = delta_t;
+	while(want < max_block_level && block > dt)
+	{
+		block *= 0.5;
+		want++;
+	}
+
+	if(want >= level)
+		return want;
+
+	// only coarsen when this tick is on the coarser block boundary
+	uint64_t coarser = (uint64_t)1 << (max_block_level - level + 1);
+	if(tick % coarser == 0)
+		return level - 1;
+	return level;
 }
 
-Eigen::Vector3d physics::accel(Eigen::Vector3d x_i, uint16_t skip_index)
+void physics::set_max_block_level(uint8_t level)
 {
-	Eigen::Vector3d a(0.0, 0.0, 0.0);
-	for(uint16_t j = 0; j < obj_count; j++)
+	if(level > 40)
+		level = 40;
+	max_block_level = level;
+	accel_valid = false;
+}
+
+void physics::accel_all(const std::vector<Eigen::Vector3d> &pos,
+	std::vector<Eigen::Vector3d> &acc, bool potential)
+{
+	uint64_t count = 0;
+	double eps2 = softening * softening;
+	double *phi_all = nullptr;
+	if(potential)
+	{
+		zero_phi();
+		phi_all = phi.data();
+	}
+	if(method == force_method::barnes_hut)
 	{
-		if(skip_index == j)
+		{
+			profile_scope scope(profile_phase::tree_build);
+			tree.build(pos, get_mass_view());
+		}
+
+		// walks in a clustered system cost very different amounts, the
+		// chunks are cut by each body's interactions in the last pass and
+		// threads that run out steal, timed per thread so what is left of
+		// the imbalance shows up as uneven threads
+		pool.split(obj_count, walk_cost.size() == obj_count ?
+			walk_cost.data() : nullptr, omp_get_max_threads());
+		walk_cost.resize(obj_count);
+		#pragma omp parallel reduction(+:count)
+		{
+			profile_scope scope(profile_phase::force);
+			uint32_t begin, end;
+			while(pool.next(begin, end))
+			{
+				for(uint32_t i = begin; i < end; i++)
+				{
+					uint64_t c = 0;
+					acc[i] = tree.accel(pos[i], i, G, eps2, c,
+						potential ? &phi_all[i] : nullptr);
+					walk_cost[i] = (uint32_t)c;
+					count += c;
+				}
+			}
+		}
+	}
+	else if(method == force_method::tiled)
+	{
+		tiled_all(pos, acc, phi_all);
+		count = (uint64_t)obj_count * (obj_count - 1);
+	}
+	else
+	{
+		if(prec == precision::fp64)
+			direct_all(src, potential ? kernel_pot : kernel, pos, acc, phi_all);
+		else
+		{
+			if(src_f.size() != obj_count)
+				resize_sources(src_f);
+			direct_all(src_f, potential ? kernel_f_pot : kernel_f, pos, acc,
+				phi_all);
+		}
+		count = (uint64_t)obj_count * (obj_count - 1);
+	}
+	interactions += count;
+}
+
+template<typename soa_t, typename kernel_t>
+void physics::direct_all(soa_t &s, kernel_t k,
+	const std::vector<Eigen::Vector3d> &pos,
+	std::vector<Eigen::Vector3d> &acc, double *phi)
+{
+	double eps2 = softening * softening;
+	pack_sources(s, pos);
+
+	// sum either side of i so the kernel has no branch in it, timed per
+	// thread to show any imbalance
+	#pragma omp parallel
+	{
+		profile_scope scope(profile_phase::force);
+		#pragma omp for nowait
+		for(int i = 0; i < (int)obj_count; i++)
+		{
+			Eigen::Vector3d a_i(0.0, 0.0, 0.0);
+			double *phi_i = phi != nullptr ? &phi[i] : nullptr;
+			k(s, 0, i, pos[i].data(), G, eps2, a_i.data(), phi_i);
+			k(s, i + 1, obj_count, pos[i].data(), G, eps2, a_i.data(), phi_i);
+			acc[i] = a_i;
+		}
+	}
+}
+
+template<typename soa_t>
+void physics::pack_sources(soa_t &s, const std::vector<Eigen::Vector3d> &pos)
+{
+	typedef typename soa_t::scalar scalar;
+	profile_scope scope(profile_phase::pack);
+	#pragma omp parallel for
+	for(int i = 0; i < (int)obj_count; i++)
+	{
+		s.x[i] = (scalar)pos[i][0];
+		s.y[i] = (scalar)pos[i][1];
+		s.z[i] = (scalar)pos[i][2];
+		s.m[i] = (scalar)m[i];
+	}
+}
+
+void physics::tracer_accel(const std::vector<Eigen::Vector3d> &pos)
+{
+	double eps2 = softening * softening;
+	pack_sources(src, pos);
+
+	const uint32_t chunks = (tracer_count + tracer_chunk - 1) / tracer_chunk;
+	#pragma omp parallel
+	{
+		profile_scope scope(profile_phase::tracers);
+		#pragma omp for nowait
+		for(int c = 0; c < (int)chunks; c++)
+		{
+			uint32_t begin = c * tracer_chunk;
+			uint32_t end = std::min(begin + tracer_chunk, tracer_count);
+			tracer_k(src, 0, obj_count, tracers, begin, end, G, eps2);
+		}
+	}
+	interactions += (uint64_t)obj_count * tracer_count;
+	tracer_accel_valid = true;
+}
+
+void physics::step_tracers(double delta_t)
+{
+	double eps2 = softening * softening;
+	double half_dt = 0.5 * delta_t;
+	// the bodies at the end of the step, after any merge
+	pack_sources(src, x[next]);
+
+	tracer_soa &t = tracers;
+	const uint32_t chunks = (tracer_count + tracer_chunk - 1) / tracer_chunk;
+	#pragma omp parallel
+	{
+		profile_scope scope(profile_phase::tracers);
+		#pragma omp for nowait
+		for(int c = 0; c < (int)chunks; c++)
+		{
+			uint32_t begin = c * tracer_chunk;
+			uint32_t end = std::min(begin + tracer_chunk, tracer_count);
+			for(uint32_t i = begin; i < end; i++)
+			{
+				t.vx[i] += half_dt * t.ax[i];
+				t.vy[i] += half_dt * t.ay[i];
+				t.vz[i] += half_dt * t.az[i];
+				t.x[i] += delta_t * t.vx[i];
+				t.y[i] += delta_t * t.vy[i];
+				t.z[i] += delta_t * t.vz[i];
+			}
+			tracer_k(src, 0, obj_count, t, begin, end, G, eps2);
+			for(uint32_t i = begin; i < end; i++)
+			{
+				t.vx[i] += half_dt * t.ax[i];
+				t.vy[i] += half_dt * t.ay[i];
+				t.vz[i] += half_dt * t.az[i];
+			}
+		}
+	}
+	interactions += (uint64_t)obj_count * tracer_count;
+}
+
+template<typename soa_t>
+void physics::resize_sources(soa_t &s)
+{
+	size_t capacity = s.m.capacity();
+	s.resize(obj_count);
+	if(!interleave || s.m.capacity() == capacity)
+		return;
+	// nothing has touched the new arrays yet, pack_sources() does
+	typedef typename soa_t::scalar scalar;
+	size_t bytes = obj_count * sizeof(scalar);
+	numa_interleave(s.x.data(), bytes);
+	numa_interleave(s.y.data(), bytes);
+	numa_interleave(s.z.data(), bytes);
+	numa_interleave(s.m.data(), bytes);
+}
+
+void physics::zero_phi()
+{
+	phi.resize(obj_count);
+	#pragma omp parallel for
+	for(int i = 0; i < (int)obj_count; i++)
+		phi[i] = 0.0;
+}
+
+void physics::tiled_all(const std::vector<Eigen::Vector3d> &pos,
+	std::vector<Eigen::Vector3d> &acc, double *phi)
+{
+	double eps2 = softening * softening;
+	pair_kernel k = phi != nullptr ? pair_k_pot : pair_k;
+	pack_sources(src, pos);
+
+	const uint32_t tiles = (obj_count + pair_tile - 1) / pair_tile;
+	pair_sums.resize(omp_get_max_threads());
+	#pragma omp parallel
+	{
+		profile_scope scope(profile_phase::force);
+		// each thread only ever writes its own sums so they need no barrier
+		// before the tiles, and the thread that zeroes them touches them
+		// first
+		pair_sum &t = pair_sums[omp_get_thread_num()];
+		t.ax.assign(obj_count, 0.0);
+		t.ay.assign(obj_count, 0.0);
+		t.az.assign(obj_count, 0.0);
+		if(phi != nullptr)
+			t.phi.assign(obj_count, 0.0);
+
+		// row I is tiles I to the end, the rows get shorter so they are
+		// handed out one at a time longest first, tile I stays in cache
+		// while the others stream past it
+		#pragma omp for schedule(dynamic, 1)
+		for(int ti = 0; ti < (int)tiles; ti++)
+		{
+			uint32_t i_begin = ti * pair_tile;
+			uint32_t i_end = std::min(i_begin + pair_tile, obj_count);
+			for(uint32_t tj = ti; tj < tiles; tj++)
+			{
+				uint32_t j_begin = tj * pair_tile;
+				k(src, i_begin, i_end, j_begin, std::min(j_begin + pair_tile,
+					obj_count), G, eps2, t.ax.data(), t.ay.data(),
+					t.az.data(), phi != nullptr ? t.phi.data() : nullptr);
+			}
+		}
+
+		// the implied barrier above means every thread's sums are done
+		int threads = omp_get_num_threads();
+		#pragma omp for
+		for(int i = 0; i < (int)obj_count; i++)
+		{
+			Eigen::Vector3d a_i(0.0, 0.0, 0.0);
+			double phi_i = 0.0;
+			for(int u = 0; u < threads; u++)
+			{
+				const pair_sum &s = pair_sums[u];
+				a_i += Eigen::Vector3d(s.ax[i], s.ay[i], s.az[i]);
+				if(phi != nullptr)
+					phi_i += s.phi[i];
+			}
+			acc[i] = a_i;
+			if(phi != nullptr)
+				phi[i] = phi_i;
+		}
+	}
+}
+
+void physics::sample_diagnostics(const std::vector<Eigen::Vector3d> &pos,
+	const std::vector<Eigen::Vector3d> &vel, double time)
+{
+	// every sum is O(N), the O(N^2) part came with the forces
+	double kinetic = 0.0, potential = 0.0;
+	double px = 0.0, py = 0.0, pz = 0.0;
+	double lx = 0.0, ly = 0.0, lz = 0.0;
+	#pragma omp parallel for reduction(+:kinetic, potential, px, py, pz, \
+		lx, ly, lz)
+	for(int i = 0; i < (int)obj_count; i++)
+	{
+		kinetic += 0.5 * m[i] * vel[i].squaredNorm();
+		potential += 0.5 * m[i] * phi[i];
+		Eigen::Vector3d p = m[i] * vel[i];
+		Eigen::Vector3d l = pos[i].cross(p);
+		px += p[0];
+		py += p[1];
+		pz += p[2];
+		lx += l[0];
+		ly += l[1];
+		lz += l[2];
+	}
+
+	diagnostics d;
+	d.time = time;
+	d.kinetic = kinetic;
+	d.potential = potential;
+	d.momentum = Eigen::Vector3d(px, py, pz);
+	d.angular_momentum = Eigen::Vector3d(lx, ly, lz);
+	diag.push_back(d);
+}
+
+void physics::seed(uint64_t s)
+{
+	generator.seed(s);
+}
+
+void physics::set_mass_range(double min, double max)
+{
+	mass_range[0] = min;
+	mass_range[1] = max;
+}
+
+void physics::set_radius_range(double min, double max)
+{
+	radius_range[0] = min;
+	radius_range[1] = max;
+}
+
+void physics::set_distance_range(double min, double max)
+{
+	distance_range[0] = min;
+	distance_range[1] = max;
+}
+
+const char *physics::integrator_name(integrator i)
+{
+	switch(i)
+	{
+		case integrator::rk4:
+			return "rk4";
+		case integrator::hermite:
+			return "hermite";
+		default:
+			return "leapfrog";
+	}
+}
+
+bool physics::parse_integrator(const std::string &name, integrator &i)
+{
+	for(integrator k : {integrator::leapfrog, integrator::rk4,
+		integrator::hermite})
+	{
+		if(name == integrator_name(k))
+		{
+			i = k;
+			return true;
+		}
+	}
+	return false;
+}
+
+const char *physics::force_method_name(force_method f)
+{
+	switch(f)
+	{
+		case force_method::barnes_hut:
+			return "barnes_hut";
+		case force_method::tiled:
+			return "tiled";
+		default:
+			return "direct";
+	}
+}
+
+bool physics::parse_force_method(const std::string &name, force_method &f)
+{
+	for(force_method k : {force_method::direct, force_method::barnes_hut,
+		force_method::tiled})
+	{
+		if(name == force_method_name(k))
+		{
+			f = k;
+			return true;
+		}
+	}
+	return false;
+}
+
+const char *physics::distribution_name(distribution d)
+{
+	switch(d)
+	{
+		case distribution::plummer:
+			return "plummer";
+		case distribution::disk:
+			return "disk";
+		default:
+			return "uniform";
+	}
+}
+
+bool physics::parse_distribution(const std::string &name, distribution &d)
+{
+	for(distribution k : {distribution::uniform, distribution::plummer,
+		distribution::disk})
+	{
+		if(name == distribution_name(k))
+		{
+			d = k;
+			return true;
+		}
+	}
+	return false;
+}
+
+const char *physics::collision_mode_name(collision_mode c)
+{
+	switch(c)
+	{
+		case collision_mode::report:
+			return "report";
+		case collision_mode::elastic:
+			return "elastic";
+		case collision_mode::merge:
+			return "merge";
+		default:
+			return "none";
+	}
+}
+
+bool physics::parse_collision_mode(const std::string &name, collision_mode &c)
+{
+	for(collision_mode k : {collision_mode::none, collision_mode::report,
+		collision_mode::elastic, collision_mode::merge})
+	{
+		if(name == collision_mode_name(k))
+		{
+			c = k;
+			return true;
+		}
+	}
+	return false;
+}
+
+void physics::collide()
+{
+	{
+		profile_scope scope(profile_phase::grid_build);
+		hash.build(x[next], get_radii_view());
+	}
+	hash.find_pairs(x[next], get_radii_view(), collision_pairs);
+	collision_count += collision_pairs.size();
+	if(collision_pairs.empty())
+		return;
+
+	if(collisions == collision_mode::elastic)
+		bounce();
+	else if(collisions == collision_mode::merge)
+		merge();
+}
+
+void physics::bounce()
+{
+	// in order so a body in several pairs sees the earlier bounces, there are
+	// few enough pairs that this doesn't need to be parallel
+	for(const std::pair<uint32_t, uint32_t> &p : collision_pairs)
+	{
+		uint32_t i = p.first;
+		uint32_t j = p.second;
+		Eigen::Vector3d n = x[next][j] - x[next][i];
+		double d = n.norm();
+		if(d == 0.0)
+			continue;
+		n /= d;
+
+		// already separating (ie. bounced last step and still overlapping)
+		double approach = (v[next][i] - v[next][j]).dot(n);
+		if(approach <= 0.0)
 			continue;
 
-		Eigen::Vector3d r = x[current][j] - x_i;
-		a += G * m[j] * r.normalized() / r.squaredNorm();
+		double total = m[i] + m[j];
+		v[next][i] -= (2.0 * m[j] / total * approach) * n;
+		v[next][j] += (2.0 * m[i] / total * approach) * n;
 	}
-	return a;
+
+	// the Hermite jerk depends on the velocities
+	if(integ == integrator::hermite)
+		accel_valid = false;
+}
+
+void physics::merge()
+{
+	merge_root.resize(obj_count);
+	for(uint32_t i = 0; i < obj_count; i++)
+		merge_root[i] = i;
+	auto find = [this](uint32_t i)
+	{
+		while(merge_root[i] != i)
+		{
+			merge_root[i] = merge_root[merge_root[i]];
+			i = merge_root[i];
+		}
+		return i;
+	};
+	for(const std::pair<uint32_t, uint32_t> &p : collision_pairs)
+	{
+		uint32_t a = find(p.first);
+		uint32_t b = find(p.second);
+		if(a < b)
+			merge_root[b] = a;
+		else if(b < a)
+			merge_root[a] = b;
+	}
+
+	// fold each body into its root, the root is always the lower index so it
+	// is whole before anything else folds in, repeated mass weighted means
+	// give the center of mass and momentum of the whole group
+	for(uint32_t i = 0; i < obj_count; i++)
+	{
+		uint32_t t = find(i);
+		if(t == i)
+			continue;
+		double total = m[t] + m[i];
+		x[next][t] = (m[t] * x[next][t] + m[i] * x[next][i]) / total;
+		v[next][t] = (m[t] * v[next][t] + m[i] * v[next][i]) / total;
+		r[t] = std::cbrt(r[t] * r[t] * r[t] + r[i] * r[i] * r[i]);
+		m[t] = total;
+	}
+
+	// keep the roots in order
+	uint32_t count = 0;
+	for(uint32_t i = 0; i < obj_count; i++)
+	{
+		if(merge_root[i] != i)
+			continue;
+		x[next][count] = x[next][i];
+		v[next][count] = v[next][i];
+		r[count] = r[i];
+		m[count] = m[i];
+		id[count] = id[i];
+		count++;
+	}
+
+	obj_count = count;
+	for(int k = 0; k < 2; k++)
+	{
+		x[k].resize(obj_count);
+		v[k].resize(obj_count);
+		a[k].resize(obj_count);
+	}
+	r.resize(obj_count);
+	m.resize(obj_count);
+	id.resize(obj_count);
+	update_id_order();
+	src.resize(obj_count);
+	if(src_f.size() > 0)
+		src_f.resize(obj_count);
+	accel_valid = false;
+}
+
+/**
+ * @brief Gathers v in the order of index into tmp then swaps them, tmp is
+ * left with the old order
+ */
+template<typename vector_t>
+static void permute(vector_t &v, vector_t &tmp,
+	const std::vector<uint32_t> &index)
+{
+	int n = (int)index.size();
+	tmp.resize(n);
+	#pragma omp parallel for
+	for(int i = 0; i < n; i++)
+		tmp[i] = v[index[i]];
+	v.swap(tmp);
+}
+
+void physics::reorder()
+{
+	profile_scope scope(profile_phase::reorder);
+	if(obj_count < 2)
+		return;
+
+	// the check and the sort key the same cube, the bounding one of the
+	// state, so a sorted state checks as sorted and the same state reorders
+	// the same way however it was reached, a restart included
+	const std::vector<Eigen::Vector3d> &p = x[current];
+	Eigen::Vector3d lo = p[0];
+	Eigen::Vector3d hi = p[0];
+	#pragma omp parallel
+	{
+		Eigen::Vector3d t_lo = lo;
+		Eigen::Vector3d t_hi = hi;
+		#pragma omp for nowait
+		for(int i = 0; i < (int)obj_count; i++)
+		{
+			t_lo = t_lo.cwiseMin(p[i]);
+			t_hi = t_hi.cwiseMax(p[i]);
+		}
+		#pragma omp critical
+		{
+			lo = lo.cwiseMin(t_lo);
+			hi = hi.cwiseMax(t_hi);
+		}
+	}
+	double scale = (double)(1u << morton_bits) /
+		((hi - lo).maxCoeff() * 1.0001 + 1e-12);
+
+	// neighbours in memory that are out of order at the level with about 4
+	// bodies per cell, 0 right after a sort and about half for a random
+	// order, finer levels would count bodies that only moved within a cell
+	uint32_t bits = 0;
+	while(bits < 31 && ((uint32_t)1 << bits) < obj_count / 4)
+		bits++;
+	uint32_t check_level = std::min(std::max(bits / 3, 1u), reorder_level);
+	uint32_t check_shift = 3 * (morton_bits - check_level);
+	uint32_t samples = std::min(obj_count - 1, reorder_samples);
+	uint32_t stride = (obj_count - 1) / samples;
+	uint32_t descents = 0;
+	for(uint32_t k = 0; k < samples; k++)
+	{
+		uint32_t i = k * stride;
+		if(morton_key(p[i], lo, scale) >> check_shift >
+			morton_key(p[i + 1], lo, scale) >> check_shift)
+			descents++;
+	}
+	if(descents <= reorder_threshold * samples)
+		return;
+
+	const uint32_t shift = 3 * (morton_bits - reorder_level);
+	sort_key.resize(obj_count);
+	sort_index.resize(obj_count);
+	#pragma omp parallel for
+	for(int i = 0; i < (int)obj_count; i++)
+	{
+		sort_key[i] = (uint32_t)(morton_key(p[i], lo, scale) >> shift);
+		sort_index[i] = i;
+	}
+	radix_sort(sort_key, sort_index, sort_key_tmp, sort_index_tmp,
+		3 * reorder_level);
+
+	// the next buffers are written by the step before they are read so they
+	// take the old order, every state carried over from the last step moves
+	permute(x[current], x[next], sort_index);
+	permute(v[current], v[next], sort_index);
+	permute(a[current], a[next], sort_index);
+	if(jerk.size() == obj_count)
+	{
+		permute(jerk, x[next], sort_index);
+		std::vector<uint8_t> level_tmp;
+		permute(level, level_tmp, sort_index);
+	}
+	aligned_vector<double> tmp;
+	permute(m, tmp, sort_index);
+	permute(r, tmp, sort_index);
+	aligned_vector<uint32_t> tmp_u32;
+	permute(id, tmp_u32, sort_index);
+	if(walk_cost.size() == obj_count)
+		permute(walk_cost, tmp_u32, sort_index);
+	update_id_order();
+	reorder_count++;
+}
+
+void physics::update_id_order()
+{
+	// a radix sort rather than a scatter by id, a checkpoint can hold any ids
+	uint32_t top = 0;
+	for(uint32_t i = 0; i < obj_count; i++)
+		top = std::max(top, id[i]);
+	uint32_t key_bits = 8;
+	while(key_bits < 32 && (top >> key_bits) != 0)
+		key_bits += 8;
+	sort_key.assign(id.begin(), id.begin() + obj_count);
+	sort_index.resize(obj_count);
+	std::iota(sort_index.begin(), sort_index.end(), 0);
+	radix_sort(sort_key, sort_index, sort_key_tmp, sort_index_tmp, key_bits);
+	id_order.swap(sort_index);
+}
+
+void physics::set_simd_isa(simd_isa isa)
+{
+	simd_isa best = detect_simd_isa();
+	if((int)isa > (int)best)
+		isa = best;
+	this->isa = isa;
+	select_kernels();
 }
 
-void physics::init(uint16_t obj_count)
+void physics::set_precision(precision prec)
 {
+	this->prec = prec;
+	select_kernels();
+	accel_valid = false;
+}
+
+void physics::set_softening(double eps)
+{
+	softening = eps > 0.0 ? eps : 0.0;
+	select_kernels();
+	accel_valid = false;
+	tracer_accel_valid = false;
+}
+
+void physics::set_G(double G)
+{
+	this->G = G;
+	select_kernels();
+	accel_valid = false;
+	tracer_accel_valid = false;
+}
+
+void physics::select_kernels()
+{
+	bool softened = softening > 0.0;
+	bool unit_g = G == 1.0;
+	kernel = get_accel_kernel(isa, softened, unit_g);
+	kernel_f = get_accel_kernel_f(isa,
+		prec == precision::mixed ? precision::mixed : precision::fp32,
+		softened, unit_g);
+	jerk_k = get_jerk_kernel(softened, unit_g);
+	pair_k = get_pair_kernel(isa, softened, unit_g);
+	kernel_pot = get_accel_kernel(isa, softened, unit_g, true);
+	kernel_f_pot = get_accel_kernel_f(isa,
+		prec == precision::mixed ? precision::mixed : precision::fp32,
+		softened, unit_g, true);
+	jerk_k_pot = get_jerk_kernel(softened, unit_g, true);
+	pair_k_pot = get_pair_kernel(isa, softened, unit_g, true);
+	tracer_k = get_tracer_kernel(isa, softened, unit_g);
+}
+
+double physics::get_energy()
+{
+	const std::vector<Eigen::Vector3d> &pos = x[current];
+	const std::vector<Eigen::Vector3d> &vel = v[current];
+	double eps2 = softening * softening;
+	double kinetic = 0.0, potential = 0.0;
+
+	// the inner loop shrinks as i grows so hand out rows dynamically
+	#pragma omp parallel for schedule(dynamic, 64) reduction(+:kinetic, potential)
+	for(int i = 0; i < (int)obj_count; i++)
+	{
+		kinetic += 0.5 * m[i] * vel[i].squaredNorm();
+		double u = 0.0;
+		for(uint32_t j = i + 1; j < obj_count; j++)
+			u += m[j] / std::sqrt((pos[j] - pos[i]).squaredNorm() + eps2);
+		potential -= G * m[i] * u;
+	}
+
+	return kinetic + potential;
+}
+
+double physics::fill_radius_scale(uint32_t obj_count) const
+{
+	// moments of the uniform radius distribution
+	double r0 = radius_range[0], r1 = radius_range[1];
+	double r2 = r0 * r0, r3 = r0 * r0 * r0;
+	if(r1 > r0)
+	{
+		r2 = (r1 * r1 * r1 - r0 * r0 * r0) / (3.0 * (r1 - r0));
+		r3 = (r1 * r1 * r1 * r1 - r0 * r0 * r0 * r0) / (4.0 * (r1 - r0));
+	}
+	double half = 0.5 * (distance_range[1] - distance_range[0]);
+
+	double fill;
+	switch(dist)
+	{
+		case distribution::plummer:
+		{
+			// volume filled at the center, where the density peaks, 0.9131 is
+			// the mass inside the 4 scale radius cutoff
+			double scale = 0.25 * half;
+			fill = obj_count * r3 / (scale * scale * scale * 0.9131);
+			return fill > max_fill ? std::cbrt(max_fill / fill) : 1.0;
+		}
+		case distribution::disk:
+			// the disk is thinner than the bodies, so fill it as a plane
+			fill = obj_count * r2 / (half * half);
+			return fill > max_fill ? std::sqrt(max_fill / fill) : 1.0;
+		default:
+			fill = obj_count * (4.0 / 3.0) * M_PI * r3 / (8.0 * half * half *
+				half);
+			return fill > max_fill ? 0.0 : 1.0;
+	}
+}
+
+bool physics::init(uint32_t obj_count)
+{
+	// the uniform cube is as dense as the ranges ask for, the plummer sphere
+	// and the disk concentrate the bodies so their radii shrink to fit
+	double scale = fill_radius_scale(obj_count);
+	if(scale <= 0.0)
+	{
+		printf("ERROR: %u bodies of radius %g to %g fill more than %g of the "
+			"distance range, use a larger range or smaller radii\n",
+			obj_count, radius_range[0], radius_range[1], max_fill);
+		return false;
+	}
+	radius_scale = scale;
 	this->obj_count = obj_count;
 
 	current = 0;
 	next = 1;
 	total_time = 0.0;
+	accel_valid = false;
+	tracer_accel_valid = false;
+	interactions = 0;
+	collision_count = 0;
+	collision_pairs.clear();
+	epoch++;
+	diag_step = 0;
+	diag.clear();
+	reorder_count = 0;
+	walk_cost.clear();
 
 	x[0].resize(obj_count);
 	x[1].resize(obj_count);
@@ -85,65 +1212,270 @@ void physics::init(uint16_t obj_count)
 	a[1].resize(obj_count);
 	r.resize(obj_count);
 	m.resize(obj_count);
+	id.resize(obj_count);
+	#pragma omp parallel for
+	for(int i = 0; i < (int)obj_count; i++)
+		id[i] = i;
+	update_id_order();
+	resize_sources(src);
 
-	// for now hard code some values
-	mass_range[0] = 5e7;
-	mass_range[1] = 1e8;
-	radius_range[0] = 0.05;
-	radius_range[1] = 0.25;
-	//distance_range[0] = -radius_range[0] * 15.0;
-	//distance_range[1] = radius_range[0] * 15.0;
-	distance_range[0] = -4.0;
-	distance_range[1] = 4.0;
-
-	// random init stuff
+	// the generator only picks the base seed, each body draws from its own
+	// stream so the bodies don't depend on the thread count
+	uint64_t base = generator();
 	std::uniform_real_distribution<double> dist_m(mass_range[0],
 		mass_range[1]);
-	std::uniform_real_distribution<double> dist_r(radius_range[0],
-		radius_range[1]);
-	std::uniform_real_distribution<double> dist_d(distance_range[0],
-		distance_range[1]);
+	std::uniform_real_distribution<double> dist_r(radius_range[0] *
+		radius_scale, radius_range[1] * radius_scale);
 
-	for(uint16_t i = 0; i < obj_count; i++)
+	double total_mass = 0.0;
+	#pragma omp parallel for reduction(+:total_mass)
+	for(int i = 0; i < (int)obj_count; i++)
 	{
-		r[i] = dist_r(generator);
-		m[i] = dist_m(generator);
+		splitmix64 rng = body_stream(base, i, 0);
+		r[i] = dist_r(rng);
+		m[i] = dist_m(rng);
+		total_mass += m[i];
+	}
+
+	#pragma omp parallel for
+	for(int i = 0; i < (int)obj_count; i++)
+	{
+		splitmix64 rng = body_stream(base, i, 1);
+		place(rng, total_mass, x[0][i], v[0][i]);
+		a[0][i] = Eigen::Vector3d(0.0, 0.0, 0.0);
+	}
+
+	// move the higher index of every overlapping pair somewhere else until
+	// nothing overlaps, with the spatial hash this is linear per round
+	std::vector<uint8_t> redo;
+	for(uint32_t round = 2; ; round++)
+	{
+		hash.build(x[0], get_radii_view());
+		hash.find_pairs(x[0], get_radii_view(), collision_pairs);
+		if(collision_pairs.empty())
+			break;
+		if(round > max_place_rounds)
+		{
+			printf("ERROR: %zu overlapping pairs left after placing %u bodies, "
+				"use a larger distance range or smaller radii\n",
+				collision_pairs.size(), obj_count);
+			collision_pairs.clear();
+			this->obj_count = 0;
+			tracer_count = 0;
+			return false;
+		}
+
+		redo.assign(obj_count, 0);
+		for(const std::pair<uint32_t, uint32_t> &p : collision_pairs)
+			redo[p.second] = 1;
+		#pragma omp parallel for
+		for(int i = 0; i < (int)obj_count; i++)
+		{
+			if(!redo[i])
+				continue;
+			splitmix64 rng = body_stream(base, i, round);
+			place(rng, total_mass, x[0][i], v[0][i]);
+		}
+	}
+	collision_pairs.clear();
+
+	place_tracers(base, total_mass);
+	return true;
+}
+
+void physics::place_tracers(uint64_t base, double total_mass)
+{
+	tracer_count = tracer_init_count;
+	tracers.resize(tracer_count);
 
-		// TODO: detect and avoid collisions here
-		bool collision = true;
-		while(collision)
+	// in the same chunks as the tracer steps so each thread first touches
+	// the tracers it steps, tracers can overlap anything so one stream past
+	// the bodies' last round is all they need
+	const uint32_t chunks = (tracer_count + tracer_chunk - 1) / tracer_chunk;
+	#pragma omp parallel for
+	for(int c = 0; c < (int)chunks; c++)
+	{
+		uint32_t begin = c * tracer_chunk;
+		uint32_t end = std::min(begin + tracer_chunk, tracer_count);
+		for(uint32_t i = begin; i < end; i++)
 		{
-			// generate a new point
-			x[0][i] = Eigen::Vector3d(dist_d(generator),
-									dist_d(generator),
-									dist_d(generator));
+			splitmix64 rng = body_stream(base, i, max_place_rounds + 1);
+			Eigen::Vector3d pos, vel;
+			place(rng, total_mass, pos, vel);
+			tracers.x[i] = pos[0];
+			tracers.y[i] = pos[1];
+			tracers.z[i] = pos[2];
+			tracers.vx[i] = vel[0];
+			tracers.vy[i] = vel[1];
+			tracers.vz[i] = vel[2];
+			tracers.ax[i] = 0.0;
+			tracers.ay[i] = 0.0;
+			tracers.az[i] = 0.0;
+		}
+	}
+}
+
+void physics::place(splitmix64 &rng, double total_mass, Eigen::Vector3d &pos,
+	Eigen::Vector3d &vel)
+{
+	std::uniform_real_distribution<double> unit(0.0, 1.0);
+	double half = 0.5 * (distance_range[1] - distance_range[0]);
+	Eigen::Vector3d center = Eigen::Vector3d::Constant(distance_range[0] +
+		half);
 
-			// look for a collision
-			collision = false;
-			for(uint16_t j = 0; j < i; j++)
+	switch(dist)
+	{
+		case distribution::plummer:
+		{
+			// inverse of the cumulative mass, cut off at 4 scale radii so
+			// everything is inside the distance range
+			double scale = 0.25 * half;
+			double radius;
+			do
 			{
-				if(i == j)
-					continue;
+				double f = unit(rng);
+				radius = scale / std::sqrt(std::pow(f, -2.0 / 3.0) - 1.0);
+			} while(!(radius <= 4.0 * scale));
 
-				// direction unit vector
-				Eigen::Vector3d ji_uv = (x[0][i] - x[0][j]).normalized();
+			// speed as a fraction of the local escape speed from von Neumann
+			// rejection on q^2 (1 - q^2)^(7/2) (Aarseth, Henon and Wielen 1974)
+			double q, y;
+			do
+			{
+				q = unit(rng);
+				y = 0.1 * unit(rng);
+			} while(y > q * q * std::pow(1.0 - q * q, 3.5));
+			double escape = std::sqrt(2.0 * G * total_mass /
+				std::sqrt(radius * radius + scale * scale));
 
-				// position plus radius in the direction of the other object
-				Eigen::Vector3d ji_r = x[0][j] + ji_uv * r[j];
+			pos = center + radius * random_direction(rng);
+			vel = q * escape * random_direction(rng);
+			break;
+		}
+		case distribution::disk:
+		{
+			// uniform surface density in the x y plane, thin in z, on circular
+			// orbits about the mass inside each radius
+			double radius = half * std::sqrt(unit(rng));
+			double angle = 2.0 * M_PI * unit(rng);
+			std::normal_distribution<double> thickness(0.0, 0.01 * half);
+			Eigen::Vector3d dir(std::cos(angle), std::sin(angle), 0.0);
 
-				double distance_j = (x[0][i] - ji_r).norm();
-				// if radius > distance to j object then collision
-				if(r[i] > distance_j)
-				{
-					collision = true;
-					break;
-				}
-			}
+			pos = center + radius * dir;
+			pos[2] += thickness(rng);
+			double speed = std::sqrt(G * total_mass * radius) / half;
+			vel = speed * Eigen::Vector3d(-dir[1], dir[0], 0.0);
+			break;
+		}
+		default:
+		{
+			std::uniform_real_distribution<double> d(distance_range[0],
+				distance_range[1]);
+			pos = Eigen::Vector3d(d(rng), d(rng), d(rng));
+			vel = Eigen::Vector3d(0.0, 0.0, 0.0);
+			break;
 		}
+	}
+}
 
-		v[0][i] = Eigen::Vector3d(0.0, 0.0, 0.0);
-		a[0][i] = Eigen::Vector3d(0.0, 0.0, 0.0);
+// checkpoints store vectors as packed (x, y, z) doubles
+static_assert(sizeof(Eigen::Vector3d) == 3 * sizeof(double),
+	"Eigen::Vector3d is not three packed doubles");
+
+bool physics::save_checkpoint(const std::string &fname) const
+{
+	checkpoint_header h;
+	checkpoint_init_header(h, obj_count);
+	h.total_time = total_time;
+	h.G = G;
+	h.softening = softening;
+	return checkpoint_write(fname, h, (const double *)x[current].data(),
+		(const double *)v[current].data(), m.data(), r.data(), id.data());
+}
+
+bool physics::load_checkpoint(const std::string &fname)
+{
+	mapped_file f;
+	if(!f.open(fname))
+		return false;
+	const checkpoint_header *h = checkpoint_check(f, fname);
+	if(h == nullptr)
+		return false;
+
+	obj_count = h->obj_count;
+	current = 0;
+	next = 1;
+	total_time = h->total_time;
+	accel_valid = false;
+	tracer_count = 0;
+	tracers.resize(0);
+	tracer_accel_valid = false;
+	interactions = 0;
+	collision_count = 0;
+	collision_pairs.clear();
+	epoch++;
+	diag_step = 0;
+	diag.clear();
+	reorder_count = 0;
+	walk_cost.clear();
+
+	for(int k = 0; k < 2; k++)
+	{
+		x[k].resize(obj_count);
+		v[k].resize(obj_count);
+		a[k].resize(obj_count);
+	}
+	r.resize(obj_count);
+	m.resize(obj_count);
+	id.resize(obj_count);
+	resize_sources(src);
+	if(src_f.size() > 0)
+		resize_sources(src_f);
+
+	// the arrays are laid out like the vectors so each is one copy, split
+	// over the threads so the page faults on the map are too, and each
+	// thread's part of the arrays is placed on its node
+	const uint8_t *base = f.data();
+	size_t vec_bytes = obj_count * sizeof(Eigen::Vector3d);
+	size_t scalar_bytes = obj_count * sizeof(double);
+	size_t id_bytes = h->id_offset ? obj_count * sizeof(uint32_t) : 0;
+	struct block
+	{
+		void *dst;
+		const uint8_t *src;
+		size_t size;
+	};
+	const block blocks[5] =
+	{
+		{x[0].data(), base + h->x_offset, vec_bytes},
+		{v[0].data(), base + h->v_offset, vec_bytes},
+		{m.data(), base + h->m_offset, scalar_bytes},
+		{r.data(), base + h->r_offset, scalar_bytes},
+		{id.data(), base + h->id_offset, id_bytes}
+	};
+	#pragma omp parallel
+	{
+		int t = omp_get_thread_num();
+		int threads = omp_get_num_threads();
+		for(const block &b : blocks)
+		{
+			size_t begin = b.size * t / threads;
+			size_t end = b.size * (t + 1) / threads;
+			memcpy((uint8_t *)b.dst + begin, b.src + begin, end - begin);
+		}
 	}
+	// version 1 has no ids, the bodies are in the order init() made them
+	if(id_bytes == 0)
+	{
+		#pragma omp parallel for
+		for(int i = 0; i < (int)obj_count; i++)
+			id[i] = i;
+	}
+	update_id_order();
+
+	set_G(h->G);
+	set_softening(h->softening);
+	return true;
 }
 
 void physics::deinit()
@@ -169,13 +1501,56 @@ void physics::deinit()
 	a[0].swap(n4);
 	a[1].swap(n5);
 
-	std::vector<double> n6;
+	aligned_vector<double> n6;
 	r.clear();
 	r.swap(n6);
 
-	std::vector<double> n7;
+	aligned_vector<double> n7;
 	m.clear();
 	m.swap(n7);
+
+	body_soa n8;
+	std::swap(src, n8);
+	body_soa_f n8f;
+	std::swap(src_f, n8f);
+	tracer_soa n8t;
+	std::swap(tracers, n8t);
+	tracer_count = 0;
+
+	std::vector<Eigen::Vector3d> n9, n10, n11, n12;
+	rk_x.swap(n9);
+	rk_v.swap(n10);
+	rk_dx.swap(n11);
+	rk_dv.swap(n12);
+
+	std::vector<Eigen::Vector3d> n13;
+	jerk.swap(n13);
+	std::vector<uint8_t> n14;
+	level.swap(n14);
+	std::vector<uint64_t> n15;
+	t_tick.swap(n15);
+	std::vector<uint32_t> n16;
+	active.swap(n16);
+	std::vector<std::pair<uint32_t, uint32_t>> n17;
+	collision_pairs.swap(n17);
+	std::vector<uint32_t> n18;
+	merge_root.swap(n18);
+	aligned_vector<double> n19;
+	phi.swap(n19);
+	std::vector<pair_sum> n26;
+	pair_sums.swap(n26);
+	aligned_vector<uint32_t> n27;
+	walk_cost.swap(n27);
+	aligned_vector<uint32_t> n20;
+	id.swap(n20);
+	std::vector<uint32_t> n21, n22, n23, n24, n25;
+	id_order.swap(n21);
+	sort_key.swap(n22);
+	sort_index.swap(n23);
+	sort_key_tmp.swap(n24);
+	sort_index_tmp.swap(n25);
+	accel_valid = false;
+	tracer_accel_valid = false;
 }
 
 
@@ -3,43 +3,576 @@
 
 #define _USE_MATH_DEFINES
 #include <vector>
+#include <string>
+#include <functional>
+#include <utility>
 #include <random>
 #include <cstdint>
 #include <Eigen/Core>
 
+#include "octree.hpp"
+#include "spatial_hash.hpp"
+#include "kernels.hpp"
+#include "soa.hpp"
+#include "task_pool.hpp"
+#include "array_view.hpp"
+#include "splitmix64.hpp"
+
+/**
+ * @brief Each body costs about 200 bytes with the default leapfrog and
+ * direct sum, most of it the double buffered x, v and a (144), see the
+ * README for what the other options add
+ */
 class physics
 {
 public:
+	/**
+	 * @brief The OpenMP loops use int indices
+	 */
+	constexpr static uint32_t max_obj_count = 0x7fffffff;
+
+	/**
+	 * @brief How the gravity on each body is found
+	 */
+	enum class force_method
+	{
+		/**
+		 * @brief All pairs, O(N^2), this is the reference
+		 */
+		direct,
+		/**
+		 * @brief Barnes-Hut octree, O(N log N), see set_theta()
+		 */
+		barnes_hut,
+		/**
+		 * @brief All pairs like direct but each pair once, applied to both
+		 * bodies (Newton's third law), half the arithmetic. The pairs are
+		 * done in cache sized tiles of bodies and every thread adds into its
+		 * own copy of the accelerations, which are summed at the end. Always
+		 * double, the kernel follows set_simd_isa().
+		 */
+		tiled
+	};
+
+	/**
+	 * @brief How step() advances the bodies
+	 */
+	enum class integrator
+	{
+		/**
+		 * @brief Kick drift kick leapfrog (velocity Verlet), symplectic and one
+		 * force evaluation per step
+		 */
+		leapfrog,
+		/**
+		 * @brief Classic 4th order Runge-Kutta, four force evaluations per step
+		 */
+		rk4,
+		/**
+		 * @brief 4th order Hermite predictor-corrector with individual power of
+		 * two block time steps, each step() is split into substeps and only the
+		 * bodies due at a substep have their forces found, always direct sum
+		 */
+		hermite
+	};
+
+	/**
+	 * @brief How init() places the bodies, all of them fill the distance range
+	 * and none of the bodies overlap
+	 */
+	enum class distribution
+	{
+		/**
+		 * @brief Uniform in the distance range cube, at rest
+		 */
+		uniform,
+		/**
+		 * @brief Plummer sphere in equilibrium, scale radius 1/8 of the range
+		 * and cut off at 4 scale radii
+		 */
+		plummer,
+		/**
+		 * @brief Thin disk in the x y plane with a uniform surface density on
+		 * circular orbits about the mass inside each radius
+		 */
+		disk
+	};
+
+	/**
+	 * @brief What step() does about bodies that overlap at the end of a step
+	 */
+	enum class collision_mode
+	{
+		/**
+		 * @brief Nothing, the bodies pass through each other
+		 */
+		none,
+		/**
+		 * @brief The overlapping pairs are found and counted only
+		 */
+		report,
+		/**
+		 * @brief Pairs that are moving towards each other bounce, momentum and
+		 * kinetic energy are kept
+		 */
+		elastic,
+		/**
+		 * @brief Overlapping bodies become one body with their total mass,
+		 * momentum and volume at their center of mass, the lowest index is
+		 * kept and the rest are removed so the body count drops
+		 */
+		merge
+	};
+
+	/**
+	 * @brief Conserved quantities of the state at one time
+	 */
+	struct diagnostics
+	{
+		double time;
+		/**
+		 * @brief Sum of m v^2 / 2
+		 */
+		double kinetic;
+		/**
+		 * @brief Half the sum of m phi from the same force pass as the
+		 * accelerations, so Barnes-Hut gives the tree's potential
+		 */
+		double potential;
+		/**
+		 * @brief Sum of m v
+		 */
+		Eigen::Vector3d momentum;
+		/**
+		 * @brief Sum of m x cross v about the origin
+		 */
+		Eigen::Vector3d angular_momentum;
+		double energy() const {return kinetic + potential;}
+	};
+
 	physics();
 	virtual ~physics();
 
-	void init(uint16_t obj_count);
+	/**
+	 * @brief Seeds the generator used by init(), otherwise it is seeded from
+	 * std::random_device
+	 */
+	void seed(uint64_t s);
+	/**
+	 * @brief Ranges used by init(), call these first
+	 */
+	void set_mass_range(double min, double max);
+	void set_radius_range(double min, double max);
+	/**
+	 * @brief Each position component is picked from [min, max)
+	 */
+	void set_distance_range(double min, double max);
+	void set_distribution(distribution d){dist = d;}
+	distribution get_distribution(){return dist;}
+	/**
+	 * @brief Massless tracers init() places after the bodies from the same
+	 * distribution, 0 (the default) for none. They feel the gravity of the
+	 * bodies but exert none, so a step costs one interaction per body per
+	 * tracer. They always use the double direct sum and kick drift kick,
+	 * whatever the force method, precision and integrator, never collide
+	 * and aren't saved in checkpoints.
+	 */
+	void set_tracer_count(uint32_t n){tracer_init_count = n;}
+	/**
+	 * @brief Tracers in the current state, none after load_checkpoint()
+	 */
+	uint32_t get_tracer_count() const {return tracer_count;}
+
+	/**
+	 * @brief Places obj_count bodies from the ranges and distribution
+	 * @return False with an error printed if they can't be placed without
+	 * overlaps, the state is then empty
+	 */
+	bool init(uint32_t obj_count);
+	/**
+	 * @brief Factor the last init() multiplied the radius range by to fit a
+	 * plummer sphere or a disk, 1 if they fit as given
+	 */
+	double get_radius_scale() const {return radius_scale;}
 	void deinit();
+	/**
+	 * @brief Writes the current state, time, G and softening to fname,
+	 * atomically so an interrupted write leaves the old file
+	 * @return False (with an error printed) if it couldn't be written
+	 */
+	bool save_checkpoint(const std::string &fname) const;
+	/**
+	 * @brief Replaces the state with a checkpoint from save_checkpoint(),
+	 * like init() but with the bodies, time, G and softening from the file
+	 * @return False (with an error printed) if it couldn't be read, the
+	 * state is then unchanged
+	 */
+	bool load_checkpoint(const std::string &fname);
 	void step(double delta_t);
-	uint16_t get_obj_count(){return obj_count;}
-	std::vector<Eigen::Vector3d> get_pos(){return x[current];}
-	std::vector<double> get_radii(){return r;}
+	uint32_t get_obj_count(){return obj_count;}
+	/**
+	 * @brief Views of the current state, they stay valid until the next
+	 * step(), init() or deinit() and must not be read while step() runs
+	 */
+	array_view<Eigen::Vector3d> get_pos_view() const
+	{
+		return array_view<Eigen::Vector3d>(x[current].data(), obj_count);
+	}
+	array_view<Eigen::Vector3d> get_vel_view() const
+	{
+		return array_view<Eigen::Vector3d>(v[current].data(), obj_count);
+	}
+	array_view<double> get_radii_view() const
+	{
+		return array_view<double>(r.data(), obj_count);
+	}
+	array_view<double> get_mass_view() const
+	{
+		return array_view<double>(m.data(), obj_count);
+	}
+	/**
+	 * @brief Stable id of each body in the other views, its index when
+	 * init() placed it (or the id in the checkpoint). Reordering moves the
+	 * bodies around the views and merging drops some, a body keeps its id.
+	 */
+	array_view<uint32_t> get_id_view() const
+	{
+		return array_view<uint32_t>(id.data(), obj_count);
+	}
+	/**
+	 * @brief Index into the other views of every body in ascending id order,
+	 * so the k-th entry is the same body every step until a merge removes
+	 * one, for output and rendering that need a fixed order
+	 */
+	array_view<uint32_t> get_id_order_view() const
+	{
+		return array_view<uint32_t>(id_order.data(), obj_count);
+	}
+	/**
+	 * @brief One component (0 to 2) of the tracer positions and velocities,
+	 * valid like the body views. Tracers never move around the views.
+	 */
+	array_view<double> get_tracer_pos_view(int axis) const
+	{
+		const aligned_vector<double> &c = axis == 0 ? tracers.x :
+			axis == 1 ? tracers.y : tracers.z;
+		return array_view<double>(c.data(), tracer_count);
+	}
+	array_view<double> get_tracer_vel_view(int axis) const
+	{
+		const aligned_vector<double> &c = axis == 0 ? tracers.vx :
+			axis == 1 ? tracers.vy : tracers.vz;
+		return array_view<double>(c.data(), tracer_count);
+	}
+	/**
+	 * @brief Goes up by one every time the state changes (init() and every
+	 * step()) so consumers can tell if what they converted is stale
+	 */
+	uint64_t get_epoch() const {return epoch;}
+	double get_total_time() const {return total_time;}
+	/**
+	 * @brief Called on the stepping thread at the end of every step() with
+	 * the new state current, it can read or convert the state in place with
+	 * the views, pass an empty function to remove it
+	 */
+	void set_step_callback(std::function<void(const physics &)> callback)
+	{
+		step_callback = callback;
+	}
+	void set_integrator(integrator i){integ = i; accel_valid = false;}
+	integrator get_integrator(){return integ;}
+	void set_force_method(force_method f){method = f; accel_valid = false;}
+	force_method get_force_method(){return method;}
+	/**
+	 * @brief Sets the Barnes-Hut opening angle
+	 */
+	void set_theta(double theta){tree.set_theta(theta);}
+	double get_theta(){return tree.get_theta();}
+	/**
+	 * @brief Reorders every per body array along a Morton curve at the start
+	 * of a step once more than this fraction of a sample of neighbouring
+	 * bodies are out of Morton order, 0 for never, 0.1 by default.
+	 *
+	 * Bodies close in space are then close in memory, which the tree build
+	 * and walks and the collision grid run faster on. The direct sum goes
+	 * over every pair whatever the order so it only happens with Barnes-Hut
+	 * (not Hermite, which is always direct) or collisions on.
+	 */
+	void set_reorder_threshold(double t){reorder_threshold = t;}
+	double get_reorder_threshold(){return reorder_threshold;}
+	/**
+	 * @brief Reorders since init() or load_checkpoint()
+	 */
+	uint32_t get_reorder_count(){return reorder_count;}
+	/**
+	 * @brief Spreads the pages of the direct and tiled sum sources over the
+	 * NUMA nodes, off by default. Every thread reads all the sources, so on
+	 * more than one node this uses every node's bandwidth instead of the one
+	 * the sources were packed on. It takes effect the next time they are
+	 * allocated (init() or load_checkpoint() with more bodies than before)
+	 * and does nothing on one node or without libnuma.
+	 *
+	 * The per body arrays are always placed by first touch, each thread's
+	 * part on its node, see pin_threads() to keep the threads there.
+	 */
+	void set_interleave(bool i){interleave = i;}
+	bool get_interleave(){return interleave;}
+	/**
+	 * @brief Picks the direct sum kernel, the detected best is used by default
+	 * and anything the CPU can't run falls back to it
+	 */
+	void set_simd_isa(simd_isa isa);
+	simd_isa get_simd_isa(){return isa;}
+	/**
+	 * @brief Picks the precision the direct sum runs in, fp64 by default.
+	 * Barnes-Hut and Hermite always run in double.
+	 */
+	void set_precision(precision prec);
+	precision get_precision(){return prec;}
+	/**
+	 * @brief Plummer softening length, forces use r^2 + eps^2 in place of r^2,
+	 * 0 (the default) for none
+	 */
+	void set_softening(double eps);
+	double get_softening(){return softening;}
+	/**
+	 * @brief The gravitational constant, SI by default, 1 for N-body units
+	 * picks kernels that don't scale by it at all
+	 */
+	void set_G(double G);
+	double get_G(){return G;}
+	/**
+	 * @brief Total kinetic plus potential energy of the current state, an
+	 * O(N^2) double precision sum
+	 */
+	double get_energy();
+	/**
+	 * @brief Samples the conserved quantities every this many steps, 0 (the
+	 * default) for never. The force pass of a sampled step also sums the
+	 * potential, every other step runs exactly as without diagnostics.
+	 *
+	 * Leapfrog samples the state at the end of the step and RK4 at the start,
+	 * its only force pass at a whole step. Hermite samples the end of the
+	 * step with the potential from the predicted positions of the last block.
+	 * All of them sample before collisions are resolved.
+	 */
+	void set_diagnostics_interval(uint32_t steps){diag_interval = steps;}
+	uint32_t get_diagnostics_interval(){return diag_interval;}
+	/**
+	 * @brief Every sample since init(), load_checkpoint() or
+	 * clear_diagnostics(), in step order
+	 */
+	array_view<diagnostics> get_diagnostics() const
+	{
+		return array_view<diagnostics>(diag.data(), diag.size());
+	}
+	void clear_diagnostics(){diag.clear();}
+	/**
+	 * @brief Pairwise interactions evaluated since init(), Barnes-Hut counts
+	 * an accepted node as one interaction and every body on every tracer is
+	 * one
+	 */
+	uint64_t get_interactions(){return interactions;}
+	/**
+	 * @brief Hermite time step accuracy parameter (Aarseth criterion)
+	 */
+	void set_hermite_eta(double eta){hermite_eta = eta;}
+	/**
+	 * @brief The smallest Hermite block step is delta_t / 2^level
+	 */
+	void set_max_block_level(uint8_t level);
+	void set_collision_mode(collision_mode c){collisions = c;}
+	collision_mode get_collision_mode(){return collisions;}
+	/**
+	 * @brief Overlapping pairs (i < j) found by the last step, with the
+	 * indices from before any merge
+	 */
+	array_view<std::pair<uint32_t, uint32_t>> get_collision_pairs() const
+	{
+		return array_view<std::pair<uint32_t, uint32_t>>(
+			collision_pairs.data(), collision_pairs.size());
+	}
+	/**
+	 * @brief Overlapping pairs found since init()
+	 */
+	uint64_t get_collision_count(){return collision_count;}
+
+	static const char *integrator_name(integrator i);
+	static bool parse_integrator(const std::string &name, integrator &i);
+	static const char *force_method_name(force_method f);
+	static bool parse_force_method(const std::string &name, force_method &f);
+	static const char *distribution_name(distribution d);
+	static bool parse_distribution(const std::string &name, distribution &d);
+	static const char *collision_mode_name(collision_mode c);
+	static bool parse_collision_mode(const std::string &name,
+		collision_mode &c);
 
 private:
+	void step_leapfrog(double delta_t);
+	void step_rk4(double delta_t);
+	void step_hermite(double delta_t);
+
+	/**
+	 * @brief Sets up the sources for accel_jerk() with every body predicted
+	 * to the given tick, the state of body i is at tick t_tick[i]
+	 */
+	void hermite_predict(uint64_t tick, double tick_dt);
+	/**
+	 * @brief Picks a block level for a time step, levels only ever get coarser
+	 * by one at a time and only when the tick lines up with the coarser block
+	 */
+	uint8_t block_level(double dt, double delta_t, uint8_t level,
+		uint64_t tick);
+
+	/**
+	 * @brief Finds the acceleration on every body with all of them at pos
+	 * @param pos Positions of all bodies
+	 * @param acc The accelerations are written here
+	 * @param potential Also find the potential of every body in phi
+	 */
+	void accel_all(const std::vector<Eigen::Vector3d> &pos,
+		std::vector<Eigen::Vector3d> &acc, bool potential = false);
 	/**
-	 * @brief Finds acceleration due to gravity
-	 * @param x_i Position
-	 * @param skip_index The index of the object that acceleration is calc
-	 * @return The acceleration vector
+	 * @brief Appends a diagnostics sample of pos and vel at time with the
+	 * potential in phi
 	 */
-	Eigen::Vector3d accel(Eigen::Vector3d x_i, uint16_t skip_index);
+	void sample_diagnostics(const std::vector<Eigen::Vector3d> &pos,
+		const std::vector<Eigen::Vector3d> &vel, double time);
+
+	/**
+	 * @brief Sorts the bodies by their Morton key in the bounding cube of
+	 * x[current] if a sample of them is out of order past the threshold,
+	 * x[next], v[next] and a[next] are the scratch
+	 */
+	void reorder();
+	/**
+	 * @brief Rebuilds id_order from id
+	 */
+	void update_id_order();
+
+	/**
+	 * @brief Bodies sorted by their level 10 octree cell, finer than that
+	 * hardly changes the locality
+	 */
+	constexpr static uint32_t reorder_level = 10;
+	/**
+	 * @brief Neighbouring pairs the locality check looks at
+	 */
+	constexpr static uint32_t reorder_samples = 4096;
+
+	/**
+	 * @brief Picks the kernel instantiations for the isa, precision,
+	 * softening and G, the kernels themselves never test any of them
+	 */
+	void select_kernels();
+	/**
+	 * @brief Sizes s for obj_count bodies, interleaving what is newly
+	 * allocated when that is on
+	 */
+	template<typename soa_t>
+	void resize_sources(soa_t &s);
+	/**
+	 * @brief Sizes phi for obj_count bodies and zeroes it in parallel, so it
+	 * is placed like the other per body arrays
+	 */
+	void zero_phi();
+
+	/**
+	 * @brief Picks a position and velocity from the distribution
+	 * @param total_mass Total mass of all bodies
+	 */
+	void place(splitmix64 &rng, double total_mass, Eigen::Vector3d &pos,
+		Eigen::Vector3d &vel);
+	/**
+	 * @brief Sizes the tracers for tracer_init_count and places them, each
+	 * from its own stream of base
+	 */
+	void place_tracers(uint64_t base, double total_mass);
+
+	/**
+	 * @brief Rounds of moving the overlapping bodies init() does before it
+	 * gives up
+	 */
+	const static uint32_t max_place_rounds = 64;
+	/**
+	 * @brief Largest fraction of the space the bodies may fill where they
+	 * are densest, well below where random placement jams
+	 */
+	constexpr static double max_fill = 0.1;
+	/**
+	 * @brief Factor for the radius range that keeps obj_count bodies under
+	 * max_fill, 0 if the uniform cube is too full
+	 */
+	double fill_radius_scale(uint32_t obj_count) const;
+
+	/**
+	 * @brief Finds the overlapping pairs in x[next] and responds to them
+	 */
+	void collide();
+	void bounce();
+	void merge();
+
+	/**
+	 * @brief Packs pos and m into s then runs kernel k over it for every body
+	 * @param phi Potentials are written here if not null, k must be a
+	 * potential instantiation then
+	 */
+	template<typename soa_t, typename kernel_t>
+	void direct_all(soa_t &s, kernel_t k,
+		const std::vector<Eigen::Vector3d> &pos,
+		std::vector<Eigen::Vector3d> &acc, double *phi);
+	/**
+	 * @brief Copies pos and m into the sources s
+	 */
+	template<typename soa_t>
+	void pack_sources(soa_t &s, const std::vector<Eigen::Vector3d> &pos);
+	/**
+	 * @brief force_method::tiled over the double sources, phi as for
+	 * direct_all()
+	 */
+	void tiled_all(const std::vector<Eigen::Vector3d> &pos,
+		std::vector<Eigen::Vector3d> &acc, double *phi);
+
+	/**
+	 * @brief Finds every tracer's acceleration from the bodies at pos
+	 */
+	void tracer_accel(const std::vector<Eigen::Vector3d> &pos);
+	/**
+	 * @brief Kick drift kick for every tracer, with the bodies at the start
+	 * of the step in the tracer accelerations and at the end in x[next]
+	 */
+	void step_tracers(double delta_t);
+
+	/**
+	 * @brief Tracers per chunk of the tracer loops, a chunk goes through the
+	 * kick, drift, force and kick in one pass while it is in cache
+	 */
+	constexpr static uint32_t tracer_chunk = 1024;
+
+	/**
+	 * @brief Bodies per tile side for force_method::tiled, the sources of
+	 * two tiles and the sums of one are 24 KB so they stay in L1 while the
+	 * rows of a tile run
+	 */
+	constexpr static uint32_t pair_tile = 256;
 
 	/**
 	 * @brief Current and next indicies
 	 */
-	uint16_t current, next;
-	uint16_t obj_count;
+	uint8_t current, next;
+	uint32_t obj_count;
 	double total_time;
+	uint64_t epoch;
+	std::function<void(const physics &)> step_callback;
 	double mass_range[2];
 	double radius_range[2];
+	double radius_scale;
 	double distance_range[2];
+	distribution dist;
 	/**
-	 * @brief Position (x1, x2, x3), two vectors for new and old
+	 * @brief Position (x1, x2, x3), two vectors for new and old. Eigen leaves
+	 * a new Vector3d uninitialized, so like the aligned_vector members these
+	 * get their pages from the first parallel loop that writes them.
 	 */
 	std::vector<Eigen::Vector3d> x[2];
 	/**
@@ -53,16 +586,142 @@ private:
 	/**
 	 * @brief Ocject radii
 	 */
-	std::vector<double> r;
+	aligned_vector<double> r;
 	/**
 	 * @brief Object mass
 	 */
-	std::vector<double> m;
+	aligned_vector<double> m;
+	/**
+	 * @brief Stable id of every body and the index of every body in id order
+	 */
+	aligned_vector<uint32_t> id;
+	std::vector<uint32_t> id_order;
+	double reorder_threshold;
+	uint32_t reorder_count;
+	/**
+	 * @brief Radix sort keys and indices for reorder() and update_id_order()
+	 */
+	std::vector<uint32_t> sort_key, sort_index, sort_key_tmp, sort_index_tmp;
 	/**
-	 * @brief A random generator that is initialized in the constructor
+	 * @brief A random generator that is initialized in the constructor, init()
+	 * only takes a base seed for the per body streams from it
 	 */
 	std::mt19937_64 generator;
 
+	force_method method;
+	integrator integ;
+	/**
+	 * @brief True when a[current] is the acceleration at x[current]
+	 */
+	bool accel_valid;
+	/**
+	 * @brief RK4 stage positions, velocities and weighted sums
+	 */
+	std::vector<Eigen::Vector3d> rk_x, rk_v, rk_dx, rk_dv;
+	/**
+	 * @brief Hermite jerk, block level and the tick (in units of the smallest
+	 * block) each body has been advanced to within the current step
+	 */
+	std::vector<Eigen::Vector3d> jerk;
+	std::vector<uint8_t> level;
+	std::vector<uint64_t> t_tick;
+	std::vector<uint32_t> active;
+	double hermite_eta;
+	uint64_t interactions;
+	uint8_t max_block_level;
+	/**
+	 * @brief Rebuilt from the positions forces are found at when using
+	 * Barnes-Hut
+	 */
+	octree tree;
+	/**
+	 * @brief Interactions each body's last Barnes-Hut walk took, what the
+	 * next walk's chunks are cut by, empty until there has been one
+	 */
+	aligned_vector<uint32_t> walk_cost;
+	/**
+	 * @brief Hands out the Barnes-Hut walks and Hermite blocks
+	 */
+	task_pool pool;
+	/**
+	 * @brief Source positions and masses for the direct sum kernel, packed
+	 * from the positions forces are found at
+	 */
+	body_soa src;
+	/**
+	 * @brief Float sources for precision::fp32 and precision::mixed, only
+	 * allocated when one of them is used
+	 */
+	body_soa_f src_f;
+	bool interleave;
+	simd_isa isa;
+	precision prec;
+	double softening;
+	accel_kernel kernel;
+	accel_kernel_f kernel_f;
+	jerk_kernel jerk_k;
+	pair_kernel pair_k;
+	/**
+	 * @brief The same kernels that also sum the potential, only used on the
+	 * steps diagnostics are sampled
+	 */
+	accel_kernel kernel_pot;
+	accel_kernel_f kernel_f_pot;
+	jerk_kernel jerk_k_pot;
+	pair_kernel pair_k_pot;
+	tracer_kernel tracer_k;
+
+	/**
+	 * @brief Tracers the next init() places and the tracers in the state
+	 */
+	uint32_t tracer_init_count;
+	uint32_t tracer_count;
+	tracer_soa tracers;
+	/**
+	 * @brief True when the tracer accelerations are from the bodies at
+	 * x[current]
+	 */
+	bool tracer_accel_valid;
+	/**
+	 * @brief One thread's sums for force_method::tiled, every thread has all
+	 * the bodies
+	 */
+	struct pair_sum
+	{
+		aligned_vector<double> ax, ay, az;
+		/**
+		 * @brief Only sized on the steps the potential is summed
+		 */
+		aligned_vector<double> phi;
+	};
+	std::vector<pair_sum> pair_sums;
+
+	uint32_t diag_interval;
+	/**
+	 * @brief Steps since init() or load_checkpoint(), for the interval
+	 */
+	uint64_t diag_step;
+	/**
+	 * @brief True while a step that is sampled runs
+	 */
+	bool diag_sampling;
+	/**
+	 * @brief Potential per unit mass of every body from the last force pass
+	 * that summed it
+	 */
+	aligned_vector<double> phi;
+	std::vector<diagnostics> diag;
+
+	collision_mode collisions;
+	spatial_hash hash;
+	std::vector<std::pair<uint32_t, uint32_t>> collision_pairs;
+	uint64_t collision_count;
+	/**
+	 * @brief Union-find parents for merge(), every body ends up pointing to
+	 * the lowest index it touches
+	 */
+	std::vector<uint32_t> merge_root;
+
 	double G = 6.67408e-11;
 };
 
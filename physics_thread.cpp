@@ -0,0 +1,110 @@
+#include "physics_thread.hpp"
+
+#include <chrono>
+#include <omp.h>
+
+#include "physics.hpp"
+#include "profiler.hpp"
+
+physics_thread::physics_thread(physics *p)
+{
+	this->p = p;
+	running = false;
+	fixed_delta_t = 0.0;
+	steps_per_second = 0.0;
+	thread_count = 0;
+}
+
+physics_thread::~physics_thread()
+{
+	stop();
+}
+
+void physics_thread::start(int thread_count)
+{
+	if(running)
+		return;
+
+	this->thread_count = thread_count;
+	// so the renderer has the initial state before the first step is done
+	publish();
+	// then every step publishes from its own tail
+	p->set_step_callback([this](const physics &){publish();});
+
+	running = true;
+	thread = std::thread(&physics_thread::run, this);
+}
+
+void physics_thread::stop()
+{
+	running = false;
+	if(thread.joinable())
+		thread.join();
+	p->set_step_callback(nullptr);
+}
+
+void physics_thread::run()
+{
+	if(profiler::enabled())
+		profiler::set_thread_name("physics");
+	// OpenMP settings are per thread so this only changes the physics team
+	if(thread_count > 0)
+		omp_set_num_threads(thread_count);
+
+	typedef std::chrono::steady_clock clock;
+	clock::time_point last = clock::now();
+	clock::time_point rate_start = last;
+	uint64_t rate_steps = 0;
+
+	while(running)
+	{
+		clock::time_point now = clock::now();
+		double delta_t = fixed_delta_t;
+		if(delta_t <= 0.0)
+			delta_t = std::chrono::duration<double>(now - last).count();
+		last = now;
+
+		p->step(delta_t);
+
+		rate_steps++;
+		double elapsed = std::chrono::duration<double>(clock::now() -
+			rate_start).count();
+		if(elapsed >= 1.0)
+		{
+			steps_per_second = rate_steps / elapsed;
+			rate_steps = 0;
+			rate_start = clock::now();
+		}
+	}
+}
+
+void physics_thread::publish()
+{
+	// gather straight from the physics buffers in id order so a body keeps
+	// its place in the snapshot when physics reorders, the snapshot vectors
+	// keep their capacity so this doesn't allocate once they are big enough
+	profile_scope scope(profile_phase::convert);
+	physics_snapshot &s = buffers.write_buffer();
+	array_view<Eigen::Vector3d> pos = p->get_pos_view();
+	array_view<uint32_t> order = p->get_id_order_view();
+	s.x.resize(order.size());
+	for(size_t k = 0; k < order.size(); k++)
+		s.x[k] = pos[order[k]];
+	// tracers never move around so they need no order, but there can be
+	// millions of them so the physics team converts them
+	array_view<double> tx = p->get_tracer_pos_view(0);
+	array_view<double> ty = p->get_tracer_pos_view(1);
+	array_view<double> tz = p->get_tracer_pos_view(2);
+	s.tracers.resize(3 * tx.size());
+	float *t = s.tracers.data();
+	#pragma omp parallel for
+	for(int k = 0; k < (int)tx.size(); k++)
+	{
+		t[k * 3] = (float)tx[k];
+		t[k * 3 + 1] = (float)ty[k];
+		t[k * 3 + 2] = (float)tz[k];
+	}
+	s.total_time = p->get_total_time();
+	s.epoch = p->get_epoch();
+	buffers.publish();
+}
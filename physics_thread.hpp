@@ -0,0 +1,82 @@
+#ifndef PHYSICS_THREAD_HPP
+#define PHYSICS_THREAD_HPP
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+#include <Eigen/Core>
+
+#include "triple_buffer.hpp"
+
+class physics;
+
+/**
+ * @brief A finished physics state as seen by the renderer
+ */
+struct physics_snapshot
+{
+	std::vector<Eigen::Vector3d> x;
+	/**
+	 * @brief Tracer positions as packed x, y, z floats, already what the
+	 * vertex buffer takes so the render thread only copies them
+	 */
+	std::vector<float> tracers;
+	double total_time = 0.0;
+	/**
+	 * @brief physics::get_epoch() of the state
+	 */
+	uint64_t epoch = 0;
+};
+
+/**
+ * @brief Runs physics::step() on its own thread (and its own OpenMP team) as
+ * fast as it can and publishes each finished state through a triple buffer
+ */
+class physics_thread
+{
+public:
+	/**
+	 * @param p An initialized physics, the thread owns it while running
+	 */
+	physics_thread(physics *p);
+	virtual ~physics_thread();
+
+	/**
+	 * @brief Starts stepping
+	 * @param thread_count OpenMP threads for the physics, 0 for the default
+	 */
+	void start(int thread_count = 0);
+	void stop();
+
+	/**
+	 * @brief Picks up the newest finished state, never blocks
+	 * @return True if get_snapshot() changed
+	 */
+	bool update(){return buffers.update();}
+	const physics_snapshot &get_snapshot(){return buffers.read_buffer();}
+
+	/**
+	 * @brief Step with a fixed delta_t, 0 (the default) uses the wall clock
+	 * time since the last step
+	 */
+	void set_fixed_delta_t(double dt){fixed_delta_t = dt;}
+	/**
+	 * @brief Steps per second averaged over roughly the last second
+	 */
+	double get_steps_per_second(){return steps_per_second.load();}
+
+private:
+	void run();
+	void publish();
+
+	physics *p;
+	std::thread thread;
+	std::atomic<bool> running;
+	std::atomic<double> fixed_delta_t;
+	std::atomic<double> steps_per_second;
+	int thread_count;
+	triple_buffer<physics_snapshot> buffers;
+};
+
+#endif
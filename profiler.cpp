@@ -0,0 +1,324 @@
+#include "profiler.hpp"
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <omp.h>
+
+std::atomic<bool> profiler::enabled_flag(false);
+std::atomic<bool> profiler::tracing_flag(false);
+
+struct profile_event
+{
+	uint64_t start;
+	uint64_t end;
+	profile_phase phase;
+};
+
+/**
+ * @brief Durations are counted in buckets of 1/16 of a power of two, exact
+ * below 16 ns
+ */
+const int bucket_bits = 4;
+const uint32_t bucket_count = (64 - bucket_bits + 1) << bucket_bits;
+
+static uint32_t bucket_of(uint64_t d)
+{
+	if(d < (1u << bucket_bits))
+		return (uint32_t)d;
+	int e = 63 - __builtin_clzll(d);
+	return ((uint32_t)(e - bucket_bits + 1) << bucket_bits) +
+		(uint32_t)((d >> (e - bucket_bits)) & ((1u << bucket_bits) - 1));
+}
+
+/**
+ * @brief Middle of the durations in bucket b
+ */
+static double bucket_middle(uint32_t b)
+{
+	if(b < (1u << bucket_bits))
+		return (double)b;
+	int shift = (int)(b >> bucket_bits) - 1;
+	uint64_t low = (uint64_t)((1u << bucket_bits) +
+		(b & ((1u << bucket_bits) - 1))) << shift;
+	return (double)low + 0.5 * (double)((uint64_t)1 << shift);
+}
+
+/**
+ * @brief One phase on one thread, the buckets are only allocated once the
+ * phase is first recorded
+ */
+struct phase_stats
+{
+	uint64_t count = 0;
+	uint64_t total = 0;
+	uint64_t max = 0;
+	std::vector<uint64_t> buckets;
+};
+
+struct thread_events
+{
+	uint32_t id;
+	std::string name;
+	phase_stats phases[(int)profile_phase::count];
+	/**
+	 * @brief The last trace_capacity events while tracing, traced counts
+	 * every event that went into it
+	 */
+	std::vector<profile_event> ring;
+	uint64_t traced = 0;
+};
+
+/**
+ * @brief Every thread that has recorded anything, kept after the thread
+ * is gone so its events can still be reported
+ */
+struct thread_registry
+{
+	std::mutex lock;
+	std::vector<std::unique_ptr<thread_events>> threads;
+	std::chrono::steady_clock::time_point origin =
+		std::chrono::steady_clock::now();
+};
+
+static thread_registry &registry()
+{
+	static thread_registry r;
+	return r;
+}
+
+static thread_local thread_events *own_events = nullptr;
+
+static thread_events &own()
+{
+	if(own_events == nullptr)
+	{
+		thread_registry &r = registry();
+		std::lock_guard<std::mutex> guard(r.lock);
+		r.threads.emplace_back(new thread_events());
+		own_events = r.threads.back().get();
+		own_events->id = (uint32_t)r.threads.size();
+		own_events->name = std::to_string(own_events->id) + ":omp" +
+			std::to_string(omp_get_thread_num());
+	}
+	return *own_events;
+}
+
+static double percentile(const std::vector<uint64_t> &buckets,
+	uint64_t count, uint64_t max, double p)
+{
+	uint64_t k = (uint64_t)(p * (double)(count - 1) + 0.5);
+	uint64_t seen = 0;
+	for(uint32_t b = 0; b < bucket_count; b++)
+	{
+		seen += buckets[b];
+		if(seen > k)
+			return std::min(bucket_middle(b), (double)max);
+	}
+	return (double)max;
+}
+
+const char *profile_phase_name(profile_phase p)
+{
+	switch(p)
+	{
+		case profile_phase::step:
+			return "step";
+		case profile_phase::tree_build:
+			return "tree_build";
+		case profile_phase::grid_build:
+			return "grid_build";
+		case profile_phase::pack:
+			return "pack";
+		case profile_phase::force:
+			return "force";
+		case profile_phase::integrate:
+			return "integrate";
+		case profile_phase::collide:
+			return "collide";
+		case profile_phase::convert:
+			return "convert";
+		case profile_phase::upload:
+			return "upload";
+		case profile_phase::draw:
+			return "draw";
+		case profile_phase::swap:
+			return "swap";
+		case profile_phase::exchange:
+			return "exchange";
+		case profile_phase::reorder:
+			return "reorder";
+		case profile_phase::tracers:
+			return "tracers";
+		default:
+			return "unknown";
+	}
+}
+
+uint64_t profiler::now()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - registry().origin).count() + 1;
+}
+
+void profiler::record(profile_phase p, uint64_t start, uint64_t end)
+{
+	thread_events &t = own();
+	uint64_t d = end - start;
+	phase_stats &s = t.phases[(int)p];
+	if(s.buckets.empty())
+		s.buckets.assign(bucket_count, 0);
+	s.count++;
+	s.total += d;
+	s.max = std::max(s.max, d);
+	s.buckets[bucket_of(d)]++;
+
+	if(!tracing())
+		return;
+	profile_event e;
+	e.start = start;
+	e.end = end;
+	e.phase = p;
+	if(t.ring.size() < trace_capacity)
+		t.ring.push_back(e);
+	else
+		t.ring[t.traced % trace_capacity] = e;
+	t.traced++;
+}
+
+void profiler::set_thread_name(const std::string &name)
+{
+	own().name = name;
+}
+
+void profiler::reset()
+{
+	thread_registry &r = registry();
+	std::lock_guard<std::mutex> guard(r.lock);
+	for(std::unique_ptr<thread_events> &t : r.threads)
+	{
+		for(phase_stats &s : t->phases)
+			s = phase_stats();
+		t->ring.clear();
+		t->traced = 0;
+	}
+}
+
+void profiler::report(FILE *out)
+{
+	thread_registry &r = registry();
+	std::lock_guard<std::mutex> guard(r.lock);
+	const int phase_count = (int)profile_phase::count;
+
+	fprintf(out, "%-11s %9s %12s %11s %11s %11s %11s\n", "phase", "count",
+		"total ms", "p50 us", "p90 us", "p99 us", "max us");
+	std::vector<uint64_t> buckets(bucket_count);
+	for(int p = 0; p < phase_count; p++)
+	{
+		uint64_t count = 0, total = 0, max = 0;
+		std::fill(buckets.begin(), buckets.end(), 0);
+		for(std::unique_ptr<thread_events> &t : r.threads)
+		{
+			const phase_stats &s = t->phases[p];
+			if(s.count == 0)
+				continue;
+			count += s.count;
+			total += s.total;
+			max = std::max(max, s.max);
+			for(uint32_t b = 0; b < bucket_count; b++)
+				buckets[b] += s.buckets[b];
+		}
+		if(count == 0)
+			continue;
+		fprintf(out, "%-11s %9llu %12.3f %11.1f %11.1f %11.1f %11.1f\n",
+			profile_phase_name((profile_phase)p), (unsigned long long)count,
+			(double)total * 1e-6,
+			percentile(buckets, count, max, 0.5) * 1e-3,
+			percentile(buckets, count, max, 0.9) * 1e-3,
+			percentile(buckets, count, max, 0.99) * 1e-3,
+			(double)max * 1e-3);
+	}
+
+	// the same phase summed per thread, a slow thread in a parallel phase
+	// is time every other thread spends waiting at the barrier
+	fprintf(out, "\nms per thread:\n%-11s", "phase");
+	for(std::unique_ptr<thread_events> &t : r.threads)
+		fprintf(out, " %10s", t->name.c_str());
+	fprintf(out, " %10s\n", "max/mean");
+	for(int p = 0; p < phase_count; p++)
+	{
+		std::vector<double> per_thread(r.threads.size(), 0.0);
+		bool any = false;
+		for(size_t k = 0; k < r.threads.size(); k++)
+		{
+			const phase_stats &s = r.threads[k]->phases[p];
+			if(s.count == 0)
+				continue;
+			per_thread[k] = (double)s.total * 1e-6;
+			any = true;
+		}
+		if(!any)
+			continue;
+		double sum = 0.0, max = 0.0;
+		int used = 0;
+		fprintf(out, "%-11s", profile_phase_name((profile_phase)p));
+		for(double v : per_thread)
+		{
+			fprintf(out, " %10.3f", v);
+			if(v > 0.0)
+			{
+				sum += v;
+				max = std::max(max, v);
+				used++;
+			}
+		}
+		fprintf(out, " %10.3f\n", max / (sum / used));
+	}
+}
+
+bool profiler::write_chrome_trace(const std::string &fname)
+{
+	FILE *f = fopen(fname.c_str(), "w");
+	if(f == NULL)
+	{
+		printf("ERROR couldn't open %s\n", fname.c_str());
+		return false;
+	}
+
+	thread_registry &r = registry();
+	std::lock_guard<std::mutex> guard(r.lock);
+	fprintf(f, "{\"traceEvents\":[\n");
+	bool first = true;
+	uint64_t dropped = 0;
+	for(std::unique_ptr<thread_events> &t : r.threads)
+	{
+		dropped += t->traced - t->ring.size();
+		fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+			"\"tid\":%u,\"args\":{\"name\":\"%s\"}}", first ? "" : ",\n", t->id,
+			t->name.c_str());
+		first = false;
+		// complete events in microseconds
+		for(const profile_event &e : t->ring)
+		{
+			fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+				"\"ts\":%.3f,\"dur\":%.3f}", profile_phase_name(e.phase), t->id,
+				e.start * 1e-3, (e.end - e.start) * 1e-3);
+		}
+	}
+	fprintf(f, "\n]}\n");
+
+	if(fclose(f) != 0)
+	{
+		printf("ERROR couldn't write %s\n", fname.c_str());
+		return false;
+	}
+	if(dropped != 0)
+	{
+		printf("note: %s keeps the last %u scopes of each thread, %llu "
+			"earlier ones were dropped\n", fname.c_str(), trace_capacity,
+			(unsigned long long)dropped);
+	}
+	return true;
+}
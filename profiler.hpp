@@ -0,0 +1,117 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include <string>
+#include <atomic>
+#include <cstdio>
+#include <cstdint>
+
+/**
+ * @brief The phases that are timed, each scope is one of these
+ */
+enum class profile_phase : uint8_t
+{
+	step,
+	tree_build,
+	grid_build,
+	pack,
+	force,
+	integrate,
+	collide,
+	convert,
+	upload,
+	draw,
+	swap,
+	exchange,
+	reorder,
+	tracers,
+	count
+};
+
+const char *profile_phase_name(profile_phase p);
+
+/**
+ * @brief Collects timed scopes from every thread, off until set_enabled().
+ *
+ * Every thread adds its scopes to its own per phase histograms, so
+ * recording never takes a lock after a thread's first scope and the memory
+ * doesn't grow with the run. The scopes themselves are only kept while
+ * tracing, in a fixed size ring per thread. report() and
+ * write_chrome_trace() read every thread's data and must only be called
+ * while nothing is being timed.
+ */
+class profiler
+{
+public:
+	static void set_enabled(bool on){enabled_flag.store(on,
+		std::memory_order_relaxed);}
+	static bool enabled(){return enabled_flag.load(std::memory_order_relaxed);}
+	/**
+	 * @brief Also keeps the last trace_capacity scopes of every thread for
+	 * write_chrome_trace(), older ones are dropped and counted
+	 */
+	static void set_tracing(bool on){tracing_flag.store(on,
+		std::memory_order_relaxed);}
+	static bool tracing(){return tracing_flag.load(std::memory_order_relaxed);}
+	const static uint32_t trace_capacity = 1 << 18;
+
+	/**
+	 * @brief Nanoseconds since the profiler was first used, never 0
+	 */
+	static uint64_t now();
+	static void record(profile_phase p, uint64_t start, uint64_t end);
+	/**
+	 * @brief Names the calling thread in the report and trace, threads are
+	 * named after their OpenMP thread number otherwise
+	 */
+	static void set_thread_name(const std::string &name);
+	/**
+	 * @brief Drops everything recorded so far
+	 */
+	static void reset();
+
+	/**
+	 * @brief Prints count, total and the 50th, 90th, 99th percentile (to
+	 * about 3%) and max time of every phase, then the total of each phase on each thread to
+	 * show how even the work was
+	 */
+	static void report(FILE *out);
+	/**
+	 * @brief Writes the scopes kept while tracing as Chrome trace event
+	 * JSON, for chrome://tracing or ui.perfetto.dev, with a note if any were
+	 * dropped
+	 * @return False (with an error printed) if it couldn't be written
+	 */
+	static bool write_chrome_trace(const std::string &fname);
+
+private:
+	static std::atomic<bool> enabled_flag;
+	static std::atomic<bool> tracing_flag;
+};
+
+/**
+ * @brief Times from construction to destruction as one phase if the
+ * profiler is enabled, otherwise costs a load and a branch
+ */
+class profile_scope
+{
+public:
+	profile_scope(profile_phase p) : phase(p)
+	{
+		start = profiler::enabled() ? profiler::now() : 0;
+	}
+	~profile_scope()
+	{
+		if(start != 0)
+			profiler::record(phase, start, profiler::now());
+	}
+
+private:
+	profile_scope(const profile_scope &) = delete;
+	profile_scope &operator=(const profile_scope &) = delete;
+
+	profile_phase phase;
+	uint64_t start;
+};
+
+#endif
@@ -0,0 +1,57 @@
+#include "radix_sort.hpp"
+
+#include <omp.h>
+#include <algorithm>
+#include <cstddef>
+
+void radix_sort(std::vector<uint32_t> &key, std::vector<uint32_t> &index,
+	std::vector<uint32_t> &key_tmp, std::vector<uint32_t> &index_tmp,
+	uint32_t key_bits)
+{
+	const size_t n = key.size();
+	key_tmp.resize(n);
+	index_tmp.resize(n);
+
+	// one row of 256 counts per thread, the team may be smaller than asked
+	// for so the row count is taken from the team itself
+	std::vector<size_t> count((size_t)omp_get_max_threads() * 256);
+	for(uint32_t shift = 0; shift < key_bits; shift += 8)
+	{
+		#pragma omp parallel
+		{
+			const int t = omp_get_thread_num();
+			const int threads = omp_get_num_threads();
+			const size_t begin = n * t / threads;
+			const size_t end = n * (t + 1) / threads;
+			size_t *c = &count[(size_t)t * 256];
+
+			std::fill(c, c + 256, 0);
+			for(size_t i = begin; i < end; i++)
+				c[(key[i] >> shift) & 0xff]++;
+
+			#pragma omp barrier
+			#pragma omp single
+			{
+				size_t sum = 0;
+				for(int d = 0; d < 256; d++)
+				{
+					for(int u = 0; u < threads; u++)
+					{
+						size_t k = count[(size_t)u * 256 + d];
+						count[(size_t)u * 256 + d] = sum;
+						sum += k;
+					}
+				}
+			}
+
+			for(size_t i = begin; i < end; i++)
+			{
+				size_t k = c[(key[i] >> shift) & 0xff]++;
+				key_tmp[k] = key[i];
+				index_tmp[k] = index[i];
+			}
+		}
+		key.swap(key_tmp);
+		index.swap(index_tmp);
+	}
+}
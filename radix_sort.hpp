@@ -0,0 +1,23 @@
+#ifndef RADIX_SORT_HPP
+#define RADIX_SORT_HPP
+
+#include <vector>
+#include <cstdint>
+
+/**
+ * @brief Stable parallel LSD radix sort of key and index together by key, 8
+ * bits a pass over the low key_bits bits of the keys.
+ *
+ * Every thread counts its own contiguous chunk, the counts are turned into
+ * starts in digit then thread order and every thread scatters its chunk in
+ * order, so equal keys keep their order whatever the thread count. The
+ * vectors are swapped with the scratch ones after every pass, only the
+ * contents of key and index mean anything afterwards.
+ * @param key_tmp Scratch, resized to match
+ * @param index_tmp Scratch, resized to match
+ */
+void radix_sort(std::vector<uint32_t> &key, std::vector<uint32_t> &index,
+	std::vector<uint32_t> &key_tmp, std::vector<uint32_t> &index_tmp,
+	uint32_t key_bits = 32);
+
+#endif
@@ -0,0 +1,176 @@
+#include "replay_thread.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+replay_thread::replay_thread()
+{
+	max_obj_count = 0;
+	head = 0;
+	queued = 0;
+	next = 0;
+	wanted = 0;
+	generation = 0;
+	running = false;
+	position = 0.0;
+	speed = 30.0;
+	paused = false;
+	shown_count = 0;
+	shown_frame = 0;
+}
+
+replay_thread::~replay_thread()
+{
+	stop();
+}
+
+bool replay_thread::open(const std::string &fname)
+{
+	if(!reader.open(fname))
+		return false;
+	if(reader.get_frame_count() == 0)
+	{
+		printf("ERROR %s has no frames\n", fname.c_str());
+		return false;
+	}
+	max_obj_count = 0;
+	for(size_t k = 0; k < reader.get_frame_count(); k++)
+		max_obj_count = std::max(max_obj_count,
+			reader.get_frame_info(k).obj_count);
+	return true;
+}
+
+void replay_thread::start()
+{
+	if(running)
+		return;
+	running = true;
+	last_update = clock::now();
+	thread = std::thread(&replay_thread::run, this);
+}
+
+void replay_thread::stop()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		running = false;
+	}
+	wake.notify_one();
+	if(thread.joinable())
+		thread.join();
+}
+
+bool replay_thread::update()
+{
+	clock::time_point now = clock::now();
+	double dt = std::chrono::duration<double>(now - last_update).count();
+	last_update = now;
+
+	double last_frame = (double)(reader.get_frame_count() - 1);
+	if(!paused)
+	{
+		position += dt * speed;
+		// stop at either end rather than wrapping
+		if((speed > 0.0 && position >= last_frame) ||
+			(speed < 0.0 && position <= 0.0))
+			paused = true;
+		position = std::min(std::max(position, 0.0), last_frame);
+	}
+	size_t target = (size_t)position;
+
+	bool changed = false;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		// going backwards, or far enough forward that starting from the key
+		// frame is quicker than catching up, throws away what was read ahead
+		if(target < wanted || reader.get_keyframe(target) > next)
+		{
+			next = target;
+			head = 0;
+			queued = 0;
+			generation++;
+		}
+		wanted = target;
+
+		// take the newest frame that isn't past the clock, the reader only
+		// queues frames from wanted on so this skips anything already late
+		while(queued > 0 && slots[head].frame <= target)
+		{
+			shown.swap(slots[head].x);
+			shown_count = slots[head].obj_count;
+			shown_frame = slots[head].frame;
+			head = (head + 1) % ring_size;
+			queued--;
+			changed = true;
+		}
+	}
+	wake.notify_one();
+	return changed;
+}
+
+double replay_thread::get_time()
+{
+	return reader.get_frame_info(shown_frame).time;
+}
+
+void replay_thread::set_speed(double frames_per_second)
+{
+	speed = frames_per_second;
+}
+
+void replay_thread::set_paused(bool paused)
+{
+	// playing again from the end starts over
+	double last_frame = (double)(reader.get_frame_count() - 1);
+	if(!paused && speed > 0.0 && position >= last_frame)
+		position = 0.0;
+	else if(!paused && speed < 0.0 && position <= 0.0)
+		position = last_frame;
+	this->paused = paused;
+	last_update = clock::now();
+}
+
+void replay_thread::seek(double frame)
+{
+	double last_frame = (double)(reader.get_frame_count() - 1);
+	position = std::min(std::max(frame, 0.0), last_frame);
+}
+
+void replay_thread::run()
+{
+	std::unique_lock<std::mutex> guard(lock);
+	while(running)
+	{
+		if(queued == ring_size || next >= reader.get_frame_count())
+		{
+			wake.wait(guard);
+			continue;
+		}
+
+		size_t frame = next;
+		uint64_t gen = generation;
+		// frames before the clock still have to be decoded for the ones
+		// after them but aren't worth converting
+		bool keep = frame >= wanted;
+		slot &s = slots[(head + queued) % ring_size];
+		guard.unlock();
+
+		// the render thread doesn't look at a slot until it is queued
+		bool ok = reader.read_frame(frame);
+		if(ok && keep)
+		{
+			s.frame = frame;
+			s.obj_count = reader.get_obj_count();
+			s.x.resize(3 * (size_t)s.obj_count);
+			reader.get_positions(s.x.data());
+		}
+
+		guard.lock();
+		if(gen != generation)
+			continue;
+		// a corrupt frame ends the replay there, the error is printed
+		next = ok ? frame + 1 : reader.get_frame_count();
+		if(ok && keep)
+			queued++;
+	}
+}
@@ -0,0 +1,112 @@
+#ifndef REPLAY_THREAD_HPP
+#define REPLAY_THREAD_HPP
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+
+#include "trajectory.hpp"
+
+/**
+ * @brief Plays a trajectory file back in place of running the physics. A
+ * reader thread decodes the frames ahead of the one shown into a small ring
+ * of float frames, the render thread picks them up by the playback clock.
+ */
+class replay_thread
+{
+public:
+	replay_thread();
+	virtual ~replay_thread();
+
+	/**
+	 * @return False (with an error printed) if the file couldn't be read
+	 */
+	bool open(const std::string &fname);
+	void start();
+	void stop();
+
+	/**
+	 * @brief Advances the playback clock and picks up the frame it is at if
+	 * it has been decoded, never waits on the reader
+	 * @return True if get_positions() changed
+	 */
+	bool update();
+	/**
+	 * @brief x, y and z of each body of the frame shown
+	 */
+	const std::vector<float> &get_positions(){return shown;}
+	uint32_t get_obj_count(){return shown_count;}
+	/**
+	 * @brief The most bodies in any frame
+	 */
+	uint32_t get_max_obj_count(){return max_obj_count;}
+
+	size_t get_frame_count(){return reader.get_frame_count();}
+	/**
+	 * @brief The frame shown, the playback clock can be ahead of it when
+	 * the reader can't keep up
+	 */
+	size_t get_frame(){return shown_frame;}
+	double get_time();
+
+	/**
+	 * @brief Frames per second of wall clock time, can be fractional
+	 */
+	void set_speed(double frames_per_second);
+	double get_speed(){return speed;}
+	void set_paused(bool paused);
+	bool get_paused(){return paused;}
+	/**
+	 * @brief Moves the playback clock to a frame, clamped to the file
+	 */
+	void seek(double frame);
+	double get_position(){return position;}
+
+private:
+	void run();
+
+	struct slot
+	{
+		size_t frame;
+		uint32_t obj_count;
+		std::vector<float> x;
+	};
+
+	trajectory_reader reader;
+	std::thread thread;
+	uint32_t max_obj_count;
+
+	// the ring and everything the two threads share is under the lock
+	std::mutex lock;
+	std::condition_variable wake;
+	const static uint32_t ring_size = 4;
+	slot slots[ring_size];
+	uint32_t head, queued;
+	/**
+	 * @brief The frame the reader decodes next and the one the clock is at,
+	 * the reader only converts frames from wanted on
+	 */
+	size_t next, wanted;
+	/**
+	 * @brief Goes up on every seek so the reader can drop a frame it was
+	 * converting from before it
+	 */
+	uint64_t generation;
+	bool running;
+
+	// only used by the render thread
+	typedef std::chrono::steady_clock clock;
+	clock::time_point last_update;
+	double position;
+	double speed;
+	bool paused;
+	std::vector<float> shown;
+	uint32_t shown_count;
+	size_t shown_frame;
+};
+
+#endif
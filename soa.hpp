@@ -0,0 +1,156 @@
+#ifndef SOA_HPP
+#define SOA_HPP
+
+#include <vector>
+#include <new>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief Minimal allocator that hands out cache line aligned memory so the
+ * SIMD kernels never split a load across lines at the start of an array.
+ *
+ * resize() default initializes, so new elements of arithmetic types are left
+ * as they are rather than zeroed by the calling thread. A fresh large array
+ * then has no pages until it is first written, and a parallel loop with the
+ * same schedule as the loops that use it places each thread's part on that
+ * thread's NUMA node. Whatever resize() adds has to be written before it is
+ * read.
+ */
+template<typename T, size_t alignment = 64>
+class aligned_allocator
+{
+public:
+	typedef T value_type;
+
+	template<typename U>
+	struct rebind
+	{
+		typedef aligned_allocator<U, alignment> other;
+	};
+
+	aligned_allocator(){}
+	template<typename U>
+	aligned_allocator(const aligned_allocator<U, alignment> &){}
+
+	T *allocate(size_t n)
+	{
+		return (T *)::operator new(n * sizeof(T), std::align_val_t(alignment));
+	}
+
+	void deallocate(T *p, size_t)
+	{
+		::operator delete(p, std::align_val_t(alignment));
+	}
+
+	template<typename U>
+	void construct(U *p)
+	{
+		::new((void *)p) U;
+	}
+	template<typename U, typename... Args>
+	void construct(U *p, Args &&...args)
+	{
+		::new((void *)p) U(std::forward<Args>(args)...);
+	}
+
+	template<typename U>
+	bool operator==(const aligned_allocator<U, alignment> &) const
+	{
+		return true;
+	}
+	template<typename U>
+	bool operator!=(const aligned_allocator<U, alignment> &) const
+	{
+		return false;
+	}
+};
+
+template<typename T>
+using aligned_vector = std::vector<T, aligned_allocator<T>>;
+
+/**
+ * @brief Structure of arrays copy of the bodies that act as gravity sources,
+ * each component is its own contiguous aligned array
+ */
+template<typename T>
+struct basic_body_soa
+{
+	typedef T scalar;
+
+	aligned_vector<T> x;
+	aligned_vector<T> y;
+	aligned_vector<T> z;
+	aligned_vector<T> m;
+	/**
+	 * @brief Velocities, only sized by resize_velocities() for the kernels
+	 * that need them
+	 */
+	aligned_vector<T> vx;
+	aligned_vector<T> vy;
+	aligned_vector<T> vz;
+
+	void resize(size_t n)
+	{
+		x.resize(n);
+		y.resize(n);
+		z.resize(n);
+		m.resize(n);
+	}
+
+	void resize_velocities(size_t n)
+	{
+		vx.resize(n);
+		vy.resize(n);
+		vz.resize(n);
+	}
+
+	size_t size() const {return m.size();}
+};
+
+/**
+ * @brief Massless test particles, they feel the gravity of the bodies but
+ * exert none so nothing else reads them. Every component is its own
+ * contiguous aligned array so the tracer kernels load a block of tracers
+ * per instruction.
+ */
+struct tracer_soa
+{
+	aligned_vector<double> x;
+	aligned_vector<double> y;
+	aligned_vector<double> z;
+	aligned_vector<double> vx;
+	aligned_vector<double> vy;
+	aligned_vector<double> vz;
+	/**
+	 * @brief Acceleration at x, y, z from the bodies at the same time
+	 */
+	aligned_vector<double> ax;
+	aligned_vector<double> ay;
+	aligned_vector<double> az;
+
+	void resize(size_t n)
+	{
+		x.resize(n);
+		y.resize(n);
+		z.resize(n);
+		vx.resize(n);
+		vy.resize(n);
+		vz.resize(n);
+		ax.resize(n);
+		ay.resize(n);
+		az.resize(n);
+	}
+
+	size_t size() const {return x.size();}
+};
+
+typedef basic_body_soa<double> body_soa;
+/**
+ * @brief Single precision sources, half the memory traffic and twice the
+ * SIMD width of body_soa
+ */
+typedef basic_body_soa<float> body_soa_f;
+
+#endif
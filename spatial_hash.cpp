@@ -0,0 +1,147 @@
+#include "spatial_hash.hpp"
+
+#include <algorithm>
+#include <omp.h>
+
+/**
+ * @brief Own cell first then the 13 neighbours with a positive offset in the
+ * first non zero axis from z
+ */
+static const int stencil[14][3] =
+{
+	{0, 0, 0},
+	{-1, -1, 1}, {0, -1, 1}, {1, -1, 1},
+	{-1, 0, 1}, {0, 0, 1}, {1, 0, 1},
+	{-1, 1, 1}, {0, 1, 1}, {1, 1, 1},
+	{-1, 1, 0}, {0, 1, 0}, {1, 1, 0},
+	{1, 0, 0}
+};
+
+spatial_hash::spatial_hash()
+{
+	cell_size = 1.0;
+	inv_cell_size = 1.0;
+	table_mask = 0;
+}
+
+spatial_hash::~spatial_hash()
+{
+
+}
+
+void spatial_hash::build(const std::vector<Eigen::Vector3d> &x,
+	array_view<double> r)
+{
+	int n = (int)x.size();
+
+	double r_max = 0.0;
+	#pragma omp parallel for reduction(max:r_max)
+	for(int i = 0; i < n; i++)
+		r_max = std::max(r_max, r[i]);
+	cell_size = r_max > 0.0 ? 2.0 * r_max : 1.0;
+	inv_cell_size = 1.0 / cell_size;
+
+	// at least twice as many buckets as bodies keeps the chains short
+	uint32_t table_size = 64;
+	while(table_size < 2 * (uint64_t)n && table_size < 0x80000000u)
+		table_size <<= 1;
+	table_mask = table_size - 1;
+
+	bucket_start.assign(table_size + 1, 0);
+	body_bucket.resize(n);
+	sorted.resize(n);
+
+	#pragma omp parallel for
+	for(int i = 0; i < n; i++)
+	{
+		uint32_t b = bucket(cell(x[i][0]), cell(x[i][1]), cell(x[i][2]));
+		body_bucket[i] = b;
+		#pragma omp atomic
+		bucket_start[b]++;
+	}
+
+	// counts to starts
+	uint32_t sum = 0;
+	for(uint32_t b = 0; b < table_size; b++)
+	{
+		uint32_t count = bucket_start[b];
+		bucket_start[b] = sum;
+		sum += count;
+	}
+	bucket_start[table_size] = sum;
+
+	// each body takes the next slot in its bucket, which leaves every start
+	// moved up to the start of the next bucket
+	#pragma omp parallel for
+	for(int i = 0; i < n; i++)
+	{
+		uint32_t b = body_bucket[i];
+		uint32_t k;
+		#pragma omp atomic capture
+		k = bucket_start[b]++;
+		sorted[k] = i;
+	}
+	for(uint32_t b = table_size; b > 0; b--)
+		bucket_start[b] = bucket_start[b - 1];
+	bucket_start[0] = 0;
+}
+
+void spatial_hash::find_pairs(const std::vector<Eigen::Vector3d> &x,
+	array_view<double> r, std::vector<std::pair<uint32_t, uint32_t>> &pairs)
+{
+	int n = (int)x.size();
+	thread_pairs.resize(omp_get_max_threads());
+	for(std::vector<std::pair<uint32_t, uint32_t>> &t : thread_pairs)
+		t.clear();
+
+	#pragma omp parallel
+	{
+		std::vector<std::pair<uint32_t, uint32_t>> &out =
+			thread_pairs[omp_get_thread_num()];
+
+		#pragma omp for
+		for(int i = 0; i < n; i++)
+		{
+			int64_t c[3] = {cell(x[i][0]), cell(x[i][1]), cell(x[i][2])};
+
+			// the body's own cell and the 13 neighbours "after" it, so each pair
+			// of neighbouring cells is only looked at from one side
+			for(int s = 0; s < 14; s++)
+			{
+				int64_t t[3] = {c[0] + stencil[s][0], c[1] + stencil[s][1],
+					c[2] + stencil[s][2]};
+				uint32_t b = bucket(t[0], t[1], t[2]);
+				for(uint32_t k = bucket_start[b]; k < bucket_start[b + 1]; k++)
+				{
+					uint32_t j = sorted[k];
+					// in the own cell each pair is found from the lower index
+					if(s == 0 && j <= (uint32_t)i)
+						continue;
+					double rr = r[i] + r[j];
+					if((x[j] - x[i]).squaredNorm() >= rr * rr)
+						continue;
+					// other cells can share the bucket, only count j from the
+					// cell it is really in
+					if(cell(x[j][0]) != t[0] || cell(x[j][1]) != t[1] ||
+						cell(x[j][2]) != t[2])
+						continue;
+					if(s == 0)
+						out.push_back(std::make_pair((uint32_t)i, j));
+					else
+						out.push_back(std::make_pair(std::min((uint32_t)i, j),
+							std::max((uint32_t)i, j)));
+				}
+			}
+		}
+	}
+
+	size_t total = 0;
+	for(const std::vector<std::pair<uint32_t, uint32_t>> &t : thread_pairs)
+		total += t.size();
+	pairs.clear();
+	pairs.reserve(total);
+	for(const std::vector<std::pair<uint32_t, uint32_t>> &t : thread_pairs)
+		pairs.insert(pairs.end(), t.begin(), t.end());
+	// the buckets fill in whatever order the threads got there
+	std::sort(pairs.begin(), pairs.end());
+}
@@ -0,0 +1,70 @@
+#ifndef SPATIAL_HASH_HPP
+#define SPATIAL_HASH_HPP
+
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <cmath>
+#include <Eigen/Core>
+
+#include "array_view.hpp"
+
+/**
+ * @brief Collision broad phase, a uniform grid of cubes stored in a hash table
+ * so only occupied cells cost memory. The cell side is the largest diameter so
+ * any two overlapping bodies are in the same or neighbouring cells.
+ */
+class spatial_hash
+{
+public:
+	spatial_hash();
+	virtual ~spatial_hash();
+
+	/**
+	 * @brief Bins every body, safe to call every step, the tables keep their
+	 * capacity
+	 * @param x Positions
+	 * @param r Radii, same size as x
+	 */
+	void build(const std::vector<Eigen::Vector3d> &x, array_view<double> r);
+
+	/**
+	 * @brief Finds every pair of bodies that overlap, needs build() with the
+	 * same x and r first
+	 * @param pairs Overwritten with (i, j) for i < j, sorted
+	 */
+	void find_pairs(const std::vector<Eigen::Vector3d> &x,
+		array_view<double> r,
+		std::vector<std::pair<uint32_t, uint32_t>> &pairs);
+
+	double get_cell_size(){return cell_size;}
+
+private:
+	uint32_t bucket(int64_t cx, int64_t cy, int64_t cz) const
+	{
+		// the usual large primes (Teschner et al. 2003)
+		uint64_t h = (uint64_t)cx * 73856093ull ^ (uint64_t)cy * 19349663ull ^
+			(uint64_t)cz * 83492791ull;
+		return (uint32_t)(h & table_mask);
+	}
+	int64_t cell(double c) const
+	{
+		return (int64_t)std::floor(c * inv_cell_size);
+	}
+
+	double cell_size;
+	double inv_cell_size;
+	uint32_t table_mask;
+	/**
+	 * @brief Bodies in bucket b are sorted[bucket_start[b], bucket_start[b + 1])
+	 */
+	std::vector<uint32_t> bucket_start;
+	std::vector<uint32_t> sorted;
+	std::vector<uint32_t> body_bucket;
+	/**
+	 * @brief Pairs found by each OpenMP thread before they are merged
+	 */
+	std::vector<std::vector<std::pair<uint32_t, uint32_t>>> thread_pairs;
+};
+
+#endif
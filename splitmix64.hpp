@@ -0,0 +1,33 @@
+#ifndef SPLITMIX64_HPP
+#define SPLITMIX64_HPP
+
+#include <cstdint>
+
+/**
+ * @brief Tiny random generator (Steele, Lea and Flood 2014) that is free to
+ * seed, so every body can have its own stream. Works with the <random>
+ * distributions.
+ */
+class splitmix64
+{
+public:
+	typedef uint64_t result_type;
+
+	explicit splitmix64(uint64_t seed) : state(seed){}
+
+	static constexpr uint64_t min(){return 0;}
+	static constexpr uint64_t max(){return UINT64_MAX;}
+
+	uint64_t operator()()
+	{
+		uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+		return z ^ (z >> 31);
+	}
+
+private:
+	uint64_t state;
+};
+
+#endif
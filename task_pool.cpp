@@ -0,0 +1,116 @@
+#include "task_pool.hpp"
+
+#include <algorithm>
+#include <omp.h>
+
+static uint64_t pack_range(uint32_t front, uint32_t back)
+{
+	return (uint64_t)back << 32 | front;
+}
+
+task_pool::task_pool()
+{
+	deque_count = 0;
+}
+
+void task_pool::split(uint32_t count, const uint32_t *cost, int threads)
+{
+	if(threads < 1)
+		threads = 1;
+	if(threads != deque_count)
+	{
+		deques.reset(new deque[threads]);
+		deque_count = threads;
+	}
+
+	// cut where the running cost crosses each multiple of total / chunks,
+	// never more chunks than items so none is empty
+	uint32_t chunks = std::min(count, (uint32_t)threads * chunks_per_thread);
+	bounds.assign(1, 0);
+	if(chunks > 0)
+	{
+		uint64_t total = count;
+		if(cost != nullptr)
+		{
+			for(uint32_t i = 0; i < count; i++)
+				total += cost[i];
+		}
+		uint64_t sum = 0;
+		uint32_t next = 1;
+		for(uint32_t i = 0; i < count && next < chunks; i++)
+		{
+			sum += 1 + (cost != nullptr ? cost[i] : 0);
+			if((double)sum * chunks >= (double)total * next)
+			{
+				bounds.push_back(i + 1);
+				next++;
+			}
+		}
+		bounds.push_back(count);
+	}
+
+	// contiguous runs of chunks so a thread works on neighbouring items
+	uint32_t made = (uint32_t)bounds.size() - 1;
+	for(int t = 0; t < threads; t++)
+	{
+		uint32_t front = (uint32_t)((uint64_t)made * t / threads);
+		uint32_t back = (uint32_t)((uint64_t)made * (t + 1) / threads);
+		deques[t].range.store(pack_range(front, back),
+			std::memory_order_relaxed);
+	}
+}
+
+bool task_pool::next(uint32_t &begin, uint32_t &end)
+{
+	int t = omp_get_thread_num() % deque_count;
+	uint32_t c;
+	if(!pop(t, c) && !steal(t, c))
+		return false;
+	begin = bounds[c];
+	end = bounds[c + 1];
+	return true;
+}
+
+bool task_pool::pop(int t, uint32_t &c)
+{
+	std::atomic<uint64_t> &range = deques[t].range;
+	uint64_t r = range.load(std::memory_order_relaxed);
+	while(true)
+	{
+		uint32_t front = (uint32_t)r;
+		uint32_t back = (uint32_t)(r >> 32);
+		if(front >= back)
+			return false;
+		if(range.compare_exchange_weak(r, pack_range(front + 1, back),
+			std::memory_order_relaxed))
+		{
+			c = front;
+			return true;
+		}
+	}
+}
+
+bool task_pool::steal(int t, uint32_t &c)
+{
+	// nothing is ever added, so once every run has been seen empty the
+	// work is done
+	for(int k = 1; k < deque_count; k++)
+	{
+		std::atomic<uint64_t> &range = deques[(t + k) % deque_count].range;
+		uint64_t r = range.load(std::memory_order_relaxed);
+		while(true)
+		{
+			uint32_t front = (uint32_t)r;
+			uint32_t back = (uint32_t)(r >> 32);
+			if(front >= back)
+				break;
+			if(range.compare_exchange_weak(r, pack_range(front, back - 1),
+				std::memory_order_relaxed))
+			{
+				c = back - 1;
+				return true;
+			}
+		}
+	}
+	return false;
+}
@@ -0,0 +1,75 @@
+#ifndef TASK_POOL_HPP
+#define TASK_POOL_HPP
+
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+
+/**
+ * @brief Work stealing over the threads of an OpenMP parallel region for
+ * loops whose items cost very different amounts.
+ *
+ * split() cuts [0, count) into contiguous chunks of about equal estimated
+ * cost and deals each thread a contiguous run of them, so a thread starts on
+ * neighbouring items. In next() every thread takes chunks from the front of
+ * its own run, then steals from the back of the others' until every run is
+ * empty. A run is one atomic word holding its front and back, so taking a
+ * chunk from either end is a single compare and swap.
+ */
+class task_pool
+{
+public:
+	/**
+	 * @brief Chunks every thread is dealt, more lets the stealing even out
+	 * worse estimates for more atomic operations
+	 */
+	constexpr static uint32_t chunks_per_thread = 16;
+
+	task_pool();
+
+	/**
+	 * @brief Cuts [0, count) into chunks for threads threads, call it outside
+	 * the parallel region next() is called in
+	 * @param cost Estimated cost of every item, nullptr if they all cost the
+	 * same. Each item counts as at least 1 so unmeasured items still spread.
+	 */
+	void split(uint32_t count, const uint32_t *cost, int threads);
+
+	/**
+	 * @brief Takes a chunk for the calling thread, from the front of its own
+	 * run while it lasts then from the back of the others'. Every thread of
+	 * the parallel region calls this until it returns false. A smaller team
+	 * than split() was told about is fine, the runs of the missing threads
+	 * get stolen.
+	 */
+	bool next(uint32_t &begin, uint32_t &end);
+
+private:
+	/**
+	 * @brief Takes the front chunk of run t
+	 */
+	bool pop(int t, uint32_t &c);
+	/**
+	 * @brief Takes the back chunk of the first run after t that has one
+	 */
+	bool steal(int t, uint32_t &c);
+
+	/**
+	 * @brief The chunks [front, back) left in one thread's run, front in the
+	 * low half, on its own cache line
+	 */
+	struct alignas(64) deque
+	{
+		std::atomic<uint64_t> range;
+	};
+
+	std::unique_ptr<deque[]> deques;
+	int deque_count;
+	/**
+	 * @brief Chunk c is [bounds[c], bounds[c + 1])
+	 */
+	std::vector<uint32_t> bounds;
+};
+
+#endif
@@ -0,0 +1,472 @@
+#include "trajectory.hpp"
+
+#include <cmath>
+#include <cstring>
+
+static const char trajectory_magic[8] = {'G', 'S', 'I', 'M', '2', 'T', 'R',
+	'J'};
+static const char index_magic[8] = {'G', 'S', 'I', 'M', '2', 'I', 'D', 'X'};
+
+static void put_varint(std::vector<uint8_t> &out, int64_t v)
+{
+	// zigzag so small negative numbers are small too
+	uint64_t u = ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+	while(u >= 0x80)
+	{
+		out.push_back((uint8_t)(u | 0x80));
+		u >>= 7;
+	}
+	out.push_back((uint8_t)u);
+}
+
+static bool get_varint(const uint8_t *&p, const uint8_t *end, int64_t &v)
+{
+	uint64_t u = 0;
+	for(int shift = 0; shift < 64; shift += 7)
+	{
+		if(p == end)
+			return false;
+		uint8_t b = *p++;
+		u |= (uint64_t)(b & 0x7f) << shift;
+		if(!(b & 0x80))
+		{
+			v = (int64_t)(u >> 1) ^ -(int64_t)(u & 1);
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * @brief The value each body is stored relative to: the previous body in a
+ * key frame, otherwise the previous frame or a straight line through the two
+ * before it
+ */
+static int64_t predict(const std::vector<int64_t> &q1,
+	const std::vector<int64_t> &q2, const std::vector<int64_t> &cur,
+	uint32_t since_key, size_t k)
+{
+	if(since_key == 0)
+		return k >= 3 ? cur[k - 3] : 0;
+	if(since_key == 1)
+		return q1[k];
+	return 2 * q1[k] - q2[k];
+}
+
+trajectory_writer::trajectory_writer()
+{
+	file = NULL;
+	quantum = 1.0;
+	keyframe_interval = 16;
+	head = 0;
+	queued = 0;
+	closing = false;
+	since_key = 0;
+	failed = false;
+	frames_written = 0;
+	frames_dropped = 0;
+	bytes_written = 0;
+	raw_bytes = 0;
+}
+
+trajectory_writer::~trajectory_writer()
+{
+	close();
+}
+
+bool trajectory_writer::open(const std::string &fname, double quantum,
+	uint32_t keyframe_interval, uint32_t queue_frames)
+{
+	close();
+
+	file = fopen(fname.c_str(), "wb");
+	if(file == NULL)
+	{
+		printf("ERROR couldn't open %s\n", fname.c_str());
+		return false;
+	}
+
+	this->quantum = quantum;
+	this->keyframe_interval = keyframe_interval > 0 ? keyframe_interval : 1;
+	slots.resize(queue_frames > 0 ? queue_frames : 1);
+	head = 0;
+	queued = 0;
+	closing = false;
+	index.clear();
+	since_key = 0;
+	failed = false;
+	frames_written = 0;
+	frames_dropped = 0;
+	bytes_written = 0;
+	raw_bytes = 0;
+
+	trajectory_header h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, trajectory_magic, sizeof(h.magic));
+	h.version = trajectory_version;
+	h.byte_order = 0x01020304;
+	h.quantum = quantum;
+	h.keyframe_interval = this->keyframe_interval;
+	if(!write(&h, sizeof(h)))
+	{
+		printf("ERROR couldn't write %s\n", fname.c_str());
+		fclose(file);
+		file = NULL;
+		return false;
+	}
+
+	thread = std::thread(&trajectory_writer::run, this);
+	return true;
+}
+
+bool trajectory_writer::close()
+{
+	if(file == NULL)
+		return true;
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		closing = true;
+	}
+	wake.notify_one();
+	thread.join();
+
+	trajectory_footer footer;
+	footer.index_offset = bytes_written;
+	footer.frame_count = index.size();
+	memcpy(footer.magic, index_magic, sizeof(footer.magic));
+	write(index.data(), index.size() * sizeof(trajectory_index_entry));
+	write(&footer, sizeof(footer));
+	if(fclose(file) != 0)
+		failed = true;
+	file = NULL;
+
+	std::vector<slot> n;
+	slots.swap(n);
+	return !failed;
+}
+
+bool trajectory_writer::push(uint64_t step, double time,
+	array_view<Eigen::Vector3d> x, array_view<uint32_t> order)
+{
+	uint32_t s;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if(queued == slots.size())
+		{
+			frames_dropped++;
+			return false;
+		}
+		s = (head + queued) % slots.size();
+	}
+
+	// the writer thread doesn't touch a slot until it is queued so the copy
+	// can happen outside the lock, the vector keeps its capacity between uses
+	slots[s].step = step;
+	slots[s].time = time;
+	if(order.empty())
+		slots[s].x.assign(x.begin(), x.end());
+	else
+	{
+		slots[s].x.resize(order.size());
+		for(size_t k = 0; k < order.size(); k++)
+			slots[s].x[k] = x[order[k]];
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		queued++;
+	}
+	wake.notify_one();
+	return true;
+}
+
+void trajectory_writer::run()
+{
+	std::unique_lock<std::mutex> guard(lock);
+	while(true)
+	{
+		wake.wait(guard, [this]{return queued > 0 || closing;});
+		if(queued == 0)
+			break;
+		uint32_t s = head;
+		guard.unlock();
+
+		encode(slots[s]);
+
+		guard.lock();
+		head = (head + 1) % slots.size();
+		queued--;
+	}
+}
+
+void trajectory_writer::encode(const slot &s)
+{
+	size_t n = s.x.size();
+	size_t frame = index.size();
+	std::vector<int64_t> &cur = q[frame % 3];
+	const std::vector<int64_t> &q1 = q[(frame + 2) % 3];
+	const std::vector<int64_t> &q2 = q[(frame + 1) % 3];
+
+	// prediction needs the same bodies in the frames before
+	if(since_key >= keyframe_interval || frame == 0 || q1.size() != 3 * n)
+		since_key = 0;
+
+	cur.resize(3 * n);
+	double inv_quantum = 1.0 / quantum;
+	for(size_t i = 0; i < n; i++)
+	{
+		for(int k = 0; k < 3; k++)
+		{
+			double v = std::nearbyint(s.x[i][k] * inv_quantum);
+			// anything that doesn't fit (or is NaN) is pinned to the edge
+			// rather than being undefined
+			if(!(v > -4e18))
+				v = -4e18;
+			if(v > 4e18)
+				v = 4e18;
+			cur[3 * i + k] = (int64_t)v;
+		}
+	}
+
+	payload.clear();
+	// axis by axis, the differences on one axis are more alike
+	for(int k = 0; k < 3; k++)
+	{
+		for(size_t i = 0; i < n; i++)
+		{
+			size_t j = 3 * i + k;
+			put_varint(payload, cur[j] - predict(q1, q2, cur, since_key, j));
+		}
+	}
+
+	trajectory_index_entry e;
+	e.offset = bytes_written;
+	e.step = s.step;
+	e.time = s.time;
+	e.obj_count = (uint32_t)n;
+	e.flags = since_key == 0 ? trajectory_keyframe : 0;
+
+	trajectory_frame_header h;
+	h.obj_count = e.obj_count;
+	h.flags = e.flags;
+	h.step = e.step;
+	h.time = e.time;
+	h.payload_size = payload.size();
+	write(&h, sizeof(h));
+	write(payload.data(), payload.size());
+
+	index.push_back(e);
+	since_key++;
+	frames_written++;
+	raw_bytes += n * sizeof(Eigen::Vector3d);
+}
+
+bool trajectory_writer::write(const void *data, size_t size)
+{
+	if(size > 0 && fwrite(data, 1, size, file) != size)
+	{
+		if(!failed)
+			printf("ERROR couldn't write trajectory\n");
+		failed = true;
+		return false;
+	}
+	bytes_written += size;
+	return true;
+}
+
+trajectory_reader::trajectory_reader()
+{
+	quantum = 1.0;
+	last = 0;
+	valid = false;
+	obj_count = 0;
+}
+
+trajectory_reader::~trajectory_reader()
+{
+	close();
+}
+
+bool trajectory_reader::open(const std::string &fname)
+{
+	close();
+	if(!file.open(fname))
+		return false;
+
+	const uint8_t *base = file.data();
+	size_t size = file.size();
+	// everything past the header can start at any byte after a varint
+	// payload, so the structs are copied out rather than read in place
+	trajectory_header hdr;
+	if(size >= sizeof(hdr))
+		memcpy(&hdr, base, sizeof(hdr));
+	const trajectory_header *h = &hdr;
+	if(size < sizeof(trajectory_header) ||
+		memcmp(h->magic, trajectory_magic, sizeof(h->magic)) != 0)
+	{
+		printf("ERROR %s is not a trajectory\n", fname.c_str());
+		close();
+		return false;
+	}
+	if(h->byte_order != 0x01020304 || h->version != trajectory_version)
+	{
+		printf("ERROR %s is trajectory version %u or the other byte order, "
+			"this reads version %u\n", fname.c_str(), h->version,
+			trajectory_version);
+		close();
+		return false;
+	}
+	quantum = h->quantum;
+
+	bool indexed = false;
+	if(size >= sizeof(trajectory_header) + sizeof(trajectory_footer))
+	{
+		trajectory_footer footer;
+		memcpy(&footer, base + size - sizeof(footer), sizeof(footer));
+		const trajectory_footer *f = &footer;
+		uint64_t index_end = size - sizeof(trajectory_footer);
+		if(memcmp(f->magic, index_magic, sizeof(f->magic)) == 0 &&
+			f->index_offset >= sizeof(trajectory_header) &&
+			f->index_offset <= index_end && (index_end - f->index_offset) /
+			sizeof(trajectory_index_entry) == f->frame_count)
+		{
+			index.resize(f->frame_count);
+			memcpy(index.data(), base + f->index_offset,
+				f->frame_count * sizeof(trajectory_index_entry));
+			indexed = true;
+		}
+	}
+
+	// without an index walk the frame headers, stopping at the first one
+	// that was cut off
+	uint64_t offset = sizeof(trajectory_header);
+	if(!indexed)
+		printf("WARNING %s has no index, scanning it\n", fname.c_str());
+	while(!indexed && size - offset >= sizeof(trajectory_frame_header))
+	{
+		trajectory_frame_header frame_header;
+		memcpy(&frame_header, base + offset, sizeof(frame_header));
+		const trajectory_frame_header *fh = &frame_header;
+		if(fh->payload_size > size - offset - sizeof(trajectory_frame_header))
+			break;
+		trajectory_index_entry e;
+		e.offset = offset;
+		e.step = fh->step;
+		e.time = fh->time;
+		e.obj_count = fh->obj_count;
+		e.flags = fh->flags;
+		index.push_back(e);
+		offset += sizeof(trajectory_frame_header) + fh->payload_size;
+	}
+
+	for(const trajectory_index_entry &e : index)
+	{
+		if(e.offset > size || size - e.offset < sizeof(trajectory_frame_header))
+		{
+			printf("ERROR %s has a bad index\n", fname.c_str());
+			close();
+			return false;
+		}
+	}
+	if(!index.empty() && !(index[0].flags & trajectory_keyframe))
+	{
+		printf("ERROR %s doesn't start with a key frame\n", fname.c_str());
+		close();
+		return false;
+	}
+	return true;
+}
+
+void trajectory_reader::close()
+{
+	file.close();
+	index.clear();
+	for(std::vector<int64_t> &v : q)
+	{
+		std::vector<int64_t> n;
+		v.swap(n);
+	}
+	valid = false;
+	obj_count = 0;
+}
+
+bool trajectory_reader::read_frame(size_t frame)
+{
+	if(frame >= index.size())
+		return false;
+	if(valid && frame == last)
+		return true;
+
+	// carry on from the last frame when it is the one before, otherwise
+	// start again from the key frame
+	size_t start = frame;
+	if(!(valid && frame == last + 1))
+		start = get_keyframe(frame);
+
+	for(size_t f = start; f <= frame; f++)
+	{
+		if(!decode(f))
+		{
+			valid = false;
+			return false;
+		}
+	}
+	return true;
+}
+
+bool trajectory_reader::decode(size_t frame)
+{
+	const trajectory_index_entry &e = index[frame];
+	trajectory_frame_header fh;
+	memcpy(&fh, file.data() + e.offset, sizeof(fh));
+	const trajectory_frame_header *h = &fh;
+	const uint8_t *p = file.data() + e.offset + sizeof(fh);
+	const uint8_t *end = file.data() + file.size();
+	if(h->payload_size > (uint64_t)(end - p))
+	{
+		printf("ERROR trajectory frame %zu is cut off\n", frame);
+		return false;
+	}
+	end = p + h->payload_size;
+
+	uint32_t since_key = 0;
+	if(!(h->flags & trajectory_keyframe))
+	{
+		since_key = 1;
+		if(frame >= 2 && !(index[frame - 1].flags & trajectory_keyframe))
+			since_key = 2;
+	}
+
+	size_t n = h->obj_count;
+	std::vector<int64_t> &cur = q[frame % 3];
+	const std::vector<int64_t> &q1 = q[(frame + 2) % 3];
+	const std::vector<int64_t> &q2 = q[(frame + 1) % 3];
+	if((since_key > 0 && q1.size() != 3 * n) ||
+		(since_key > 1 && q2.size() != 3 * n))
+	{
+		printf("ERROR trajectory frame %zu doesn't follow on\n", frame);
+		return false;
+	}
+
+	cur.resize(3 * n);
+	for(int k = 0; k < 3; k++)
+	{
+		for(size_t i = 0; i < n; i++)
+		{
+			size_t j = 3 * i + k;
+			int64_t d;
+			if(!get_varint(p, end, d))
+			{
+				printf("ERROR trajectory frame %zu is corrupt\n", frame);
+				return false;
+			}
+			cur[j] = d + predict(q1, q2, cur, since_key, j);
+		}
+	}
+
+	last = frame;
+	valid = true;
+	obj_count = (uint32_t)n;
+	return true;
+}
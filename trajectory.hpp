@@ -0,0 +1,240 @@
+#ifndef TRAJECTORY_HPP
+#define TRAJECTORY_HPP
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdio>
+#include <cstdint>
+#include <Eigen/Core>
+
+#include "array_view.hpp"
+#include "mapped_file.hpp"
+
+/**
+ * @brief Trajectory files are a header, the frames one after the other and
+ * an index of the frames at the end.
+ *
+ * Positions are stored as integer multiples of the header's quantum. A key
+ * frame stores each axis as the difference from the previous body, the
+ * frames after it store the difference from a linear prediction out of the
+ * two frames before (just the previous frame for the first one). The
+ * differences are zigzag varints so slow bodies take a byte or two an axis.
+ */
+struct trajectory_header
+{
+	/**
+	 * @brief "GSIM2TRJ"
+	 */
+	char magic[8];
+	uint32_t version;
+	/**
+	 * @brief 0x01020304 as written
+	 */
+	uint32_t byte_order;
+	double quantum;
+	uint32_t keyframe_interval;
+	uint32_t reserved[9];
+};
+
+struct trajectory_frame_header
+{
+	uint32_t obj_count;
+	/**
+	 * @brief trajectory_keyframe if the frame doesn't depend on earlier ones
+	 */
+	uint32_t flags;
+	/**
+	 * @brief The step the frame was taken after, frames can be dropped so
+	 * this doesn't have to follow on from the one before
+	 */
+	uint64_t step;
+	double time;
+	uint64_t payload_size;
+};
+
+/**
+ * @brief One per frame in the index, offset is where the frame header is
+ */
+struct trajectory_index_entry
+{
+	uint64_t offset;
+	uint64_t step;
+	double time;
+	uint32_t obj_count;
+	uint32_t flags;
+};
+
+/**
+ * @brief The last bytes of a finished file
+ */
+struct trajectory_footer
+{
+	uint64_t index_offset;
+	uint64_t frame_count;
+	/**
+	 * @brief "GSIM2IDX"
+	 */
+	char magic[8];
+};
+
+const uint32_t trajectory_version = 1;
+const uint32_t trajectory_keyframe = 1;
+
+/**
+ * @brief Writes frames from a background thread so the thread pushing them
+ * never waits on quantizing, compressing or the disk. Frames are copied into
+ * a fixed number of slots, if they are all waiting to be written the frame
+ * is dropped (and counted) instead.
+ */
+class trajectory_writer
+{
+public:
+	trajectory_writer();
+	virtual ~trajectory_writer();
+
+	/**
+	 * @param quantum Positions are rounded to multiples of this
+	 * @param keyframe_interval A key frame every this many frames, lower
+	 * makes seeking faster and the file bigger
+	 * @param queue_frames Frames that can wait to be written
+	 * @return False (with an error printed) if the file couldn't be opened
+	 */
+	bool open(const std::string &fname, double quantum,
+		uint32_t keyframe_interval = 16, uint32_t queue_frames = 4);
+	/**
+	 * @brief Writes everything still queued and the index, then closes the
+	 * file
+	 * @return False if any write failed
+	 */
+	bool close();
+
+	/**
+	 * @brief Queues a copy of x, only the copy is done on the calling thread
+	 * @param order If not empty the frame is x[order[k]] for every k, the
+	 * body order has to stay the same between frames for the deltas
+	 * @return False if the frame was dropped
+	 */
+	bool push(uint64_t step, double time, array_view<Eigen::Vector3d> x,
+		array_view<uint32_t> order = array_view<uint32_t>());
+
+	uint64_t get_frames_written(){return frames_written;}
+	uint64_t get_frames_dropped(){return frames_dropped;}
+	/**
+	 * @brief Bytes written to the file so far
+	 */
+	uint64_t get_bytes_written(){return bytes_written;}
+	/**
+	 * @brief What the written frames would take as raw doubles
+	 */
+	uint64_t get_raw_bytes(){return raw_bytes;}
+
+private:
+	struct slot
+	{
+		uint64_t step;
+		double time;
+		std::vector<Eigen::Vector3d> x;
+	};
+
+	void run();
+	void encode(const slot &s);
+	bool write(const void *data, size_t size);
+
+	FILE *file;
+	double quantum;
+	uint32_t keyframe_interval;
+
+	/**
+	 * @brief A ring, slots [head, head + queued) are waiting to be written
+	 */
+	std::vector<slot> slots;
+	uint32_t head, queued;
+	bool closing;
+	std::mutex lock;
+	std::condition_variable wake;
+	std::thread thread;
+
+	// only used by the writer thread
+	std::vector<int64_t> q[3];
+	std::vector<uint8_t> payload;
+	std::vector<trajectory_index_entry> index;
+	uint32_t since_key;
+	bool failed;
+
+	std::atomic<uint64_t> frames_written, frames_dropped;
+	std::atomic<uint64_t> bytes_written, raw_bytes;
+};
+
+/**
+ * @brief Reads a trajectory file through a memory map. Reading the frame after
+ * the last one read only decodes that frame, anything else decodes from the
+ * key frame before it.
+ */
+class trajectory_reader
+{
+public:
+	trajectory_reader();
+	virtual ~trajectory_reader();
+
+	/**
+	 * @brief Files without an index (the writer didn't finish) are scanned
+	 * for their frames instead
+	 * @return False (with an error printed) if it isn't a trajectory file
+	 */
+	bool open(const std::string &fname);
+	void close();
+
+	size_t get_frame_count() const {return index.size();}
+	const trajectory_index_entry &get_frame_info(size_t frame) const
+	{
+		return index[frame];
+	}
+	double get_quantum() const {return quantum;}
+	/**
+	 * @brief The key frame decoding frame has to start from
+	 */
+	size_t get_keyframe(size_t frame) const
+	{
+		while(frame > 0 && !(index[frame].flags & trajectory_keyframe))
+			frame--;
+		return frame;
+	}
+
+	/**
+	 * @brief Decodes a frame, get_obj_count() and get_positions() then
+	 * return it
+	 * @return False (with an error printed) if the frame is corrupt
+	 */
+	bool read_frame(size_t frame);
+	uint32_t get_obj_count() const {return obj_count;}
+	/**
+	 * @brief Writes x, y and z of each body of the last read frame to out
+	 */
+	template<typename T>
+	void get_positions(T *out) const
+	{
+		const std::vector<int64_t> &cur = q[last % 3];
+		for(size_t i = 0; i < 3 * (size_t)obj_count; i++)
+			out[i] = (T)(cur[i] * quantum);
+	}
+
+private:
+	bool decode(size_t frame);
+
+	mapped_file file;
+	double quantum;
+	std::vector<trajectory_index_entry> index;
+	/**
+	 * @brief The decoded frames last, last - 1 and last - 2 at [frame % 3]
+	 */
+	std::vector<int64_t> q[3];
+	size_t last;
+	bool valid;
+	uint32_t obj_count;
+};
+
+#endif
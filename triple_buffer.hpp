@@ -0,0 +1,71 @@
+#ifndef TRIPLE_BUFFER_HPP
+#define TRIPLE_BUFFER_HPP
+
+#include <atomic>
+#include <cstdint>
+
+/**
+ * @brief Lock free single producer single consumer triple buffer
+ *
+ * The writer fills write_buffer() and calls publish(), the reader calls
+ * update() and then uses read_buffer(). Neither side ever waits on the other,
+ * the reader always gets the newest published buffer and skipped buffers are
+ * simply overwritten.
+ */
+template<typename T>
+class triple_buffer
+{
+public:
+	triple_buffer()
+	{
+		back = 0;
+		middle.store(1, std::memory_order_relaxed);
+		front = 2;
+	}
+
+	/**
+	 * @brief The buffer the writer owns, only the writer thread may touch it
+	 */
+	T &write_buffer(){return buffers[back];}
+
+	/**
+	 * @brief Hands the write buffer over to the reader and gets a free one back
+	 */
+	void publish()
+	{
+		uint8_t old = middle.exchange(back | fresh, std::memory_order_acq_rel);
+		back = old & index_mask;
+	}
+
+	/**
+	 * @brief Picks up the newest published buffer if there is one
+	 * @return True if read_buffer() changed
+	 */
+	bool update()
+	{
+		if(!(middle.load(std::memory_order_relaxed) & fresh))
+			return false;
+		uint8_t old = middle.exchange(front, std::memory_order_acq_rel);
+		front = old & index_mask;
+		return true;
+	}
+
+	/**
+	 * @brief The buffer the reader owns, only the reader thread may touch it
+	 */
+	const T &read_buffer() const {return buffers[front];}
+
+private:
+	const static uint8_t index_mask = 0x3;
+	/**
+	 * @brief Set on the middle index when it holds something not read yet
+	 */
+	const static uint8_t fresh = 0x4;
+
+	T buffers[3];
+	uint8_t back;
+	std::atomic<uint8_t> middle;
+	uint8_t front;
+};
+
+#endif